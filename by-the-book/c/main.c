@@ -1,13 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
+#include "src/cache.h"
 #include "src/common.h"
+#include "src/jit.h"
+#include "src/profile.h"
 #include "src/scanner.h"
 #include "src/vm.h"
 #include "src/test/unit.h"
 
 const char* VERSION = "v0.0.1";
 bool DEBUG_TRACE = false;
+bool REGISTER_VM = false;
+int JIT_THRESHOLD = JIT_DEFAULT_THRESHOLD;
+bool PROFILING = false;
+bool PROFILE_OPS = false;
+bool PROFILE_STACKS = false;
+bool PROFILE_LINES = false;
+bool PROFILE_HEAP = false;
+bool PROFILE_MAPS = false;
+bool PROFILE_EVENTS = false;
 
 static void repl(void) {
     char line[1<<20] = {0};
@@ -57,16 +70,88 @@ int main(int argc, char** argv) {
 #define EQ(a, b) (strncmp(a, b, 1024) == 0)
     bool test = false;
     bool ran = false;
+    bool cache = false;
+    const char* cacheDir = NULL;
+    const char* profileJson = NULL;
+    const char* profileStacks = NULL;
+    FILE* heatmap = NULL;
     for (int i = 1; i < argc; i++) {
         if (EQ(argv[i], "--debug") || EQ(argv[i], "-d")) {
             DEBUG_TRACE = true;
+            setHooks(getHooks() | HOOK_TRACE);
             ERR_PRINT("====== DEBUG_TRACE=true\n");
+        } else if (EQ(argv[i], "--debug-signal")) {
+            if (!profileHooksOnSignal(HOOK_TRACE)) {
+                ERR_PRINT("Error: could not handle SIGUSR1\n");
+            }
+        } else if (EQ(argv[i], "--reg")) {
+            REGISTER_VM = true;
+        } else if (EQ(argv[i], "--no-jit")) {
+            JIT_THRESHOLD = 0;
+        } else if (EQ(argv[i], "--jit-eager")) {
+            JIT_THRESHOLD = 1;
+        } else if (EQ(argv[i], "--profile-ops") || EQ(argv[i], "--profile-json")) {
+            // Only the stack VM counts instructions, so everything has to run there
+            PROFILE_OPS = true;
+            PROFILING = true;
+            REGISTER_VM = false;
+            JIT_THRESHOLD = 0;
+            setHooks(getHooks() | HOOK_PROFILE);
+            profileStart();
+            if (EQ(argv[i], "--profile-json")) {
+                profileJson = argv[i + 1];
+                i++;
+            }
+        } else if (EQ(argv[i], "--profile")) {
+            // Samples are taken between stack VM instructions, like --profile-ops
+            REGISTER_VM = false;
+            JIT_THRESHOLD = 0;
+            profileStacks = argv[i + 1];
+            i++;
+            PROFILE_STACKS = profileStacksStart();
+            if (!PROFILE_STACKS) {
+                ERR_PRINT("Error: could not start the SIGPROF timer\n");
+            }
+            PROFILING = PROFILING || PROFILE_STACKS;
+            if (PROFILE_STACKS) {
+                setHooks(getHooks() | HOOK_PROFILE);
+            }
+        } else if (EQ(argv[i], "--heatmap")) {
+            REGISTER_VM = false;
+            JIT_THRESHOLD = 0;
+            heatmap = fopen(argv[i + 1], "w");
+            if (!heatmap) {
+                ERR_PRINT("Error: could not write %s\n", argv[i + 1]);
+            }
+            i++;
+            PROFILE_LINES = heatmap != NULL;
+            PROFILING = PROFILING || PROFILE_LINES;
+            if (PROFILE_LINES) {
+                setHooks(getHooks() | HOOK_PROFILE);
+            }
+        } else if (EQ(argv[i], "--heap-stats")) {
+            PROFILE_HEAP = true;
+            PROFILING = true;
+        } else if (EQ(argv[i], "--stats")) {
+            PROFILE_MAPS = true;
+        } else if (EQ(argv[i], "--trace-events")) {
+            // Spans begin and end where the stack VM calls and returns
+            REGISTER_VM = false;
+            JIT_THRESHOLD = 0;
+            PROFILE_EVENTS = profileEventsStart(argv[i + 1]);
+            if (!PROFILE_EVENTS) {
+                ERR_PRINT("Error: could not write %s\n", argv[i + 1]);
+            }
+            i++;
+        } else if (EQ(argv[i], "--trace-min")) {
+            profileEventsThreshold(strtod(argv[i + 1], NULL));
+            i++;
         } else if (EQ(argv[i], "--tests")) {
             test = true;
             ran = true;
         } else if (EQ(argv[i], "--help") || EQ(argv[i], "-h")) {
             ERR_PRINT("roguh's Lox C VM (2025) version %s\n"
-                   "Usage: %s [--debug] [--command|-c string] [--tests] [FILES...]\n"
+                   "Usage: %s [--debug] [--debug-signal] [--reg] [--no-jit] [--jit-eager] [--profile-ops] [--profile-json FILE] [--profile FILE] [--heatmap FILE] [--heap-stats] [--stats] [--trace-events FILE] [--trace-min MICROS] [--command|-c string] [--tests] [--cache] [--cache-dir DIR] [FILES...]\n"
                    "\n"
                    "(no arguments)\n"
                    "    Start a REPL.\n"
@@ -78,8 +163,45 @@ int main(int argc, char** argv) {
                    "    Compile and print the given CODE as c-lox bytecode.\n"
                    "--debug\n"
                    "    Enable debug-level tracing commands.\n"
+                   "--debug-signal\n"
+                   "    Turn the instruction trace of --debug on and off each time the process gets SIGUSR1.\n"
+                   "    Costs nothing while off. Only the stack VM traces, add --no-jit to see everything.\n"
+                   "--reg\n"
+                   "    Run on the register VM, functions it cannot lower stay on the stack VM.\n"
+                   "--no-jit\n"
+                   "    Never compile hot functions or trace hot loops to x86-64 machine code.\n"
+                   "--jit-eager\n"
+                   "    Compile and trace on the first call or back-edge instead of after %d of them.\n"
+                   "--profile-ops\n"
+                   "    Count the instructions run per opcode, opcode pair and opcode triple and time a\n"
+                   "    sample of them. Prints the tables to stderr at exit. Runs everything on the stack VM.\n"
+                   "--profile-json FILE\n"
+                   "    Like --profile-ops but write the counts to FILE as JSON instead.\n"
+                   "--profile FILE\n"
+                   "    Sample the Lox call stack about 1000 times per CPU second and write the samples\n"
+                   "    to FILE at exit as folded stacks for flame graph tools. Runs everything on the stack VM.\n"
+                   "--heatmap FILE\n"
+                   "    Count the instructions run and the bytes allocated on each source line and write\n"
+                   "    the files and commands that follow to FILE, annotated with them. Runs everything on the stack VM.\n"
+                   "--heap-stats\n"
+                   "    Account every allocation and print to stderr at exit the heap totals and peak, objects\n"
+                   "    by type, the sites allocating the most and the interned strings.\n"
+                   "    heapSnapshot(path) writes the object graph at any time, with or without this.\n"
+                   "--stats\n"
+                   "    Print to stderr the load and probe lengths of the globals and interned strings\n"
+                   "    tables after each file or command. mapstats(map) returns the same for any hashmap.\n"
+                   "--trace-events FILE\n"
+                   "    Time every Lox call, native call and compile phase and write them to FILE at exit as\n"
+                   "    Chrome trace events, for chrome://tracing or Perfetto. Runs everything on the stack VM.\n"
+                   "--trace-min MICROS\n"
+                   "    Only keep the trace events that took at least MICROS microseconds.\n"
                    "--tests\n"
                    "    Run internal language tests.\n"
+                   "--cache\n"
+                   "    Load the FILES that follow from precompiled .loxc bytecode next to them,\n"
+                   "    compiling and writing it first when missing or out of date.\n"
+                   "--cache-dir DIR\n"
+                   "    Like --cache but keep the .loxc files in DIR, named by content hash.\n"
                    "FILES\n"
                    "    Runs each file and -c/--code command in order.\n"
                    "-h or --help\n"
@@ -89,11 +211,21 @@ int main(int argc, char** argv) {
                    "\n"
                    "\n"
                    "Happy coding!\n",
-                   VERSION, argv[0], VERSION
+                   VERSION, argv[0], JIT_DEFAULT_THRESHOLD, VERSION
             );
             return 0;
+        } else if (EQ(argv[i], "--cache")) {
+            cache = true;
+        } else if (EQ(argv[i], "--cache-dir")) {
+            cache = true;
+            cacheDir = argv[i + 1];
+            mkdir(cacheDir, 0755);
+            i++;
         } else if (EQ(argv[i], "-c") || EQ(argv[i], "--command")) {
             interpret(argv[i + 1]);
+            if (heatmap) {
+                profileLinesReport(heatmap, "<command>", argv[i + 1]);
+            }
             i++;
             ran = true;
         } else if (EQ(argv[i], "-x") || EQ(argv[i], "--lex")) {
@@ -106,7 +238,16 @@ int main(int argc, char** argv) {
             ran = true;
         } else {
             char* contents = readFile(argv[i]);
-            interpret(contents);
+            if (cache) {
+                char* path = cachePath(argv[i], cacheDir, cacheHash(contents, strlen(contents)));
+                interpretCached(contents, path);
+                free(path);
+            } else {
+                interpret(contents);
+            }
+            if (heatmap) {
+                profileLinesReport(heatmap, argv[i], contents);
+            }
             free(contents);
             ran = true;
         }
@@ -117,5 +258,25 @@ int main(int argc, char** argv) {
     if (!ran) {
         repl();
     }
+    if (profileJson) {
+        if (!profileReportJson(profileJson)) {
+            ERR_PRINT("Error: could not write %s\n", profileJson);
+        }
+    } else if (PROFILE_OPS) {
+        profileReport(stderr);
+    }
+    if (PROFILE_HEAP) {
+        profileHeapReport(stderr);
+    }
+    if (PROFILE_STACKS && !profileStacksWrite(profileStacks)) {
+        ERR_PRINT("Error: could not write %s\n", profileStacks);
+    }
+    if (heatmap) {
+        fclose(heatmap);
+    }
+    if (PROFILE_EVENTS && !profileEventsWrite()) {
+        ERR_PRINT("Error: could not write the trace events\n");
+    }
+    profileFree();
     return 0;
 }
@@ -0,0 +1,310 @@
+// Microbenchmarks of the runtime's data structures, without the interpreter around them.
+// Built by "make microbench", which links everything but main.c and the unit tests.
+// ./microbench [FILTER] runs the benchmarks whose name contains FILTER.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common.h"
+#include "../hashmap.h"
+#include "../jit.h"
+#include "../memory.h"
+#include "../object.h"
+#include "../profile.h"
+#include "../value.h"
+#include "../vm.h"
+
+// main.c defines these for the interpreter
+bool DEBUG_TRACE = false;
+bool REGISTER_VM = false;
+int JIT_THRESHOLD = JIT_DEFAULT_THRESHOLD;
+bool PROFILING = false;
+bool PROFILE_OPS = false;
+bool PROFILE_STACKS = false;
+bool PROFILE_LINES = false;
+bool PROFILE_HEAP = false;
+bool PROFILE_MAPS = false;
+bool PROFILE_EVENTS = false;
+
+// Rounds per sample double until a sample takes this long
+#define SAMPLE_NANOS 10000000
+#define SAMPLES 20
+// Two-sided 95% Student's t for SAMPLES - 1 degrees of freedom
+#define T_95 2.093
+
+typedef struct {
+    const char* name;
+    size_t size; // Keys, strings or elements a round works on
+    // Untimed, before each sample and once after the last, may be NULL
+    void (*reset)(size_t size);
+    // Returns the operations it did
+    size_t (*round)(size_t size);
+} Bench;
+
+// Results the compiler cannot prove unused
+static volatile size_t sink;
+
+static Value* ints;
+static Value* doubles;
+static Value* strings;
+static size_t keyCount;
+static hashmap_t table;
+static uint32_t unique;
+
+static size_t formatKey(char* buffer, uint32_t n) {
+    static const char digits[] = "0123456789abcdef";
+    buffer[0] = 'k';
+    for (int i = 0; i < 8; i++) {
+        buffer[8 - i] = digits[(n >> (4 * i)) & 15];
+    }
+    return 9;
+}
+
+// size keys of each type, strings "k00000000" and up
+static void makeKeys(size_t size) {
+    if (keyCount >= size) {
+        return;
+    }
+    ints = realloc(ints, sizeof(Value) * size);
+    doubles = realloc(doubles, sizeof(Value) * size);
+    strings = realloc(strings, sizeof(Value) * size);
+    char buffer[16];
+    for (size_t i = keyCount; i < size; i++) {
+        ints[i] = INTEGER_VAL((int64_t)i * 7919);
+        doubles[i] = DOUBLE_VAL(i * 0.5);
+        strings[i] = OBJ_VAL(copyString(buffer, formatKey(buffer, i)));
+    }
+    keyCount = size;
+}
+
+static size_t addKeys(Value* keys, size_t size) {
+    hashmap_t map;
+    hashmap_init(&map, 8, hashAny);
+    for (size_t i = 0; i < size; i++) {
+        hashmap_add(&map, keys[i], keys[i]);
+    }
+    hashmap_free(&map);
+    return size;
+}
+
+static size_t addInts(size_t size) { return addKeys(ints, size); }
+static size_t addStrings(size_t size) { return addKeys(strings, size); }
+
+// table holds the first size keys, the next size are for misses
+static void fillTable(Value* keys, size_t size) {
+    hashmap_free(&table);
+    hashmap_init(&table, hashmap_capacity_for(size), hashAny);
+    for (size_t i = 0; i < size; i++) {
+        hashmap_add(&table, keys[i], keys[i]);
+    }
+}
+
+// makeKeys() may move the keys, so it runs before they are passed on
+static void fillInts(size_t size) { makeKeys(size * 2); fillTable(ints, size); }
+static void fillStrings(size_t size) { makeKeys(size * 2); fillTable(strings, size); }
+
+// Looks up the keys from offset on, which are in the table below size and missing above it
+static size_t getKeys(Value* keys, size_t offset, size_t size) {
+    size_t found = 0;
+    for (size_t i = offset; i < offset + size; i++) {
+        bool missing;
+        hashmap_get(&table, keys[i], &missing);
+        found += !missing;
+    }
+    sink = found;
+    return size;
+}
+
+static size_t getInts(size_t size) { return getKeys(ints, 0, size); }
+static size_t getStrings(size_t size) { return getKeys(strings, 0, size); }
+static size_t getMissingInts(size_t size) { return getKeys(ints, size, size); }
+
+// vm.strings as it was before the sample and the newest object then
+static hashmap_t interned;
+static Obj* newest;
+
+// vm.strings holds size strings, which copyString() finds, any others are dropped
+static void internStrings(size_t size) {
+    if (!newest) {
+        makeKeys(size);
+        hashmap_copy(&interned, &vm.strings);
+        newest = vm.objects;
+    }
+    while (vm.objects != newest) {
+        Obj* next = vm.objects->next;
+        freeObject(vm.objects);
+        vm.objects = next;
+    }
+    hashmap_free(&vm.strings);
+    hashmap_copy(&vm.strings, &interned);
+}
+
+static size_t copyStrings(size_t size, int hitPercent) {
+    char buffer[16];
+    for (size_t i = 0; i < size; i++) {
+        // Both format a key, so the difference is copyString()'s
+        uint32_t n = (int)(i % 100) < hitPercent ? (uint32_t)i : 0x80000000u + unique++;
+        sink = (size_t)copyString(buffer, formatKey(buffer, n));
+    }
+    return size;
+}
+
+static size_t copyHits(size_t size) { return copyStrings(size, 100); }
+static size_t copyHalf(size_t size) { return copyStrings(size, 50); }
+static size_t copyMisses(size_t size) { return copyStrings(size, 0); }
+
+// Concatenates strings of size bytes, the result is interned after the first round
+static size_t concatStrings(size_t size) {
+    static ObjString* parts[2];
+    static size_t partSize;
+    if (partSize != size) {
+        char* chars = malloc(size);
+        memset(chars, 'a', size);
+        parts[0] = copyString(chars, size);
+        memset(chars, 'b', size);
+        parts[1] = copyString(chars, size);
+        free(chars);
+        partSize = size;
+    }
+    for (int i = 0; i < 1000; i++) {
+        push(OBJ_VAL(parts[0]));
+        push(OBJ_VAL(parts[1]));
+        concatenate();
+        pop();
+    }
+    return 1000;
+}
+
+// Appends size values to an empty array, growing it as the interpreter would
+static size_t appendArray(size_t size) {
+    ObjArray* array = allocateArray(0);
+    for (size_t i = 0; i < size; i++) {
+        insertArray(array, (int)i, ints[i % keyCount]);
+    }
+    vm.objects = array->obj.next;
+    freeObject((Obj*)array);
+    return size;
+}
+
+static size_t compareValues(Value* a, Value* b, size_t size) {
+    size_t equal = 0;
+    for (size_t i = 0; i < size; i++) {
+        equal += valuesEqual(a[i], b[(i * 7) % size]);
+    }
+    sink = equal;
+    return size;
+}
+
+static size_t equalInts(size_t size) { return compareValues(ints, ints, size); }
+static size_t equalDoubles(size_t size) { return compareValues(doubles, doubles, size); }
+static size_t equalStrings(size_t size) { return compareValues(strings, strings, size); }
+static size_t equalMixed(size_t size) { return compareValues(ints, doubles, size); }
+
+static size_t hashValues(Value* values, size_t size) {
+    size_t hash = 0;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= hashAny(values[i]);
+    }
+    sink = hash;
+    return size;
+}
+
+static size_t hashInts(size_t size) { return hashValues(ints, size); }
+static size_t hashDoubles(size_t size) { return hashValues(doubles, size); }
+static size_t hashStrings(size_t size) { return hashValues(strings, size); }
+
+static Bench benches[] = {
+    {"hashmap_add int", 16, makeKeys, addInts},
+    {"hashmap_add int", 1024, makeKeys, addInts},
+    {"hashmap_add int", 65536, makeKeys, addInts},
+    {"hashmap_add string", 16, makeKeys, addStrings},
+    {"hashmap_add string", 1024, makeKeys, addStrings},
+    {"hashmap_add string", 65536, makeKeys, addStrings},
+    {"hashmap_get int", 16, fillInts, getInts},
+    {"hashmap_get int", 1024, fillInts, getInts},
+    {"hashmap_get int", 65536, fillInts, getInts},
+    {"hashmap_get int missing", 1024, fillInts, getMissingInts},
+    {"hashmap_get string", 16, fillStrings, getStrings},
+    {"hashmap_get string", 1024, fillStrings, getStrings},
+    {"hashmap_get string", 65536, fillStrings, getStrings},
+    {"copyString 100% hits", 1024, internStrings, copyHits},
+    {"copyString 50% hits", 1024, internStrings, copyHalf},
+    {"copyString 0% hits", 1024, internStrings, copyMisses},
+    {"concatenate", 8, NULL, concatStrings},
+    {"concatenate", 256, NULL, concatStrings},
+    {"insertArray growth", 16, makeKeys, appendArray},
+    {"insertArray growth", 65536, makeKeys, appendArray},
+    {"valuesEqual int", 1024, makeKeys, equalInts},
+    {"valuesEqual double", 1024, makeKeys, equalDoubles},
+    {"valuesEqual string", 1024, makeKeys, equalStrings},
+    {"valuesEqual int/double", 1024, makeKeys, equalMixed},
+    {"hashAny int", 1024, makeKeys, hashInts},
+    {"hashAny double", 1024, makeKeys, hashDoubles},
+    {"hashAny string", 1024, makeKeys, hashStrings},
+};
+
+// Nanoseconds per operation over rounds rounds, elapsed is set to their total
+static double sample(Bench* bench, size_t rounds, uint64_t* elapsed) {
+    if (bench->reset) {
+        bench->reset(bench->size);
+    }
+    size_t ops = 0;
+    uint64_t start = profileNanos();
+    for (size_t i = 0; i < rounds; i++) {
+        ops += bench->round(bench->size);
+    }
+    *elapsed = profileNanos() - start;
+    return (double)*elapsed / ops;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void run(Bench* bench) {
+    // Also warms up the caches and the allocator
+    size_t rounds = 1;
+    uint64_t elapsed;
+    while (sample(bench, rounds, &elapsed) > 0 && elapsed < SAMPLE_NANOS && rounds < (1u << 30)) {
+        rounds *= 2;
+    }
+    double samples[SAMPLES];
+    double mean = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        samples[i] = sample(bench, rounds, &elapsed);
+        mean += samples[i] / SAMPLES;
+    }
+    double variance = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean) / (SAMPLES - 1);
+    }
+    double interval = T_95 * sqrt(variance / SAMPLES);
+    qsort(samples, SAMPLES, sizeof(double), compareDoubles);
+    double median = (samples[SAMPLES / 2 - 1] + samples[SAMPLES / 2]) / 2;
+    printf("%-26s %8zu %10.2f %10.2f %10.2f +/- %.2f (%.1f%%)\n",
+           bench->name, bench->size, median, samples[0], mean, interval, 100 * interval / mean);
+    if (bench->reset) {
+        bench->reset(bench->size);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    initVM();
+    printf("%-26s %8s %10s %10s %10s\n", "ns/op", "size", "median", "min", "mean +/- 95% CI");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        if (strstr(benches[i].name, filter)) {
+            run(&benches[i]);
+        }
+    }
+    hashmap_free(&table);
+    hashmap_free(&interned);
+    free(ints);
+    free(doubles);
+    free(strings);
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,708 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bigint.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 uint128;
+#endif
+
+// Largest power of 10 that fits in a limb, used for printing and parsing
+#define DECIMAL_CHUNK 10000000000000000000ull
+#define DECIMAL_CHUNK_DIGITS 19
+
+// Operands are viewed as sign-magnitude limb arrays, small ints use a single inline limb
+typedef struct {
+    bool negative;
+    size_t length;
+    const uint64_t* limbs;
+    uint64_t small;
+} BigView;
+
+static void viewOf(Value value, BigView* view) {
+    if (IS_BIGINT(value)) {
+        ObjBigInt* bigint = AS_BIGINT(value);
+        view->negative = bigint->negative;
+        view->length = bigint->length;
+        view->limbs = bigint->limbs;
+        return;
+    }
+    int64_t small = AS_INTEGER(value);
+    view->negative = small < 0;
+    // Negate in unsigned arithmetic so INT64_MIN does not overflow
+    view->small = small < 0 ? (uint64_t)0 - (uint64_t)small : (uint64_t)small;
+    view->length = view->small != 0;
+    view->limbs = &view->small;
+}
+
+static size_t trim(const uint64_t* limbs, size_t length) {
+    while (length > 0 && limbs[length - 1] == 0) {
+        length--;
+    }
+    return length;
+}
+
+// Build a normalized result, demoting to VAL_INT when it fits
+static Value makeResult(bool negative, const uint64_t* limbs, size_t length) {
+    length = trim(limbs, length);
+    if (length == 0) {
+        return INTEGER_VAL(0);
+    }
+    if (length == 1) {
+        if (!negative && limbs[0] <= (uint64_t)INT64_MAX) {
+            return INTEGER_VAL((int64_t)limbs[0]);
+        }
+        if (negative && limbs[0] <= (uint64_t)INT64_MAX + 1) {
+            return INTEGER_VAL((int64_t)((uint64_t)0 - limbs[0]));
+        }
+    }
+    return BIGINT_VAL(newBigInt(negative, limbs, length));
+}
+
+static uint64_t mulWide(uint64_t a, uint64_t b, uint64_t* hi) {
+#if defined(__SIZEOF_INT128__)
+    uint128 product = (uint128)a * b;
+    *hi = (uint64_t)(product >> 64);
+    return (uint64_t)product;
+#else
+    uint64_t aLo = a & 0xffffffff, aHi = a >> 32;
+    uint64_t bLo = b & 0xffffffff, bHi = b >> 32;
+    uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+    uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return (mid << 32) | (ll & 0xffffffff);
+#endif
+}
+
+// Divide (hi:lo) by d, requires hi < d
+static uint64_t divWide(uint64_t hi, uint64_t lo, uint64_t d, uint64_t* rem) {
+#if defined(__SIZEOF_INT128__)
+    uint128 n = ((uint128)hi << 64) | lo;
+    *rem = (uint64_t)(n % d);
+    return (uint64_t)(n / d);
+#else
+    uint64_t q = 0;
+    for (int i = 63; i >= 0; i--) {
+        bool carry = hi >> 63;
+        hi = (hi << 1) | (lo >> 63);
+        lo <<= 1;
+        q <<= 1;
+        if (carry || hi >= d) {
+            hi -= d;
+            q |= 1;
+        }
+    }
+    *rem = hi;
+    return q;
+#endif
+}
+
+static int magCompare(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen) {
+    if (alen != blen) {
+        return alen < blen ? -1 : 1;
+    }
+    for (size_t i = alen; i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// out needs max(alen, blen) + 1 limbs and may alias a or b
+static size_t magAdd(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen, uint64_t* out) {
+    if (alen < blen) {
+        const uint64_t* t = a;
+        a = b;
+        b = t;
+        size_t tlen = alen;
+        alen = blen;
+        blen = tlen;
+    }
+    uint64_t carry = 0;
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t bi = i < blen ? b[i] : 0;
+        uint64_t sum = a[i] + bi;
+        uint64_t c = sum < bi;
+        sum += carry;
+        c |= sum < carry;
+        out[i] = sum;
+        carry = c;
+    }
+    out[alen] = carry;
+    return alen + carry;
+}
+
+// a - b for a >= b, out needs alen limbs and may alias a
+static size_t magSub(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen, uint64_t* out) {
+    uint64_t borrow = 0;
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t bi = i < blen ? b[i] : 0;
+        uint64_t diff = a[i] - bi;
+        uint64_t c = a[i] < bi;
+        c |= diff < borrow;
+        out[i] = diff - borrow;
+        borrow = c;
+    }
+    return trim(out, alen);
+}
+
+static void magMulSchoolbook(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen, uint64_t* out) {
+    for (size_t i = 0; i < alen; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < blen; j++) {
+            uint64_t hi;
+            uint64_t lo = mulWide(a[i], b[j], &hi);
+            lo += out[i + j];
+            hi += lo < out[i + j];
+            lo += carry;
+            hi += lo < carry;
+            out[i + j] = lo;
+            carry = hi;
+        }
+        out[i + blen] = carry;
+    }
+}
+
+// Add x shifted left by `shift` limbs into out, which must be large enough to absorb the carry
+static void magAddAt(uint64_t* out, const uint64_t* x, size_t xlen, size_t shift) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < xlen; i++) {
+        uint64_t sum = out[shift + i] + x[i];
+        uint64_t c = sum < x[i];
+        sum += carry;
+        c |= sum < carry;
+        out[shift + i] = sum;
+        carry = c;
+    }
+    while (carry) {
+        out[shift + i] += 1;
+        carry = out[shift + i] == 0;
+        i++;
+    }
+}
+
+// out needs alen + blen limbs, returns the trimmed length
+static size_t magMul(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen, uint64_t* out) {
+    memset(out, 0, (alen + blen) * sizeof(uint64_t));
+    if (alen == 0 || blen == 0) {
+        return 0;
+    }
+    if (alen < KARATSUBA_THRESHOLD || blen < KARATSUBA_THRESHOLD) {
+        magMulSchoolbook(a, alen, b, blen, out);
+        return trim(out, alen + blen);
+    }
+    // a = a1 * B^m + a0, b = b1 * B^m + b0
+    // a * b = z2 * B^2m + (z1 - z2 - z0) * B^m + z0 with z1 = (a0 + a1)(b0 + b1)
+    size_t m = (MAX(alen, blen) + 1) / 2;
+    size_t a0len = trim(a, MIN(m, alen));
+    size_t b0len = trim(b, MIN(m, blen));
+    const uint64_t* a1 = a + MIN(m, alen);
+    const uint64_t* b1 = b + MIN(m, blen);
+    size_t a1len = alen > m ? alen - m : 0;
+    size_t b1len = blen > m ? blen - m : 0;
+
+    uint64_t* z0 = ALLOCATE(uint64_t, a0len + b0len + 1);
+    uint64_t* z2 = ALLOCATE(uint64_t, a1len + b1len + 1);
+    uint64_t* sa = ALLOCATE(uint64_t, MAX(a0len, a1len) + 1);
+    uint64_t* sb = ALLOCATE(uint64_t, MAX(b0len, b1len) + 1);
+    size_t z0len = magMul(a, a0len, b, b0len, z0);
+    size_t z2len = magMul(a1, a1len, b1, b1len, z2);
+    size_t salen = magAdd(a, a0len, a1, a1len, sa);
+    size_t sblen = magAdd(b, b0len, b1, b1len, sb);
+    uint64_t* z1 = ALLOCATE(uint64_t, salen + sblen + 1);
+    size_t z1len = magMul(sa, salen, sb, sblen, z1);
+    z1len = magSub(z1, z1len, z0, z0len, z1);
+    z1len = magSub(z1, z1len, z2, z2len, z1);
+
+    memset(out, 0, (alen + blen) * sizeof(uint64_t));
+    magAddAt(out, z0, z0len, 0);
+    magAddAt(out, z1, z1len, m);
+    magAddAt(out, z2, z2len, 2 * m);
+
+    FREE_ARRAY(uint64_t, z0, a0len + b0len + 1);
+    FREE_ARRAY(uint64_t, z1, salen + sblen + 1);
+    FREE_ARRAY(uint64_t, z2, a1len + b1len + 1);
+    FREE_ARRAY(uint64_t, sa, MAX(a0len, a1len) + 1);
+    FREE_ARRAY(uint64_t, sb, MAX(b0len, b1len) + 1);
+    return trim(out, alen + blen);
+}
+
+// Fast path for single-limb divisors, q may alias a, returns the remainder
+static uint64_t magDivSmall(const uint64_t* a, size_t alen, uint64_t d, uint64_t* q) {
+    uint64_t rem = 0;
+    for (size_t i = alen; i-- > 0;) {
+        q[i] = divWide(rem, a[i], d, &rem);
+    }
+    return rem;
+}
+
+// Knuth's algorithm D on 32-bit digits, from Hacker's Delight (divmnu).
+// Requires m >= n >= 2 and v[n - 1] != 0. q needs m - n + 1 digits, r needs n.
+static void knuthDivide(const uint32_t* u, int m, const uint32_t* v, int n, uint32_t* q, uint32_t* r) {
+    const uint64_t b = (uint64_t)1 << 32;
+    int s = 0;
+    while (!(v[n - 1] & (0x80000000u >> s))) {
+        s++;
+    }
+    uint32_t* vn = ALLOCATE(uint32_t, n);
+    uint32_t* un = ALLOCATE(uint32_t, m + 1);
+    for (int i = n - 1; i > 0; i--) {
+        vn[i] = (v[i] << s) | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+    }
+    vn[0] = v[0] << s;
+    un[m] = (uint32_t)((uint64_t)u[m - 1] >> (32 - s));
+    for (int i = m - 1; i > 0; i--) {
+        un[i] = (u[i] << s) | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+    }
+    un[0] = u[0] << s;
+
+    for (int j = m - n; j >= 0; j--) {
+        uint64_t numerator = (uint64_t)un[j + n] * b + un[j + n - 1];
+        uint64_t qhat = numerator / vn[n - 1];
+        uint64_t rhat = numerator - qhat * vn[n - 1];
+        while (qhat >= b || qhat * vn[n - 2] > b * rhat + un[j + n - 2]) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= b) {
+                break;
+            }
+        }
+        // Multiply and subtract
+        int64_t t;
+        uint64_t k = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - (int64_t)k - (int64_t)(p & 0xffffffff);
+            un[i + j] = (uint32_t)t;
+            k = (p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + n] - (int64_t)k;
+        un[j + n] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            // Subtracted too much, add back
+            q[j]--;
+            k = 0;
+            for (int i = 0; i < n; i++) {
+                t = (int64_t)((uint64_t)un[i + j] + vn[i] + k);
+                un[i + j] = (uint32_t)t;
+                k = (uint64_t)t >> 32;
+            }
+            un[j + n] += (uint32_t)k;
+        }
+    }
+    for (int i = 0; i < n - 1; i++) {
+        r[i] = (un[i] >> s) | (uint32_t)((uint64_t)un[i + 1] << (32 - s));
+    }
+    r[n - 1] = un[n - 1] >> s;
+    FREE_ARRAY(uint32_t, vn, n);
+    FREE_ARRAY(uint32_t, un, m + 1);
+}
+
+// q needs alen limbs, r needs blen limbs, requires blen > 0
+static void magDivmod(const uint64_t* a, size_t alen, const uint64_t* b, size_t blen,
+                      uint64_t* q, size_t* qlen, uint64_t* r, size_t* rlen) {
+    if (magCompare(a, alen, b, blen) < 0) {
+        *qlen = 0;
+        memcpy(r, a, alen * sizeof(uint64_t));
+        *rlen = alen;
+        return;
+    }
+    if (blen == 1) {
+        r[0] = magDivSmall(a, alen, b[0], q);
+        *qlen = trim(q, alen);
+        *rlen = trim(r, 1);
+        return;
+    }
+    int m = (int)alen * 2;
+    int n = (int)blen * 2;
+    uint32_t* u = ALLOCATE(uint32_t, m);
+    uint32_t* v = ALLOCATE(uint32_t, n);
+    for (size_t i = 0; i < alen; i++) {
+        u[2 * i] = (uint32_t)a[i];
+        u[2 * i + 1] = (uint32_t)(a[i] >> 32);
+    }
+    for (size_t i = 0; i < blen; i++) {
+        v[2 * i] = (uint32_t)b[i];
+        v[2 * i + 1] = (uint32_t)(b[i] >> 32);
+    }
+    while (m > 0 && u[m - 1] == 0) {
+        m--;
+    }
+    while (n > 0 && v[n - 1] == 0) {
+        n--;
+    }
+    uint32_t* q32 = ALLOCATE(uint32_t, m - n + 2);
+    uint32_t* r32 = ALLOCATE(uint32_t, n + 1);
+    memset(q32, 0, (m - n + 2) * sizeof(uint32_t));
+    memset(r32, 0, (n + 1) * sizeof(uint32_t));
+    knuthDivide(u, m, v, n, q32, r32);
+    memset(q, 0, alen * sizeof(uint64_t));
+    memset(r, 0, blen * sizeof(uint64_t));
+    for (int i = 0; i < m - n + 1; i++) {
+        q[i / 2] |= (uint64_t)q32[i] << (32 * (i % 2));
+    }
+    for (int i = 0; i < n; i++) {
+        r[i / 2] |= (uint64_t)r32[i] << (32 * (i % 2));
+    }
+    *qlen = trim(q, alen);
+    *rlen = trim(r, blen);
+    FREE_ARRAY(uint32_t, u, alen * 2);
+    FREE_ARRAY(uint32_t, v, blen * 2);
+    FREE_ARRAY(uint32_t, q32, m - n + 2);
+    FREE_ARRAY(uint32_t, r32, n + 1);
+}
+
+static Value addSigned(Value a, Value b, bool subtract) {
+    BigView x, y;
+    viewOf(a, &x);
+    viewOf(b, &y);
+    bool yNegative = y.negative != subtract;
+    size_t length = MAX(x.length, y.length) + 1;
+    uint64_t* out = ALLOCATE(uint64_t, length);
+    Value result;
+    if (x.negative == yNegative) {
+        size_t n = magAdd(x.limbs, x.length, y.limbs, y.length, out);
+        result = makeResult(x.negative, out, n);
+    } else if (magCompare(x.limbs, x.length, y.limbs, y.length) >= 0) {
+        size_t n = magSub(x.limbs, x.length, y.limbs, y.length, out);
+        result = makeResult(x.negative, out, n);
+    } else {
+        size_t n = magSub(y.limbs, y.length, x.limbs, x.length, out);
+        result = makeResult(yNegative, out, n);
+    }
+    FREE_ARRAY(uint64_t, out, length);
+    return result;
+}
+
+Value bigintAdd(Value a, Value b) {
+    return addSigned(a, b, false);
+}
+
+Value bigintSub(Value a, Value b) {
+    return addSigned(a, b, true);
+}
+
+Value bigintMul(Value a, Value b) {
+    BigView x, y;
+    viewOf(a, &x);
+    viewOf(b, &y);
+    size_t length = x.length + y.length + 1;
+    uint64_t* out = ALLOCATE(uint64_t, length);
+    size_t n = magMul(x.limbs, x.length, y.limbs, y.length, out);
+    Value result = makeResult(x.negative != y.negative, out, n);
+    FREE_ARRAY(uint64_t, out, length);
+    return result;
+}
+
+// Truncating division like C: the quotient rounds toward zero and the remainder takes the sign of a
+static Value divmod(Value a, Value b, bool wantQuotient) {
+    BigView x, y;
+    viewOf(a, &x);
+    viewOf(b, &y);
+    if (y.length == 0) {
+        return DOUBLE_VAL(wantQuotient ? INFINITY : NAN);
+    }
+    uint64_t* q = ALLOCATE(uint64_t, x.length + 1);
+    uint64_t* r = ALLOCATE(uint64_t, MAX(x.length, y.length) + 1);
+    size_t qlen = 0, rlen = 0;
+    magDivmod(x.limbs, x.length, y.limbs, y.length, q, &qlen, r, &rlen);
+    Value result = wantQuotient
+        ? makeResult(x.negative != y.negative, q, qlen)
+        : makeResult(x.negative, r, rlen);
+    FREE_ARRAY(uint64_t, q, x.length + 1);
+    FREE_ARRAY(uint64_t, r, MAX(x.length, y.length) + 1);
+    return result;
+}
+
+Value bigintDiv(Value a, Value b) {
+    return divmod(a, b, true);
+}
+
+Value bigintMod(Value a, Value b) {
+    return divmod(a, b, false);
+}
+
+// Two's complement representation over n limbs, n must exceed the magnitude's length
+static void toTwos(const BigView* view, uint64_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = i < view->length ? view->limbs[i] : 0;
+    }
+    if (view->negative) {
+        uint64_t carry = 1;
+        for (size_t i = 0; i < n; i++) {
+            out[i] = ~out[i] + carry;
+            carry = carry && out[i] == 0;
+        }
+    }
+}
+
+static Value fromTwos(uint64_t* limbs, size_t n) {
+    bool negative = limbs[n - 1] >> 63;
+    if (negative) {
+        uint64_t carry = 1;
+        for (size_t i = 0; i < n; i++) {
+            limbs[i] = ~limbs[i] + carry;
+            carry = carry && limbs[i] == 0;
+        }
+    }
+    return makeResult(negative, limbs, n);
+}
+
+typedef enum {
+    BIT_AND,
+    BIT_OR,
+    BIT_XOR,
+} BitOp;
+
+static Value bitwise(Value a, Value b, BitOp op) {
+    BigView x, y;
+    viewOf(a, &x);
+    viewOf(b, &y);
+    size_t n = MAX(x.length, y.length) + 1;
+    uint64_t* xs = ALLOCATE(uint64_t, n);
+    uint64_t* ys = ALLOCATE(uint64_t, n);
+    toTwos(&x, xs, n);
+    toTwos(&y, ys, n);
+    for (size_t i = 0; i < n; i++) {
+        switch (op) {
+            case BIT_AND: xs[i] &= ys[i]; break;
+            case BIT_OR: xs[i] |= ys[i]; break;
+            case BIT_XOR: xs[i] ^= ys[i]; break;
+        }
+    }
+    Value result = fromTwos(xs, n);
+    FREE_ARRAY(uint64_t, xs, n);
+    FREE_ARRAY(uint64_t, ys, n);
+    return result;
+}
+
+Value bigintAnd(Value a, Value b) {
+    return bitwise(a, b, BIT_AND);
+}
+
+Value bigintOr(Value a, Value b) {
+    return bitwise(a, b, BIT_OR);
+}
+
+Value bigintXor(Value a, Value b) {
+    return bitwise(a, b, BIT_XOR);
+}
+
+Value bigintBitNeg(Value a) {
+    // ~a == -a - 1
+    return bigintSub(INTEGER_VAL(-1), a);
+}
+
+// Returns false if the result could not be allocated
+static bool shiftLeftMagnitude(const BigView* x, bool negative, uint64_t bits, Value* result) {
+    size_t limbShift = bits / 64;
+    int bitShift = bits % 64;
+    size_t length = x->length + limbShift + 1;
+    uint64_t* out = ALLOCATE(uint64_t, length);
+    if (out == NULL) {
+        return false;
+    }
+    memset(out, 0, length * sizeof(uint64_t));
+    for (size_t i = 0; i < x->length; i++) {
+        out[i + limbShift] |= x->limbs[i] << bitShift;
+        if (bitShift) {
+            out[i + limbShift + 1] = x->limbs[i] >> (64 - bitShift);
+        }
+    }
+    *result = makeResult(negative, out, length);
+    FREE_ARRAY(uint64_t, out, length);
+    return true;
+}
+
+static Value shiftRightMagnitude(const BigView* x, bool negative, uint64_t bits) {
+    uint64_t limbShift = bits / 64;
+    int bitShift = bits % 64;
+    if (limbShift >= x->length) {
+        return makeResult(negative, NULL, 0);
+    }
+    size_t length = x->length - limbShift;
+    uint64_t* out = ALLOCATE(uint64_t, length);
+    for (size_t i = 0; i < length; i++) {
+        out[i] = x->limbs[i + limbShift] >> bitShift;
+        if (bitShift && i + limbShift + 1 < x->length) {
+            out[i] |= x->limbs[i + limbShift + 1] << (64 - bitShift);
+        }
+    }
+    Value result = makeResult(negative, out, length);
+    FREE_ARRAY(uint64_t, out, length);
+    return result;
+}
+
+static bool shift(Value a, Value b, bool left, Value* result) {
+    if (IS_BIGINT(b)) {
+        return false;
+    }
+    // A negative count shifts the other way, negated unsigned so INT64_MIN does not overflow
+    int64_t count = AS_INTEGER(b);
+    uint64_t bits = count < 0 ? (uint64_t)0 - (uint64_t)count : (uint64_t)count;
+    left = left != (count < 0);
+    BigView x;
+    viewOf(a, &x);
+    if (left) {
+        return bits <= BIGINT_MAX_SHIFT && shiftLeftMagnitude(&x, x.negative, bits, result);
+    }
+    if (!x.negative) {
+        *result = shiftRightMagnitude(&x, false, bits);
+        return true;
+    }
+    // Arithmetic shift right rounds toward negative infinity: -((|a| - 1) >> n) - 1
+    Value magnitudeLessOne = bigintSub(bigintMul(a, INTEGER_VAL(-1)), INTEGER_VAL(1));
+    BigView m;
+    viewOf(magnitudeLessOne, &m);
+    Value shifted = shiftRightMagnitude(&m, false, bits);
+    *result = bigintSub(bigintMul(shifted, INTEGER_VAL(-1)), INTEGER_VAL(1));
+    return true;
+}
+
+bool bigintShiftLeft(Value a, Value b, Value* result) {
+    return shift(a, b, true, result);
+}
+
+bool bigintShiftRight(Value a, Value b, Value* result) {
+    return shift(a, b, false, result);
+}
+
+int bigintCompare(Value a, Value b) {
+    BigView x, y;
+    viewOf(a, &x);
+    viewOf(b, &y);
+    if (x.negative != y.negative) {
+        return x.negative ? -1 : 1;
+    }
+    int cmp = magCompare(x.limbs, x.length, y.limbs, y.length);
+    return x.negative ? -cmp : cmp;
+}
+
+// Multiply in place and add, limbs needs room for one more limb
+static size_t magMulAddSmall(uint64_t* limbs, size_t length, uint64_t mul, uint64_t add) {
+    uint64_t carry = add;
+    for (size_t i = 0; i < length; i++) {
+        uint64_t hi;
+        uint64_t lo = mulWide(limbs[i], mul, &hi);
+        lo += carry;
+        hi += lo < carry;
+        limbs[i] = lo;
+        carry = hi;
+    }
+    if (carry) {
+        limbs[length++] = carry;
+    }
+    return length;
+}
+
+static int digitValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parse an unsigned decimal or hexadecimal (with or without 0x) integer literal
+Value bigintParse(const char* chars, size_t length, int base) {
+    if (base == 16 && length >= 2 && chars[0] == '0' && (chars[1] == 'x' || chars[1] == 'X')) {
+        chars += 2;
+        length -= 2;
+    }
+    // Both 16^15 and 10^19 fit in a limb
+    int chunkDigits = base == 16 ? 15 : DECIMAL_CHUNK_DIGITS;
+    size_t capacity = length / chunkDigits + 2;
+    uint64_t* limbs = ALLOCATE(uint64_t, capacity);
+    size_t count = 0;
+    uint64_t chunk = 0;
+    uint64_t scale = 1;
+    int digits = 0;
+    for (size_t i = 0; i < length; i++) {
+        int digit = digitValue(chars[i]);
+        if (digit < 0 || digit >= base) {
+            continue;
+        }
+        chunk = chunk * base + digit;
+        scale *= base;
+        digits++;
+        if (digits == chunkDigits) {
+            count = magMulAddSmall(limbs, count, scale, chunk);
+            chunk = 0;
+            scale = 1;
+            digits = 0;
+        }
+    }
+    if (digits) {
+        count = magMulAddSmall(limbs, count, scale, chunk);
+    }
+    Value result = makeResult(false, limbs, count);
+    FREE_ARRAY(uint64_t, limbs, capacity);
+    return result;
+}
+
+double bigintToDouble(ObjBigInt* bigint) {
+    double result = 0;
+    for (size_t i = bigint->length; i-- > 0;) {
+        result = result * 18446744073709551616.0 + (double)bigint->limbs[i];
+    }
+    return bigint->negative ? -result : result;
+}
+
+// Keeps the low 64 bits, wrapping around like a C integer conversion
+int64_t bigintToInt(ObjBigInt* bigint) {
+    uint64_t low = bigint->limbs[0];
+    if (bigint->negative) {
+        low = (uint64_t)0 - low;
+    }
+    return (int64_t)low;
+}
+
+size_t bigintHash(ObjBigInt* bigint) {
+    size_t hash = 2166136261u ^ bigint->negative;
+    for (size_t i = 0; i < bigint->length; i++) {
+        for (int b = 0; b < 64; b += 8) {
+            hash ^= (uint8_t)(bigint->limbs[i] >> b);
+            hash *= 16777619;
+        }
+    }
+    return hash;
+}
+
+void printBigInt(ObjBigInt* bigint) {
+    size_t length = bigint->length;
+    uint64_t* tmp = ALLOCATE(uint64_t, length);
+    memcpy(tmp, bigint->limbs, length * sizeof(uint64_t));
+    // Each limb holds at most two decimal chunks
+    size_t capacity = length * 2 + 1;
+    uint64_t* chunks = ALLOCATE(uint64_t, capacity);
+    size_t count = 0;
+    while (length > 0) {
+        chunks[count++] = magDivSmall(tmp, length, DECIMAL_CHUNK, tmp);
+        length = trim(tmp, length);
+    }
+    if (bigint->negative) {
+        printf("-");
+    }
+    printf("%" PRIu64, chunks[count - 1]);
+    for (size_t i = count - 1; i-- > 0;) {
+        printf("%0*" PRIu64, DECIMAL_CHUNK_DIGITS, chunks[i]);
+    }
+    FREE_ARRAY(uint64_t, tmp, bigint->length);
+    FREE_ARRAY(uint64_t, chunks, capacity);
+}
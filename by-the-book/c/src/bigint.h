@@ -0,0 +1,44 @@
+#ifndef clox_bigint_h
+#define clox_bigint_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// Multiply with Karatsuba once both operands have at least this many limbs
+#define KARATSUBA_THRESHOLD 32
+// Left shifts by more bits are refused instead of allocating gigabytes
+#define BIGINT_MAX_SHIFT ((uint64_t)1 << 32)
+
+// Sign-magnitude arbitrary-precision integer with 64-bit limbs.
+// Always normalized: no leading zero limbs and never small enough to fit in VAL_INT.
+struct ObjBigInt {
+    Obj obj;
+    bool negative;
+    size_t length;
+    uint64_t limbs[]; // Least significant limb first
+};
+
+// All operations accept VAL_INT, VAL_BOOL and VAL_BIGINT operands
+// and demote their result back to VAL_INT when it fits
+Value bigintAdd(Value a, Value b);
+Value bigintSub(Value a, Value b);
+Value bigintMul(Value a, Value b);
+Value bigintDiv(Value a, Value b);
+Value bigintMod(Value a, Value b);
+Value bigintAnd(Value a, Value b);
+Value bigintOr(Value a, Value b);
+Value bigintXor(Value a, Value b);
+// False if the count is a bigint or the result is too large, a negative count shifts the other way
+bool bigintShiftLeft(Value a, Value b, Value* result);
+bool bigintShiftRight(Value a, Value b, Value* result);
+Value bigintBitNeg(Value a);
+int bigintCompare(Value a, Value b);
+
+Value bigintParse(const char* chars, size_t length, int base);
+double bigintToDouble(ObjBigInt* bigint);
+int64_t bigintToInt(ObjBigInt* bigint);
+size_t bigintHash(ObjBigInt* bigint);
+void printBigInt(ObjBigInt* bigint);
+
+#endif
@@ -0,0 +1,604 @@
+// mmap, rename and getpid are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bigint.h"
+#include "cache.h"
+#include "hashmap.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * A .loxc file is native-endian and laid out as
+ *
+ *   header     magic, version, layout, string count, function count,
+ *              source hash, checksum of everything after the header,
+ *              data offset and data size
+ *   strings    u32 length + chars, interned in one pass when loading
+ *   functions  name, arity, stack slots, byte count, code offset, line run count and offset,
+ *              then the constants, each a CacheTag followed by its payload
+ *   data       8-byte aligned, every function's code then its LineRun table
+ *
+ * The whole file is mapped read-only and chunks point straight into data.
+ * Function 0 is the top level, nested functions follow in depth-first order.
+ */
+
+// Catches files written on a machine with a different int size or byte order
+#define LOXC_LAYOUT ((uint32_t)(sizeof(int) | sizeof(double) << 8 | 0x4c << 16))
+#define NO_STRING UINT32_MAX
+#define HEADER_SIZE 56
+
+typedef enum {
+    CACHE_NIL,
+    CACHE_FALSE,
+    CACHE_TRUE,
+    CACHE_INT,
+    CACHE_DOUBLE,
+    CACHE_FCOMPLEX,
+    CACHE_BIGINT,
+    CACHE_STRING,
+    CACHE_FUNCTION,
+    CACHE_ARRAY,
+    CACHE_HASHMAP,
+} CacheTag;
+
+typedef struct Mapping {
+    void* start;
+    size_t size;
+    struct Mapping* next;
+} Mapping;
+
+static Mapping* mappings = NULL;
+
+#define FNV_OFFSET 14695981039346656037ull
+
+// 64-bit FNV-1a, hashString is only 32 bits wide
+static uint64_t fnv(uint64_t hash, const uint8_t* bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t cacheHash(const char* source, size_t length) {
+    return fnv(FNV_OFFSET, (const uint8_t*)source, length);
+}
+
+char* cachePath(const char* sourcePath, const char* cacheDir, uint64_t hash) {
+    if (cacheDir) {
+        // Keyed by content, so the same script run from anywhere shares one file
+        size_t size = strlen(cacheDir) + 32;
+        char* path = malloc(size);
+        snprintf(path, size, "%s/%016llx%s", cacheDir, (unsigned long long)hash, LOXC_EXTENSION);
+        return path;
+    }
+    size_t length = strlen(sourcePath);
+    char* path = malloc(length + sizeof(LOXC_EXTENSION));
+    memcpy(path, sourcePath, length + 1);
+    if (length >= 4 && strcmp(sourcePath + length - 4, ".lox") == 0) {
+        // foo.lox -> foo.loxc
+        strcpy(path + length, "c");
+    } else {
+        strcpy(path + length, LOXC_EXTENSION);
+    }
+    return path;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+} Buffer;
+
+typedef struct {
+    Buffer strings;
+    Buffer functions;
+    Buffer data;
+    uint32_t stringCount;
+    hashmap_t stringIndex;
+    ObjFunction** list;
+    uint32_t functionCount;
+    uint32_t functionCapacity;
+    bool failed;
+} Writer;
+
+static void writeBytes(Buffer* buffer, const void* bytes, size_t size) {
+    if (buffer->capacity < buffer->count + size) {
+        size_t old = buffer->capacity;
+        while (buffer->capacity < buffer->count + size) {
+            buffer->capacity = GROW_CAPACITY(buffer->capacity);
+        }
+        buffer->bytes = GROW_ARRAY(uint8_t, buffer->bytes, old, buffer->capacity);
+    }
+    memcpy(buffer->bytes + buffer->count, bytes, size);
+    buffer->count += size;
+}
+
+static void writeU8(Buffer* buffer, uint8_t value) {
+    writeBytes(buffer, &value, sizeof(value));
+}
+
+static void writeU32(Buffer* buffer, uint32_t value) {
+    writeBytes(buffer, &value, sizeof(value));
+}
+
+static void writeU64(Buffer* buffer, uint64_t value) {
+    writeBytes(buffer, &value, sizeof(value));
+}
+
+static void alignBuffer(Buffer* buffer, size_t alignment) {
+    static const uint8_t zeros[8] = {0};
+    writeBytes(buffer, zeros, (alignment - buffer->count % alignment) % alignment);
+}
+
+static void freeBuffer(Buffer* buffer) {
+    FREE_ARRAY(uint8_t, buffer->bytes, buffer->capacity);
+}
+
+static uint32_t stringIndex(Writer* writer, ObjString* string) {
+    bool notFound;
+    Value index = hashmap_get(&writer->stringIndex, OBJ_VAL(string), &notFound);
+    if (!notFound) {
+        return (uint32_t)AS_INTEGER(index);
+    }
+    // If the lossy hashmap drops this add the string is written twice, loading interns both copies anyway
+    hashmap_add(&writer->stringIndex, OBJ_VAL(string), INTEGER_VAL(writer->stringCount));
+    writeU32(&writer->strings, (uint32_t)string->length);
+    writeBytes(&writer->strings, string->chars, string->length);
+    return writer->stringCount++;
+}
+
+static uint32_t functionIndex(Writer* writer, ObjFunction* function) {
+    for (uint32_t i = 0; i < writer->functionCount; i++) {
+        if (writer->list[i] == function) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void collectFunctions(Writer* writer, ObjFunction* function) {
+    if (writer->functionCapacity < writer->functionCount + 1) {
+        uint32_t old = writer->functionCapacity;
+        writer->functionCapacity = GROW_CAPACITY(old);
+        writer->list = GROW_ARRAY(ObjFunction*, writer->list, old, writer->functionCapacity);
+    }
+    writer->list[writer->functionCount++] = function;
+    Values* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (isObjType(constants->values[i], OBJ_FUNCTION)) {
+            collectFunctions(writer, AS_FUNCTION(constants->values[i]));
+        }
+    }
+}
+
+static void writeValue(Writer* writer, Buffer* buffer, Value value) {
+    switch (value.type) { // Exhaustive!
+        case VAL_NEVER: writer->failed = true; return;
+        case VAL_NIL: writeU8(buffer, CACHE_NIL); return;
+        case VAL_BOOL: writeU8(buffer, AS_BOOL(value) ? CACHE_TRUE : CACHE_FALSE); return;
+        case VAL_INT:
+            writeU8(buffer, CACHE_INT);
+            writeU64(buffer, (uint64_t)value.as._int);
+            return;
+        case VAL_DOUBLE:
+            writeU8(buffer, CACHE_DOUBLE);
+            writeBytes(buffer, &value.as._double, sizeof(double));
+            return;
+        case VAL_FCOMPLEX:
+            writeU8(buffer, CACHE_FCOMPLEX);
+            writeBytes(buffer, &value.as._fcomplex, sizeof(float complex));
+            return;
+        case VAL_BIGINT: {
+            ObjBigInt* bigint = AS_BIGINT(value);
+            writeU8(buffer, CACHE_BIGINT);
+            writeU8(buffer, bigint->negative);
+            writeU64(buffer, bigint->length);
+            writeBytes(buffer, bigint->limbs, sizeof(uint64_t) * bigint->length);
+            return;
+        }
+        case VAL_OBJ: break;
+    }
+    switch (OBJ_TYPE(value)) {
+        case OBJ_STRING:
+            writeU8(buffer, CACHE_STRING);
+            writeU32(buffer, stringIndex(writer, AS_STRING(value)));
+            return;
+        case OBJ_FUNCTION:
+            writeU8(buffer, CACHE_FUNCTION);
+            writeU32(buffer, functionIndex(writer, AS_FUNCTION(value)));
+            return;
+        case OBJ_ARRAY: {
+            ObjArray* array = AS_ARRAY(value);
+            writeU8(buffer, CACHE_ARRAY);
+            writeU64(buffer, array->length);
+            for (size_t i = 0; i < array->length; i++) {
+                writeValue(writer, buffer, array->values[i]);
+            }
+            return;
+        }
+        case OBJ_HASHMAP: {
+            hashmap_t* map = &AS_HASHMAP(value)->map;
+            writeU8(buffer, CACHE_HASHMAP);
+            writeU64(buffer, map->capacity);
+            writeU64(buffer, map->total);
+            // Store the slot itself so the loaded table is identical, probing included
+            for (size_t slot = 0; slot < map->capacity; slot++) {
+                if (!map->entries[slot].empty) {
+                    writeU64(buffer, slot);
+                    writeValue(writer, buffer, map->entries[slot].key);
+                    writeValue(writer, buffer, map->entries[slot].value);
+                }
+            }
+            return;
+        }
+        // The compiler never puts these in a constant pool
+        case OBJ_NEVER:
+        case OBJ_NATIVE:
+        case OBJ_STRING_VIEW:
+        case OBJ_BIGINT:
+        case OBJ_MATRIX:
+        case OBJ_MATRIX_ROW:
+            writer->failed = true;
+            return;
+    }
+}
+
+static void writeFunction(Writer* writer, ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    Buffer* buffer = &writer->functions;
+    writeU32(buffer, function->name ? stringIndex(writer, function->name) : NO_STRING);
+    writeU32(buffer, (uint32_t)function->arity);
+    writeU32(buffer, (uint32_t)function->maxStack);
+    writeU32(buffer, (uint32_t)chunk->count);
+
+    writeU64(buffer, writer->data.count);
+    writeBytes(&writer->data, chunk->code, chunk->count);
+    alignBuffer(&writer->data, sizeof(int));
+    writeU32(buffer, (uint32_t)chunk->lineCount);
+    writeU64(buffer, writer->data.count);
+    writeBytes(&writer->data, chunk->lines, sizeof(LineRun) * chunk->lineCount);
+
+    writeU32(buffer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeValue(writer, buffer, chunk->constants.values[i]);
+    }
+}
+
+bool writeCache(const char* path, ObjFunction* function, uint64_t hash) {
+    Writer writer = {0};
+    hashmap_init(&writer.stringIndex, 256, (hash_function)hashAny);
+    collectFunctions(&writer, function);
+    for (uint32_t i = 0; i < writer.functionCount; i++) {
+        writeFunction(&writer, writer.list[i]);
+    }
+
+    Buffer header = {0};
+    writeBytes(&header, LOXC_MAGIC, 4);
+    writeU32(&header, LOXC_VERSION);
+    writeU32(&header, LOXC_LAYOUT);
+    writeU32(&header, writer.stringCount);
+    writeU32(&header, writer.functionCount);
+    writeU32(&header, 0);
+    writeU64(&header, hash);
+    writeU64(&header, 0);
+    size_t dataOffset = HEADER_SIZE + writer.strings.count + writer.functions.count;
+    dataOffset += (8 - dataOffset % 8) % 8;
+    writeU64(&header, dataOffset);
+    writeU64(&header, writer.data.count);
+    writeBytes(&header, writer.strings.bytes, writer.strings.count);
+    writeBytes(&header, writer.functions.bytes, writer.functions.count);
+    alignBuffer(&header, 8);
+    // Bytecode is trusted once loaded, so a corrupt file must not get that far
+    uint64_t checksum = fnv(FNV_OFFSET, header.bytes + HEADER_SIZE, header.count - HEADER_SIZE);
+    checksum = fnv(checksum, writer.data.bytes, writer.data.count);
+    memcpy(header.bytes + HEADER_SIZE - 3 * sizeof(uint64_t), &checksum, sizeof(checksum));
+
+    bool ok = !writer.failed;
+    if (ok) {
+        // Write then rename, so concurrent runs never map a half-written file
+        size_t size = strlen(path) + 32;
+        char* temporary = malloc(size);
+        snprintf(temporary, size, "%s.%ld.tmp", path, (long)getpid());
+        FILE* file = fopen(temporary, "wb");
+        ok = file
+            && fwrite(header.bytes, 1, header.count, file) == header.count
+            && fwrite(writer.data.bytes, 1, writer.data.count, file) == writer.data.count;
+        if (file && fclose(file) != 0) {
+            ok = false;
+        }
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok) {
+            remove(temporary);
+        }
+        free(temporary);
+    }
+
+    freeBuffer(&header);
+    freeBuffer(&writer.strings);
+    freeBuffer(&writer.functions);
+    freeBuffer(&writer.data);
+    FREE_ARRAY(ObjFunction*, writer.list, writer.functionCapacity);
+    hashmap_free(&writer.stringIndex);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loading
+
+typedef struct {
+    const uint8_t* current;
+    const uint8_t* end;
+    ObjString** strings;
+    uint32_t stringCount;
+    ObjFunction** functions;
+    uint32_t functionCount;
+    bool failed;
+} Reader;
+
+static const uint8_t* readBytes(Reader* reader, size_t size) {
+    if (reader->failed || (size_t)(reader->end - reader->current) < size) {
+        reader->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = reader->current;
+    reader->current += size;
+    return bytes;
+}
+
+static uint8_t readU8(Reader* reader) {
+    const uint8_t* bytes = readBytes(reader, sizeof(uint8_t));
+    return bytes ? *bytes : 0;
+}
+
+static uint32_t readU32(Reader* reader) {
+    uint32_t value = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(value));
+    if (bytes) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static uint64_t readU64(Reader* reader) {
+    uint64_t value = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(value));
+    if (bytes) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static Value readValue(Reader* reader) {
+    switch (readU8(reader)) {
+        case CACHE_NIL: return NIL_VAL;
+        case CACHE_FALSE: return BOOL_VAL(false);
+        case CACHE_TRUE: return BOOL_VAL(true);
+        case CACHE_INT: return INTEGER_VAL((int64_t)readU64(reader));
+        case CACHE_DOUBLE: {
+            Value value = DOUBLE_VAL(0.0);
+            const uint8_t* bytes = readBytes(reader, sizeof(double));
+            if (bytes) {
+                memcpy(&value.as._double, bytes, sizeof(double));
+            }
+            return value;
+        }
+        case CACHE_FCOMPLEX: {
+            Value value = FCOMPLEX_VAL(0.0f);
+            const uint8_t* bytes = readBytes(reader, sizeof(float complex));
+            if (bytes) {
+                memcpy(&value.as._fcomplex, bytes, sizeof(float complex));
+            }
+            return value;
+        }
+        case CACHE_BIGINT: {
+            bool negative = readU8(reader);
+            uint64_t length = readU64(reader);
+            if (length > (size_t)(reader->end - reader->current) / sizeof(uint64_t)) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            // The limbs are unaligned in the mapping, newBigInt copies them with memcpy
+            const uint8_t* limbs = readBytes(reader, sizeof(uint64_t) * length);
+            return BIGINT_VAL(newBigInt(negative, (const uint64_t*)limbs, length));
+        }
+        case CACHE_STRING: {
+            uint32_t index = readU32(reader);
+            if (index >= reader->stringCount) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            return OBJ_VAL(reader->strings[index]);
+        }
+        case CACHE_FUNCTION: {
+            uint32_t index = readU32(reader);
+            if (index >= reader->functionCount) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            return OBJ_VAL(reader->functions[index]);
+        }
+        case CACHE_ARRAY: {
+            uint64_t length = readU64(reader);
+            if (length > (size_t)(reader->end - reader->current)) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            ObjArray* array = allocateArray(length);
+            for (uint64_t i = 0; i < length && !reader->failed; i++) {
+                array->values[i] = readValue(reader);
+            }
+            array->length = length;
+            return OBJ_VAL(array);
+        }
+        case CACHE_HASHMAP: {
+            uint64_t capacity = readU64(reader);
+            uint64_t count = readU64(reader);
+            if (count > capacity || capacity > (size_t)(reader->end - reader->current)
+                    || (capacity & (capacity - 1)) != 0) {
+                reader->failed = true;
+                return NIL_VAL;
+            }
+            ObjHashmap* hashmap = allocateHashmap(capacity);
+            for (uint64_t i = 0; i < count && !reader->failed; i++) {
+                uint64_t slot = readU64(reader);
+                Value key = readValue(reader);
+                Value value = readValue(reader);
+                if (slot >= capacity || !hashmap->map.entries[slot].empty) {
+                    reader->failed = true;
+                    break;
+                }
+                hashmap->map.entries[slot] = (hashmap_item){key, value, false};
+                hashmap->map.total++;
+            }
+            return OBJ_VAL(hashmap);
+        }
+    }
+    reader->failed = true;
+    return NIL_VAL;
+}
+
+static void readFunction(Reader* reader, ObjFunction* function, const uint8_t* data, uint64_t dataSize) {
+    uint32_t name = readU32(reader);
+    uint32_t arity = readU32(reader);
+    uint32_t maxStack = readU32(reader);
+    uint32_t count = readU32(reader);
+    uint64_t code = readU64(reader);
+    uint32_t lineCount = readU32(reader);
+    uint64_t lines = readU64(reader);
+    uint64_t linesSize = sizeof(LineRun) * (uint64_t)lineCount;
+    if (name != NO_STRING && name >= reader->stringCount) {
+        reader->failed = true;
+    }
+    if (code > dataSize || count > dataSize - code
+            || lines > dataSize || linesSize > dataSize - lines || lines % sizeof(int) != 0) {
+        reader->failed = true;
+    }
+    if (reader->failed) {
+        return;
+    }
+
+    function->name = name == NO_STRING ? NULL : reader->strings[name];
+    function->arity = (int)arity;
+    function->maxStack = (int)maxStack;
+    Chunk* chunk = &function->chunk;
+    chunk->count = (int)count;
+    chunk->capacity = (int)count;
+    chunk->code = (uint8_t*)(data + code);
+    chunk->lines = (LineRun*)(data + lines);
+    chunk->lineCount = (int)lineCount;
+    chunk->lineCapacity = (int)lineCount;
+    chunk->mapped = true;
+
+    uint32_t constantCount = readU32(reader);
+    for (uint32_t i = 0; i < constantCount && !reader->failed; i++) {
+        writeValues(&chunk->constants, readValue(reader));
+    }
+}
+
+static void* mapFile(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    void* start = NULL;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        *size = (size_t)info.st_size;
+        start = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (start == MAP_FAILED) {
+            start = NULL;
+        }
+    }
+    // The mapping outlives the descriptor
+    close(fd);
+    return start;
+}
+
+ObjFunction* loadCache(const char* path, uint64_t hash) {
+    size_t size = 0;
+    uint8_t* start = mapFile(path, &size);
+    if (!start) {
+        return NULL;
+    }
+    Reader reader = {start, start + size, NULL, 0, NULL, 0, false};
+
+    const uint8_t* magic = readBytes(&reader, 4);
+    bool current = magic && memcmp(magic, LOXC_MAGIC, 4) == 0
+        && readU32(&reader) == LOXC_VERSION
+        && readU32(&reader) == LOXC_LAYOUT;
+    reader.stringCount = readU32(&reader);
+    reader.functionCount = readU32(&reader);
+    readU32(&reader);
+    current = current && readU64(&reader) == hash;
+    uint64_t checksum = readU64(&reader);
+    uint64_t dataOffset = readU64(&reader);
+    uint64_t dataSize = readU64(&reader);
+    current = current && !reader.failed && fnv(FNV_OFFSET, start + HEADER_SIZE, size - HEADER_SIZE) == checksum;
+    if (!current || reader.failed || reader.functionCount == 0
+            || dataOffset % 8 != 0 || dataOffset > size || dataSize > size - dataOffset
+            || reader.stringCount > size || reader.functionCount > size) {
+        munmap(start, size);
+        return NULL;
+    }
+    const uint8_t* data = start + dataOffset;
+    reader.end = data;
+
+    // Intern every string once up front, constants then refer to them by index
+    reader.strings = ALLOCATE(ObjString*, reader.stringCount);
+    for (uint32_t i = 0; i < reader.stringCount && !reader.failed; i++) {
+        uint32_t length = readU32(&reader);
+        const uint8_t* chars = readBytes(&reader, length);
+        reader.strings[i] = chars ? copyString((const char*)chars, length) : NULL;
+    }
+
+    // Allocate every function first, constants may refer to any of them
+    reader.functions = ALLOCATE(ObjFunction*, reader.functionCount);
+    for (uint32_t i = 0; i < reader.functionCount; i++) {
+        reader.functions[i] = newFunction(NULL, NULL);
+    }
+    for (uint32_t i = 0; i < reader.functionCount && !reader.failed; i++) {
+        readFunction(&reader, reader.functions[i], data, dataSize);
+    }
+
+    ObjFunction* function = reader.functions[0];
+    if (reader.failed) {
+        // Whatever was loaded stays on vm.objects, so it must not point into the mapping
+        for (uint32_t i = 0; i < reader.functionCount; i++) {
+            freeChunk(&reader.functions[i]->chunk);
+        }
+        munmap(start, size);
+        function = NULL;
+    } else {
+        Mapping* mapping = ALLOCATE(Mapping, 1);
+        mapping->start = start;
+        mapping->size = size;
+        mapping->next = mappings;
+        mappings = mapping;
+    }
+    FREE_ARRAY(ObjString*, reader.strings, reader.stringCount);
+    FREE_ARRAY(ObjFunction*, reader.functions, reader.functionCount);
+    return function;
+}
+
+void unmapCaches(void) {
+    while (mappings) {
+        Mapping* next = mappings->next;
+        munmap(mappings->start, mappings->size);
+        FREE_ARRAY(Mapping, mappings, 1);
+        mappings = next;
+    }
+}
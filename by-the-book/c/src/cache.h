@@ -0,0 +1,23 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "common.h"
+#include "object.h"
+
+// Precompiled bytecode files, see cache.c for the layout
+#define LOXC_MAGIC "LOXC"
+#define LOXC_EXTENSION ".loxc"
+// Bump whenever the file layout, an opcode or an operand encoding changes
+#define LOXC_VERSION 9
+
+uint64_t cacheHash(const char* source, size_t length);
+// Next to the source (foo.lox -> foo.loxc) or cacheDir/<hash>.loxc, caller frees
+char* cachePath(const char* sourcePath, const char* cacheDir, uint64_t hash);
+
+// NULL if the file is missing, stale, from another version or malformed
+ObjFunction* loadCache(const char* path, uint64_t hash);
+bool writeCache(const char* path, ObjFunction* function, uint64_t hash);
+// Loaded chunks point into their mapping, call after freeing every object
+void unmapCaches(void);
+
+#endif
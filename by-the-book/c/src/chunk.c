@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "chunk.h"
 #include "memory.h"
 
@@ -6,14 +8,19 @@ void initChunk(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
-    chunk->columns = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    chunk->callees = NULL;
+    chunk->mapped = false;
     initValues(&chunk->constants);
 }
 
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
-    FREE_ARRAY(int, chunk->columns, chunk->capacity);
+    if (!chunk->mapped) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(LineRun, chunk->lines, chunk->lineCapacity);
+    }
+    FREE_ARRAY(Obj*, chunk->callees, chunk->callees ? chunk->count : 0);
     freeValues(&chunk->constants);
     initChunk(chunk);
 }
@@ -23,15 +30,49 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line, int column) {
         int old = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, old, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, old, chunk->capacity);
-        chunk->columns = GROW_ARRAY(int, chunk->columns, old, chunk->capacity);
     }
-    chunk->lines[chunk->count] = line;
-    chunk->columns[chunk->count] = column;
     chunk->code[chunk->count] = byte;
+
+    LineRun* last = chunk->lineCount > 0 ? &chunk->lines[chunk->lineCount - 1] : NULL;
+    if (!last || last->line != line || last->column != column) {
+        if (chunk->lineCapacity < chunk->lineCount + 1) {
+            int old = chunk->lineCapacity;
+            chunk->lineCapacity = GROW_CAPACITY(old);
+            chunk->lines = GROW_ARRAY(LineRun, chunk->lines, old, chunk->lineCapacity);
+        }
+        chunk->lines[chunk->lineCount++] = (LineRun){chunk->count, line, column};
+    }
     chunk->count++;
 }
 
+// Drop everything written after the first count bytes, keeps the allocation
+void rewindChunk(Chunk* chunk, int count) {
+    if (count < chunk->count) {
+        chunk->count = count;
+        while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+            chunk->lineCount--;
+        }
+    }
+}
+
+// Binary search for the run holding offset
+LineRun getLineRun(const Chunk* chunk, int offset) {
+    if (chunk->lineCount == 0 || offset < 0) {
+        return (LineRun){offset, 0, 0};
+    }
+    int low = 0;
+    int high = chunk->lineCount - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return chunk->lines[low];
+}
+
 int addConstant(Chunk* chunk, Value value) {
     writeValues(&chunk->constants, value);
     return chunk->constants.count - 1;
@@ -43,12 +84,13 @@ void write24Bit(Chunk* chunk, int offset, int line, int column) {
     writeChunk(chunk, (uint8_t)((offset >> 16) & 0xff), line, column);
 }
 
-int writeConstantByOffset(Chunk* chunk, OpCode instr, OpCode instrLong, int offset, int line, int column) {
-    if (chunk->constants.count < MIN_SIZE_TO_CONSTANT_LONG) {
+int writeConstantByOffset(Chunk* chunk, OpCode instr, int offset, int line, int column) {
+    if (offset <= UINT8_MAX) {
         writeChunk(chunk, instr, line, column);
         writeChunk(chunk, (uint8_t)offset, line, column);
     } else {
-        writeChunk(chunk, instrLong, line, column);
+        writeChunk(chunk, OP_WIDE, line, column);
+        writeChunk(chunk, instr, line, column);
         // not only 1 but 3 bytes!
         write24Bit(chunk, offset, line, column);
     }
@@ -57,5 +99,214 @@ int writeConstantByOffset(Chunk* chunk, OpCode instr, OpCode instrLong, int offs
 
 int writeConstant(Chunk* chunk, Value value, int line, int column) {
     int offset = addConstant(chunk, value);
-    return writeConstantByOffset(chunk, OP_CONSTANT, OP_CONSTANT_LONG, offset, line, column);
+    return writeConstantByOffset(chunk, OP_CONSTANT, offset, line, column);
+}
+
+int instructionLength(const Chunk* chunk, int offset) {
+    bool wide = chunk->code[offset] == OP_WIDE;
+    if (wide) {
+        if (offset + 1 >= chunk->count) {
+            return 1;
+        }
+        offset++;
+    }
+    switch ((OpCode)chunk->code[offset]) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP:
+        case OP_NEG_JUMP:
+        case OP_BUILD_ARRAY:
+        case OP_APPEND_ARRAY:
+        case OP_BUILD_HASHMAP:
+        case OP_APPEND_HASHMAP:
+        case OP_COPY_CONSTANT:
+            return 1 + SIZE_OF_24BIT_ARGS;
+        case OP_CALL_BUILTIN:
+            return 3;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CONSTANT:
+            return wide ? 2 + SIZE_OF_24BIT_ARGS : 2;
+        case OP_INVALID:
+        case OP_RETURN:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_SWAP:
+        case OP_WIDE:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NAN:
+        case OP_INF:
+        case OP_SUBSCRIPT:
+        case OP_TYPEOF:
+        case OP_ARRAY_SET:
+        case OP_ARRAY_POP:
+        case OP_NEG:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_REMAINDER:
+        case OP_EXP:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR:
+        case OP_BITNEG:
+        case OP_LEFT_SHIFT:
+        case OP_RIGHT_SHIFT:
+        case OP_SIZE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+            return 1;
+    }
+    return 1;
+}
+
+// Stack slots an instruction pops and then pushes, not counting the operands' own transients
+static void stackEffect(const Chunk* chunk, int offset, int* pops, int* pushes) {
+    bool wide = chunk->code[offset] == OP_WIDE;
+    if (wide) {
+        offset++;
+    }
+    const uint8_t* operand = &chunk->code[offset + 1];
+#define COUNT() (operand[0] | operand[1] << 8 | operand[2] << 16)
+    *pops = 0;
+    *pushes = 0;
+    switch ((OpCode)chunk->code[offset]) {
+        case OP_PRINT:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+            *pops = 1;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            *pops = operand[0] + 1;
+            *pushes = 1;
+            break;
+        case OP_CALL_BUILTIN:
+            *pops = operand[1];
+            *pushes = 1;
+            break;
+        case OP_ARRAY_SET:
+            *pops = 3;
+            *pushes = 1;
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_CONSTANT:
+        case OP_COPY_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NAN:
+        case OP_INF:
+            *pushes = 1;
+            break;
+        case OP_BUILD_ARRAY:
+            *pops = COUNT();
+            *pushes = 1;
+            break;
+        case OP_APPEND_ARRAY:
+            *pops = COUNT();
+            break;
+        case OP_BUILD_HASHMAP:
+            *pops = 2 * COUNT();
+            *pushes = 1;
+            break;
+        case OP_APPEND_HASHMAP:
+            *pops = 2 * COUNT();
+            break;
+        case OP_SUBSCRIPT:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_REMAINDER:
+        case OP_EXP:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR:
+        case OP_LEFT_SHIFT:
+        case OP_RIGHT_SHIFT:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+            *pops = 2;
+            *pushes = 1;
+            break;
+        case OP_INVALID:
+        case OP_RETURN:
+        case OP_SWAP:
+        case OP_WIDE:
+        case OP_SET_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP:
+        case OP_NEG_JUMP:
+        case OP_TYPEOF:
+        case OP_ARRAY_POP:
+        case OP_NEG:
+        case OP_BITNEG:
+        case OP_SIZE:
+        case OP_NOT:
+            break;
+    }
+#undef COUNT
+}
+
+int chunkMaxStack(const Chunk* chunk, int entry) {
+    if (chunk->count == 0) {
+        return entry;
+    }
+    // Depth before each instruction, -1 until a path reaches it. The compiler leaves the same
+    // depth at a jump target on every path, so the first one to get there decides it.
+    int* depths = malloc(sizeof(int) * chunk->count);
+    int* pending = malloc(sizeof(int) * chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        depths[i] = -1;
+    }
+    int pendingCount = 0;
+    int max = entry;
+    depths[0] = entry;
+    pending[pendingCount++] = 0;
+    while (pendingCount > 0) {
+        int offset = pending[--pendingCount];
+        while (offset < chunk->count) {
+            int pops, pushes;
+            stackEffect(chunk, offset, &pops, &pushes);
+            int depth = depths[offset] - pops + pushes;
+            if (depth < 0) {
+                depth = 0;
+            }
+            if (depth > max) {
+                max = depth;
+            }
+            OpCode op = chunk->code[offset];
+            int next = offset + instructionLength(chunk, offset);
+            if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_NEG_JUMP) {
+                int jump = chunk->code[offset + 1] | chunk->code[offset + 2] << 8 | chunk->code[offset + 3] << 16;
+                int target = op == OP_NEG_JUMP ? next - jump : next + jump;
+                if (target >= 0 && target < chunk->count && depths[target] == -1) {
+                    depths[target] = depth;
+                    pending[pendingCount++] = target;
+                }
+            }
+            if (op == OP_RETURN || op == OP_INVALID || op == OP_JUMP || op == OP_NEG_JUMP
+                    || next >= chunk->count || depths[next] != -1) {
+                break;
+            }
+            depths[next] = depth;
+            offset = next;
+        }
+    }
+    free(depths);
+    free(pending);
+    return max;
 }
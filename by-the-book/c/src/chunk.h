@@ -4,6 +4,7 @@
 #include "common.h"
 #include "value.h"
 
+// Bump LOXC_VERSION in cache.h whenever these change
 typedef enum {
     // TODO assert less than 256 ops total
     OP_INVALID,
@@ -13,36 +14,40 @@ typedef enum {
     OP_POP,
     OP_SWAP,
     OP_CALL,
-    // Variables
+    OP_TAIL_CALL, // OP_CALL whose result is returned right away, the callee reuses the frame
+    // Calls to builtins the compiler resolved by name, the arguments are replaced by the result
+    OP_CALL_BUILTIN, // Two bytes: index in vm.builtins and argument count
+    OP_TYPEOF,       // type(value)
+    OP_ARRAY_SET,    // setArray(array, index, value)
+    OP_ARRAY_POP,    // rmArrayTop(array)
+    // Prefix, the next instruction takes a 24-bit operand instead of one byte
+    OP_WIDE,
+    // Variables, one-byte operand unless prefixed by OP_WIDE
     OP_DEFINE_GLOBAL,
-    OP_DEFINE_GLOBAL_LONG,
     OP_GET_GLOBAL,
-    OP_GET_GLOBAL_LONG,
     OP_SET_GLOBAL,
-    OP_SET_GLOBAL_LONG,
     OP_GET_LOCAL,
-    OP_GET_LOCAL_LONG,
     OP_SET_LOCAL,
-    OP_SET_LOCAL_LONG,
     // Jumps
     OP_JUMP_IF_FALSE,
     OP_JUMP,
     OP_NEG_JUMP,
     // Values
     OP_CONSTANT,
-    OP_CONSTANT_LONG,
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
     OP_NAN,
     OP_INF,
-    // Arrays
-    OP_INIT_ARRAY,
+    // Arrays, the 24-bit operand is the number of values on the stack
+    OP_BUILD_ARRAY,
+    OP_APPEND_ARRAY,
     OP_SUBSCRIPT,
-    OP_INSERT_ARRAY,
-    // Hashmaps
-    OP_INIT_HASHMAP,
-    OP_INSERT_HASHMAP,
+    // Hashmaps, the 24-bit operand is the number of key-value pairs on the stack
+    OP_BUILD_HASHMAP,
+    OP_APPEND_HASHMAP,
+    // Push a fresh copy of the array or hashmap constant at the 24-bit index
+    OP_COPY_CONSTANT,
     // Arithmetic
     OP_NEG,
     OP_ADD,
@@ -67,22 +72,51 @@ typedef enum {
     OP_LESS,
 } OpCode;
 
+#define OP_COUNT (OP_LESS + 1) // OP_LESS must stay the last opcode
+
+// Builtins with an instruction of their own. initVM() defines them first, so these are
+// their indices in vm.builtins.
+typedef enum {
+    BUILTIN_TYPE,
+    BUILTIN_SET_ARRAY,
+    BUILTIN_RM_ARRAY_TOP,
+} BuiltinId;
+
+// Every byte from offset up to the next run's offset came from line:column
+typedef struct {
+    int offset;
+    int line;
+    int column;
+} LineRun;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
-    int* columns;
+    // Only read on errors and by debug natives, so runs instead of an int pair per byte
+    LineRun* lines;
+    int lineCount;
+    int lineCapacity;
     ValueArray constants;
+    // Last callee of each call site, by offset of its OP_CALL. Allocated by the first call made
+    // from the chunk, the entries only ever point at objects that passed the call's arity check.
+    Obj** callees;
+    bool mapped; // code and lines point into a read-only .loxc mapping
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line, int column);
+void rewindChunk(Chunk* chunk, int count);
+LineRun getLineRun(const Chunk* chunk, int offset);
 int addConstant(Chunk* chunk, Value value);
-int writeConstantByOffset(Chunk* chunk, OpCode instr, OpCode instrLong, int offset, int line, int column);
+int writeConstantByOffset(Chunk* chunk, OpCode instr, int offset, int line, int column);
 void write24Bit(Chunk* chunk, int offset, int line, int column);
 int writeConstant(Chunk* chunk, Value value, int line, int column);
+// Bytes in the instruction at offset, an OP_WIDE prefix and its instruction count as one
+int instructionLength(const Chunk* chunk, int offset);
+// Most slots a frame running chunk has on the stack at once, starting with entry of them
+int chunkMaxStack(const Chunk* chunk, int entry);
 
 #define SIZE_OF_24BIT_ARGS 3  // 24 bits is 3 bytes
 
@@ -9,6 +9,17 @@
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 extern bool DEBUG_TRACE;
+extern bool REGISTER_VM; // Run functions that lower cleanly on the register VM
+extern int JIT_THRESHOLD; // Calls plus loop back-edges before a function is compiled, 0 for never
+// Profiling modes, see profile.c. PROFILING is set with any of them but PROFILE_EVENTS,
+// which only hooks calls and returns.
+extern bool PROFILING;
+extern bool PROFILE_OPS; // Count every instruction the stack VM runs per opcode
+extern bool PROFILE_STACKS; // Sample the Lox call stack on SIGPROF
+extern bool PROFILE_LINES; // Count instructions and allocated bytes per source line
+extern bool PROFILE_HEAP; // Account allocations per object type and source site
+extern bool PROFILE_MAPS; // Print the globals and interned strings tables' stats as each VM is freed
+extern bool PROFILE_EVENTS; // Time every call, native call and compile phase for a trace viewer
 
 #define ERR_PRINT(...) fprintf(stderr, ##__VA_ARGS__)
 
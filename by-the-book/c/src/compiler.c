@@ -1,12 +1,22 @@
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "bigint.h"
 #include "scanner.h"
 #include "chunk.h"
 #include "debug.h"
+#include "hashmap.h"
+#include "memory.h"
 #include "object.h"
+#include "profile.h"
 
 bool DEBUG_PARSER = false;
+
+// Values pushed on the stack before they are collected into the array or hashmap, a hashmap
+// batch is half as many pairs. chunkMaxStack() counts them into the frame's size.
+#define LITERAL_BATCH 256
 static int depth = 4;
 #define debugp(name) { if (DEBUG_PARSER) { fprintf(stderr, "%*s%s\n", depth += 2, "start ", name); } }
 #define debugpi(name, param) { if (DEBUG_PARSER) { fprintf(stderr, "%*s%s: %d\n", depth += 2, "start ", name, param); } }
@@ -56,12 +66,25 @@ typedef enum {
     TYPE_GLOBAL,
 } FunctionType;
 
+// One entry of the compile-time constant index
+typedef struct {
+    Value value;
+    int index; // Into the constant pool, -1 if this slot is empty
+} ConstantSlot;
+
 typedef struct Compiler {
     int localCount;
     int scopeDepth;
     int localsSize;
     ObjFunction* function;
+    // Open-addressed index of the constant pool, so repeated names and literals share one entry
+    ConstantSlot* constantSlots;
+    int constantSlotCount;
+    int constantSlotCapacity;
     FunctionType type;
+    int lastCall; // Offset of the latest OP_CALL, a return right after it becomes a tail call
+    int lastBuiltin; // Offset of the latest OP_GET_GLOBAL of a builtin, a call right after it becomes an intrinsic
+    int lastBuiltinIndex;
     struct Compiler* enclosing;
     struct Compiler* next;
     // This field must always be at the end
@@ -176,13 +199,87 @@ static void patchJump(int offset) {
     currentChunk()->code[offset + 2] = (uint8_t)((jump >> 16) & 0xff);
 }
 
+// Same type and same bits, valuesEqual would merge 1 with 1.0 and 0.0 with -0.0
+static bool sameConstant(Value a, Value b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) { // Exhaustive!
+        case VAL_NEVER: return false;
+        case VAL_NIL: return true;
+        case VAL_BOOL:
+        case VAL_INT:
+        case VAL_DOUBLE:
+        case VAL_FCOMPLEX:
+            // Every payload is 8 bytes, compare the raw bits
+            return a.as._int == b.as._int;
+        case VAL_BIGINT: return bigintCompare(a, b) == 0;
+        // Strings are interned, anything else is never shared
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+    }
+    return false;
+}
+
+static size_t constantHash(Value value) {
+    if (IS_BIGINT(value)) {
+        return bigintHash(AS_BIGINT(value));
+    }
+    if (IS_OBJ(value)) {
+        return AS_STRING(value)->hash;
+    }
+    return hashInt((uint64_t)value.as._int) ^ value.type;
+}
+
+static ConstantSlot* findConstantSlot(ConstantSlot* slots, int capacity, Value value) {
+    size_t index = constantHash(value) & (capacity - 1);
+    while (slots[index].index != -1 && !sameConstant(slots[index].value, value)) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &slots[index];
+}
+
+static void growConstantSlots(Compiler* compiler) {
+    int old = compiler->constantSlotCapacity;
+    int capacity = GROW_CAPACITY(old);
+    ConstantSlot* slots = ALLOCATE(ConstantSlot, capacity);
+    for (int i = 0; i < capacity; i++) {
+        slots[i].index = -1;
+    }
+    for (int i = 0; i < old; i++) {
+        if (compiler->constantSlots[i].index != -1) {
+            *findConstantSlot(slots, capacity, compiler->constantSlots[i].value) = compiler->constantSlots[i];
+        }
+    }
+    FREE_ARRAY(ConstantSlot, compiler->constantSlots, old);
+    compiler->constantSlots = slots;
+    compiler->constantSlotCapacity = capacity;
+}
+
 static int makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
-    return constant;
+    Chunk* chunk = currentChunk();
+    // Functions, arrays and hashmaps are unique objects, only scalars and strings are shared
+    if (IS_OBJ(value) && !IS_STRING(value)) {
+        return addConstant(chunk, value);
+    }
+    if ((current->constantSlotCount + 1) * 2 > current->constantSlotCapacity) {
+        growConstantSlots(current);
+    }
+    ConstantSlot* slot = findConstantSlot(current->constantSlots, current->constantSlotCapacity, value);
+    // Literal prebuilding truncates the pool, so a remembered index may be gone
+    if (slot->index != -1 && slot->index < chunk->constants.count
+            && sameConstant(chunk->constants.values[slot->index], value)) {
+        return slot->index;
+    }
+    if (slot->index == -1) {
+        current->constantSlotCount++;
+    }
+    slot->value = value;
+    slot->index = addConstant(chunk, value);
+    return slot->index;
 }
 
 static int emitConstant(Value value) {
-    return writeConstant(currentChunk(), value, parser.previous.line, parser.previous.column);
+    return writeConstantByOffset(currentChunk(), OP_CONSTANT, makeConstant(value), parser.previous.line, parser.previous.column);
 }
 
 static void initCompiler(size_t localsSize, FunctionType type) {
@@ -202,6 +299,8 @@ static void initCompiler(size_t localsSize, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->lastCall = -1;
+    compiler->lastBuiltin = -1;
     compiler->localsSize = localsSize;
     current = compiler;
     compiler->next = root;
@@ -218,6 +317,7 @@ static void freeCompiler(void) {
     Compiler* compiler = root;
     while (compiler != NULL) {
         Compiler* next = compiler->next;
+        FREE_ARRAY(ConstantSlot, compiler->constantSlots, compiler->constantSlotCapacity);
         free(compiler);
         compiler = next;
     }
@@ -232,7 +332,7 @@ static void markInitialized(void) {
 static void defineVariable(int global) {
     debugp("defineVariable");
     if (current->scopeDepth == 0) {
-        writeConstantByOffset(currentChunk(), OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global, parser.previous.line, parser.previous.column);
+        writeConstantByOffset(currentChunk(), OP_DEFINE_GLOBAL, global, parser.previous.line, parser.previous.column);
     } else {
         markInitialized();
         // No op-codes needed to define local variables at runtime
@@ -243,6 +343,7 @@ static void defineVariable(int global) {
 static ObjFunction* endCompiler(bool debugPrint) {
     emitReturn();
     ObjFunction* func = current->function;
+    func->maxStack = chunkMaxStack(&func->chunk, func->arity + 1);
     if (debugPrint) {
         // TODO filename and script directory
         const char* name = func->name ? func->name->chars : "<script>";
@@ -370,8 +471,39 @@ static uint8_t argumentList() {
     return argCount;
 }
 
+// Whether the callee is the OP_GET_GLOBAL of a builtin that was emitted last
+static bool calleeIsBuiltin(void) {
+    Chunk* chunk = currentChunk();
+    int start = current->lastBuiltin;
+    if (start == -1) {
+        return false;
+    }
+    bool wide = chunk->code[start] == OP_WIDE;
+    int length = wide ? 2 + SIZE_OF_24BIT_ARGS : 2;
+    return start + length == chunk->count && chunk->code[start + wide] == OP_GET_GLOBAL;
+}
+
 static void call(bool canAssign) {
+    if (calleeIsBuiltin()) {
+        // The VM looks builtins up by index and only falls back to the global once it was replaced
+        int index = current->lastBuiltinIndex;
+        rewindChunk(currentChunk(), current->lastBuiltin);
+        current->lastBuiltin = -1;
+        uint8_t argCount = argumentList();
+        if (index == BUILTIN_TYPE && argCount == 1) {
+            emitByte(OP_TYPEOF);
+        } else if (index == BUILTIN_SET_ARRAY && argCount == 3) {
+            emitByte(OP_ARRAY_SET);
+        } else if (index == BUILTIN_RM_ARRAY_TOP && argCount == 1) {
+            emitByte(OP_ARRAY_POP);
+        } else {
+            emitBytes(OP_CALL_BUILTIN, index);
+            emitByte(argCount);
+        }
+        return;
+    }
     uint8_t argCount = argumentList();
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
@@ -452,6 +584,9 @@ static void block(void) {
 static void function(FunctionType type) {
     debugp("function");
     initCompiler(256, type);
+    if (PROFILE_EVENTS) {
+        profileEnter(current->function->name->chars, "compile");
+    }
     beginScope();
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function definition.");
     if (!check(TOKEN_RIGHT_PAREN)) {
@@ -466,7 +601,10 @@ static void function(FunctionType type) {
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
     block();
     ObjFunction* function = endCompiler(DEBUG_TRACE);
-    emitBytes(OP_CONSTANT, makeConstant(OBJ_VAL(function)));
+    if (PROFILE_EVENTS) {
+        profileLeave();
+    }
+    emitConstant(OBJ_VAL(function));
     debugend("function");
 }
 
@@ -509,6 +647,10 @@ static void returnStatement(void) {
     } else {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return.");
+        // Jumps over the call, as in `return a and f()`, still land on the OP_RETURN
+        if (current->lastCall == currentChunk()->count - 2) {
+            currentChunk()->code[current->lastCall] = OP_TAIL_CALL;
+        }
         emitByte(OP_RETURN);
     }
 }
@@ -711,7 +853,7 @@ static int resolveLocal(Compiler* compiler, Token* name) {
 static void namedVariable(Token name, bool canAssign) {
     int offset = resolveLocal(current, &name);
 
-    OpCode instr, instrLong;
+    OpCode instr;
     if (canAssign && 
         (match(TOKEN_EQUAL)
         || match(TOKEN_MINUS_EQUAL)
@@ -733,14 +875,12 @@ static void namedVariable(Token name, bool canAssign) {
             if (offset != -1) {
                 // Local variables
                 instr = OP_GET_LOCAL;
-                instrLong = OP_GET_LOCAL_LONG;
             } else {
                 // Global variables
                 offset = identifierConstant(&name);
                 instr = OP_GET_GLOBAL;
-                instrLong = OP_GET_GLOBAL_LONG;
             }
-            writeConstantByOffset(currentChunk(), instr, instrLong, offset, parser.previous.line, parser.previous.column);
+            writeConstantByOffset(currentChunk(), instr, offset, parser.previous.line, parser.previous.column);
             if (instr == OP_GET_GLOBAL) {
                 offset = -1;
             }
@@ -768,26 +908,27 @@ static void namedVariable(Token name, bool canAssign) {
         if (offset != -1) {
             // Local variables
             instr = OP_SET_LOCAL;
-            instrLong = OP_SET_LOCAL_LONG;
         } else {
             // Global variables
             offset = identifierConstant(&name);
             instr = OP_SET_GLOBAL;
-            instrLong = OP_SET_GLOBAL_LONG;
         }
     } else {
         if (offset != -1) {
             // Local variables
             instr = OP_GET_LOCAL;
-            instrLong = OP_GET_LOCAL_LONG;
         } else {
             // Global variables
             offset = identifierConstant(&name);
             instr = OP_GET_GLOBAL;
-            instrLong = OP_GET_GLOBAL_LONG;
+            int builtin = copyString(name.start, name.length)->builtin;
+            if (builtin > 0 && builtin <= UINT8_COUNT) {
+                current->lastBuiltin = currentChunk()->count;
+                current->lastBuiltinIndex = builtin - 1;
+            }
         }
     }
-    writeConstantByOffset(currentChunk(), instr, instrLong, offset, parser.previous.line, parser.previous.column);
+    writeConstantByOffset(currentChunk(), instr, offset, parser.previous.line, parser.previous.column);
 }
 
 static void variable(bool canAssign) {
@@ -805,15 +946,25 @@ static void number(bool canAssign) {
 
 static void integer(bool canAssign) {
     debugp("integer");
-    int value = strtol(parser.previous.start, NULL, 10);
-    emitConstant(INTEGER_VAL(value));
+    errno = 0;
+    long long value = strtoll(parser.previous.start, NULL, 10);
+    if (errno == ERANGE) {
+        emitConstant(bigintParse(parser.previous.start, parser.previous.length, 10));
+    } else {
+        emitConstant(INTEGER_VAL(value));
+    }
     debugend("integer");
 }
 
 static void hexnumber(bool canAssign) {
     debugp("hexnumber");
-    int value = strtol(parser.previous.start, NULL, 16);
-    emitConstant(INTEGER_VAL(value));
+    errno = 0;
+    long long value = strtoll(parser.previous.start, NULL, 16);
+    if (errno == ERANGE) {
+        emitConstant(bigintParse(parser.previous.start, parser.previous.length, 16));
+    } else {
+        emitConstant(INTEGER_VAL(value));
+    }
     debugend("hexnumber");
 }
 
@@ -839,21 +990,92 @@ static void or_(bool canAssign) {
     debugend("or_");
 }
 
+// If the bytes emitted since start load exactly one constant, return it
+static bool emittedConstant(int start, Value* value) {
+    Chunk* chunk = currentChunk();
+    int length = chunk->count - start;
+    uint8_t* code = &chunk->code[start];
+    if (length == 1) {
+        switch (code[0]) {
+            case OP_NIL: *value = NIL_VAL; return true;
+            case OP_TRUE: *value = BOOL_VAL(true); return true;
+            case OP_FALSE: *value = BOOL_VAL(false); return true;
+            case OP_NAN: *value = DOUBLE_VAL(NAN); return true;
+            case OP_INF: *value = DOUBLE_VAL(INFINITY); return true;
+            default: return false;
+        }
+    }
+    if (length == 2 && code[0] == OP_CONSTANT) {
+        *value = chunk->constants.values[code[1]];
+        return true;
+    }
+    if (length == 5 && code[0] == OP_WIDE && code[1] == OP_CONSTANT) {
+        *value = chunk->constants.values[code[2] | code[3] << 8 | code[4] << 16];
+        return true;
+    }
+    return false;
+}
+
+// Flush the values pushed so far into the literal, the first flush creates it
+static void emitLiteralBatch(OpCode build, OpCode append, int pending, bool* built) {
+    if (*built && pending == 0) {
+        return;
+    }
+    emitByte(*built ? append : build);
+    write24Bit(currentChunk(), pending, parser.previous.line, parser.previous.column);
+    *built = true;
+}
+
+static void emitCopyConstant(Value value) {
+    emitByte(OP_COPY_CONSTANT);
+    write24Bit(currentChunk(), makeConstant(value), parser.previous.line, parser.previous.column);
+}
+
 static void array(bool canAssign) {
     debugp("array");
-    // Array literal
-    emitByte(OP_INIT_ARRAY);
+    // Array literal. Elements are pushed and collected by OP_BUILD_ARRAY,
+    // in batches so huge literals do not overflow the stack.
+    // If every element is a constant the array is built here instead.
+    int start = currentChunk()->count;
+    int poolStart = currentChunk()->constants.count;
+    Values constants;
+    initValues(&constants);
+    bool allConstant = true;
+    bool built = false;
+    int pending = 0;
     while (!(check(TOKEN_RIGHT_SQUARE_BRACE) && !check(TOKEN_EOF))) {
+        int elementStart = currentChunk()->count;
         expression();
+        Value value;
+        if (allConstant && emittedConstant(elementStart, &value)) {
+            writeValues(&constants, value);
+        } else {
+            allConstant = false;
+        }
         if (!check(TOKEN_RIGHT_SQUARE_BRACE)) {
             consume(TOKEN_COMMA, "Expect ',' after array element");
         } else {
             // Optional comma at end of list
             match(TOKEN_COMMA);
         }
-        emitByte(OP_INSERT_ARRAY);
+        if (++pending == LITERAL_BATCH) {
+            emitLiteralBatch(OP_BUILD_ARRAY, OP_APPEND_ARRAY, pending, &built);
+            pending = 0;
+        }
     }
     consume(TOKEN_RIGHT_SQUARE_BRACE, "Expect ']' at end of array.");
+    if (allConstant && constants.count > 0) {
+        // Only the rewound code used the element constants, drop them from the pool too
+        rewindChunk(currentChunk(), start);
+        currentChunk()->constants.count = poolStart;
+        ObjArray* constant = allocateArray(constants.count);
+        memcpy(constant->values, constants.values, constants.count * sizeof(Value));
+        constant->length = constants.count;
+        emitCopyConstant(OBJ_VAL(constant));
+    } else {
+        emitLiteralBatch(OP_BUILD_ARRAY, OP_APPEND_ARRAY, pending, &built);
+    }
+    freeValues(&constants);
     debugend("array");
 }
 
@@ -876,44 +1098,77 @@ static void subscript(bool canAssign) {
         isArray = true;
     }
     // (3) Slice detected! One constant on stack is guaranteed
-    if (isArray) {
-        // (3.1) Push new array
-        emitByte(OP_INIT_ARRAY);
-        // (3.2) Then insert the value below the array
-        emitByte(OP_SWAP);
-        emitByte(OP_INSERT_ARRAY);
-    }
+    int sliceLength = 1;
     // (4) Now parse any remaining components of a slice
     while (!(check(TOKEN_RIGHT_SQUARE_BRACE) && !check(TOKEN_EOF))) {
+        // (4.1) Keep pushing indices for the slice array
         expression();
-        // (4.1) Keep pushing indices into the slice array
-        emitByte(OP_INSERT_ARRAY);
+        sliceLength++;
         if (!check(TOKEN_RIGHT_SQUARE_BRACE)) {
             // (4.2) A slice may or may not end in a colon
             consume(TOKEN_COLON, "Expect ':' in array slice.");
         }
     }
     consume(TOKEN_RIGHT_SQUARE_BRACE, "Expect ']' after array subscript or slice.");
+    if (isArray) {
+        // (5) Collect the indices into the slice array
+        emitByte(OP_BUILD_ARRAY);
+        write24Bit(currentChunk(), sliceLength, parser.previous.line, parser.previous.column);
+    }
     emitByte(OP_SUBSCRIPT);
     debugend("subscript");
 }
 
 static void hashmap(bool canAssign) {
     debugp("hashmap");
-    emitByte(OP_INIT_HASHMAP);
+    // Same strategy as array literals, with key-value pairs
+    int start = currentChunk()->count;
+    int poolStart = currentChunk()->constants.count;
+    Values constants;
+    initValues(&constants);
+    bool allConstant = true;
+    bool built = false;
+    int pending = 0;
     while (!(check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))) {
+        int keyStart = currentChunk()->count;
         expression();
+        Value key;
+        allConstant = allConstant && emittedConstant(keyStart, &key);
         consume(TOKEN_COLON, "Expect ':' after hashmap key");
+        int valueStart = currentChunk()->count;
         expression();
+        Value value;
+        allConstant = allConstant && emittedConstant(valueStart, &value);
+        if (allConstant) {
+            writeValues(&constants, key);
+            writeValues(&constants, value);
+        }
         if (!check(TOKEN_RIGHT_BRACE)) {
             consume(TOKEN_COMMA, "Expect ',' after hashmap element");
         } else {
             // Optional comma at end of list
             match(TOKEN_COMMA);
         }
-        emitByte(OP_INSERT_HASHMAP);
+        if (++pending == LITERAL_BATCH / 2) {
+            emitLiteralBatch(OP_BUILD_HASHMAP, OP_APPEND_HASHMAP, pending, &built);
+            pending = 0;
+        }
     }
     consume(TOKEN_RIGHT_BRACE, "Expect '}' at end of hashmap.");
+    if (allConstant && constants.count > 0) {
+        // Only the rewound code used the element constants, drop them from the pool too
+        rewindChunk(currentChunk(), start);
+        currentChunk()->constants.count = poolStart;
+        int count = constants.count / 2;
+        ObjHashmap* constant = allocateHashmap(hashmap_capacity_for(count));
+        for (int i = 0; i < count; i++) {
+            hashmap_add(&constant->map, constants.values[2 * i], constants.values[2 * i + 1]);
+        }
+        emitCopyConstant(OBJ_VAL(constant));
+    } else {
+        emitLiteralBatch(OP_BUILD_HASHMAP, OP_APPEND_HASHMAP, pending, &built);
+    }
+    freeValues(&constants);
     debugend("hashmap");
 }
 
@@ -1019,6 +1274,9 @@ ObjFunction* compile(const char* source) {
     if (DEBUG_TRACE) {
         DEBUG_PARSER = true;
     }
+    if (PROFILE_EVENTS) {
+        profileEnter("compile", "compile");
+    }
     parser.hadError = false;
     parser.panicMode = false;
     initScanner(source);
@@ -1030,5 +1288,8 @@ ObjFunction* compile(const char* source) {
     consume(TOKEN_EOF, "Expect end of expression.");
     ObjFunction* func = endCompiler(DEBUG_TRACE);
     freeCompiler();
+    if (PROFILE_EVENTS) {
+        profileLeave();
+    }
     return parser.hadError ? NULL : func;
 }
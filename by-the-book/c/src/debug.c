@@ -46,114 +46,159 @@ static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 4;
 }
 
+// OP_WIDE and the instruction it widens print as one line, like OP_WIDE_CONSTANT
+static int wideInstruction(Chunk* chunk, int offset) {
+    OpCode op = chunk->code[offset + 1];
+    char name[32];
+    snprintf(name, sizeof(name), "OP_WIDE_%s", opName(op) + strlen("OP_"));
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            return constantLongInstruction(name, chunk, offset + 1);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            return constantLongByteInstruction(name, chunk, offset + 1);
+        default:
+            printf("OP_WIDE before unknown opcode %d\n", chunk->code[offset + 1]);
+            return offset + 2;
+    }
+}
+
+static int builtinInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d %d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
 static int simpleInstruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
 }
 
+static const char* opNames[OP_COUNT] = {
+    [OP_INVALID] = "OP_INVALID",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_POP] = "OP_POP",
+    [OP_SWAP] = "OP_SWAP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_CALL_BUILTIN] = "OP_CALL_BUILTIN",
+    [OP_TYPEOF] = "OP_TYPEOF",
+    [OP_ARRAY_SET] = "OP_ARRAY_SET",
+    [OP_ARRAY_POP] = "OP_ARRAY_POP",
+    [OP_WIDE] = "OP_WIDE",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_NEG_JUMP] = "OP_NEG_JUMP",
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NAN] = "OP_NAN",
+    [OP_INF] = "OP_INF",
+    [OP_BUILD_ARRAY] = "OP_BUILD_ARRAY",
+    [OP_APPEND_ARRAY] = "OP_APPEND_ARRAY",
+    [OP_SUBSCRIPT] = "OP_SUBSCRIPT",
+    [OP_BUILD_HASHMAP] = "OP_BUILD_HASHMAP",
+    [OP_APPEND_HASHMAP] = "OP_APPEND_HASHMAP",
+    [OP_COPY_CONSTANT] = "OP_COPY_CONSTANT",
+    [OP_NEG] = "OP_NEG",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUB] = "OP_SUB",
+    [OP_MUL] = "OP_MUL",
+    [OP_DIV] = "OP_DIV",
+    [OP_REMAINDER] = "OP_REMAINDER",
+    [OP_EXP] = "OP_EXP",
+    [OP_BITAND] = "OP_BITAND",
+    [OP_BITOR] = "OP_BITOR",
+    [OP_BITXOR] = "OP_BITXOR",
+    [OP_BITNEG] = "OP_BITNEG",
+    [OP_LEFT_SHIFT] = "OP_LEFT_SHIFT",
+    [OP_RIGHT_SHIFT] = "OP_RIGHT_SHIFT",
+    [OP_SIZE] = "OP_SIZE",
+    [OP_NOT] = "OP_NOT",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+};
+
+const char* opName(OpCode op) {
+    return op < OP_COUNT ? opNames[op] : "OP_UNKNOWN";
+}
+
 int disInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
-    printf("% 4d:%-4d ", chunk->lines[offset], chunk->columns[offset]);
+    LineRun run = getLineRun(chunk, offset);
+    printf("% 4d:%-4d ", run.line, run.column);
     OpCode instruction = chunk->code[offset];
+    const char* name = opName(instruction);
     switch (instruction) {
-        case OP_RETURN:
-            return simpleInstruction("OP_RETURN", offset);
+        case OP_WIDE:
+            return wideInstruction(chunk, offset);
         case OP_CONSTANT:
-            return constantInstruction("OP_CONSTANT", chunk, offset);
-        case OP_CONSTANT_LONG:
-            return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-        case OP_DEFINE_GLOBAL_LONG:
-            return constantLongInstruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-        case OP_GET_GLOBAL_LONG:
-            return constantLongInstruction("OP_GET_GLOBAL_LONG", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
-        case OP_SET_GLOBAL_LONG:
-            return constantLongInstruction("OP_SET_GLOBAL_LONG", chunk, offset);
+            return constantInstruction(name, chunk, offset);
         case OP_GET_LOCAL:
-            return constantByteInstruction("OP_GET_LOCAL", chunk, offset);
-        case OP_GET_LOCAL_LONG:
-            return constantLongByteInstruction("OP_GET_LOCAL_LONG", chunk, offset);
         case OP_SET_LOCAL:
-            return constantByteInstruction("OP_SET_LOCAL", chunk, offset);
-        case OP_SET_LOCAL_LONG:
-            return constantLongByteInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return constantByteInstruction(name, chunk, offset);
         case OP_JUMP_IF_FALSE:
-            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_JUMP:
-            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+            return jumpInstruction(name, 1, chunk, offset);
         case OP_NEG_JUMP:
-            return jumpInstruction("OP_NEG_JUMP", -1, chunk, offset);
+            return jumpInstruction(name, -1, chunk, offset);
+        case OP_CALL_BUILTIN:
+            return builtinInstruction(name, chunk, offset);
+        case OP_BUILD_ARRAY:
+        case OP_APPEND_ARRAY:
+        case OP_BUILD_HASHMAP:
+        case OP_APPEND_HASHMAP:
+            return constantLongByteInstruction(name, chunk, offset);
+        case OP_COPY_CONSTANT:
+            return constantLongInstruction(name, chunk, offset);
+        case OP_INVALID:
+        case OP_RETURN:
+        case OP_PRINT:
+        case OP_POP:
+        case OP_SWAP:
+        case OP_TYPEOF:
+        case OP_ARRAY_SET:
+        case OP_ARRAY_POP:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NAN:
+        case OP_INF:
+        case OP_SUBSCRIPT:
         case OP_NEG:
-            return simpleInstruction("OP_NEG", offset);
-        case OP_NOT:
-            return simpleInstruction("OP_NOT", offset);
-        case OP_EQUAL:
-            return simpleInstruction("OP_EQUAL", offset);
-        case OP_GREATER:
-            return simpleInstruction("OP_GREATER", offset);
-        case OP_LESS:
-            return simpleInstruction("OP_LESS", offset);
         case OP_ADD:
-            return simpleInstruction("OP_ADD", offset);
         case OP_SUB:
-            return simpleInstruction("OP_SUB", offset);
-        case OP_SIZE:
-            return simpleInstruction("OP_SIZE", offset);
-        case OP_BITAND:
-            return simpleInstruction("OP_BITAND", offset);
-        case OP_BITOR:
-            return simpleInstruction("OP_BITOR", offset);
-        case OP_BITXOR:
-            return simpleInstruction("OP_BITXOR", offset);
-        case OP_BITNEG:
-            return simpleInstruction("OP_BITNEG", offset);
         case OP_MUL:
-            return simpleInstruction("OP_MUL", offset);
         case OP_DIV:
-            return simpleInstruction("OP_DIV", offset);
         case OP_REMAINDER:
-            return simpleInstruction("OP_REMAINDER", offset);
         case OP_EXP:
-            return simpleInstruction("OP_EXP", offset);
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR:
+        case OP_BITNEG:
         case OP_LEFT_SHIFT:
-            return simpleInstruction("OP_LEFT_SHIFT", offset);
         case OP_RIGHT_SHIFT:
-            return simpleInstruction("OP_RIGHT_SHIFT", offset);
-        case OP_PRINT:
-            return simpleInstruction("OP_PRINT", offset);
-        case OP_CALL:
-            return simpleInstruction("OP_CALL", offset);
-        case OP_POP:
-            return simpleInstruction("OP_POP", offset);
-        case OP_SWAP:
-            return simpleInstruction("OP_SWAP", offset);
-        case OP_FALSE:
-            return simpleInstruction("OP_FALSE", offset);
-        case OP_NIL:
-            return simpleInstruction("OP_NIL", offset);
-        case OP_TRUE:
-            return simpleInstruction("OP_TRUE", offset);
-        case OP_NAN:
-            return simpleInstruction("OP_NAN", offset);
-        case OP_INF:
-            return simpleInstruction("OP_INF", offset);
-        case OP_INIT_ARRAY:
-            return simpleInstruction("OP_INIT_ARRAY", offset);
-        case OP_INSERT_ARRAY:
-            return simpleInstruction("OP_INSERT_ARRAY", offset);
-        case OP_INIT_HASHMAP:
-            return simpleInstruction("OP_INIT_HASHMAP", offset);
-        case OP_INSERT_HASHMAP:
-            return simpleInstruction("OP_INSERT_HASHMAP", offset);
-        case OP_SUBSCRIPT:
-            return simpleInstruction("OP_SUBSCRIPT", offset);
-        case OP_INVALID:
-            return simpleInstruction("OP_INVALID", offset);
+        case OP_SIZE:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+            return simpleInstruction(name, offset);
     }
     printf("unknown opcode %d\n", instruction);
     return offset + 1;
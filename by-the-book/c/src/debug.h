@@ -5,5 +5,6 @@
 
 void disChunk(Chunk* chunk, const char* name);
 int disInstruction(Chunk* chunk, int offset);
+const char* opName(OpCode op);
 
 #endif
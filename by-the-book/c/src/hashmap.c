@@ -1,9 +1,11 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "hashmap.h"
 #include "value.h"
 #include "object.h"
+#include "bigint.h"
 
 size_t hashString(const char* chars, size_t length) {
     size_t hash = 2166136261u;
@@ -14,7 +16,9 @@ size_t hashString(const char* chars, size_t length) {
     return hash;
 }
 
-size_t hashInt(unsigned int elem) {
+size_t hashInt(uint64_t value) {
+  // Fold the high half in so ints that differ only above bit 31 do not collide
+  unsigned int elem = (unsigned int)(value ^ (value >> 32));
   size_t c2=0x27d4eb2d; // a prime or an odd constant
   elem = (elem ^ 61) ^ (elem >> 16);
   elem = elem + (elem << 3);
@@ -35,6 +39,7 @@ size_t hashAny(Value val) {
         case VAL_FCOMPLEX: return hashInt(AS_INTEGER(val));
         case VAL_INT: return hashInt(AS_INTEGER(val));
         case VAL_BOOL: return hashInt(AS_INTEGER(val));
+        case VAL_BIGINT: return bigintHash(AS_BIGINT(val));
         case VAL_OBJ: {
             switch (AS_OBJ(val)->type) {
                 case OBJ_STRING: return AS_STRING(val)->hash;
@@ -61,6 +66,12 @@ size_t hashAny(Value val) {
                     hashmap_debug("Unhashable type HASHMAP");
                     exit(99);
                 }
+                case OBJ_BIGINT: return bigintHash((ObjBigInt*)AS_OBJ(val));
+                case OBJ_MATRIX:
+                case OBJ_MATRIX_ROW: {
+                    hashmap_debug("Unhashable type MATRIX");
+                    exit(99);
+                }
             }
         }
     }
@@ -92,11 +103,34 @@ void hashmap_init(hashmap_t* map, size_t capacity, hash_function hasher) {
     map->entries = (hashmap_item*)calloc(capacity, sizeof(hashmap_item));
     map->max_collisions = capacity < 16 ? capacity : 16; // jeez rick
     map->open_addressing_scheme = QUADRATIC;
+    map->grows = 0;
+    map->failed_adds = 0;
     for (int i = 0; i < map->capacity; i++) {
         map->entries[i].empty = true;
     }
 }
 
+/**
+ * Smallest power of 2 capacity that holds count keys without growing.
+ */
+size_t hashmap_capacity_for(size_t count) {
+    size_t capacity = 8;
+    while (count * 2 > capacity) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+/**
+ * Initialize dst as a copy of src with one allocation, no rehashing.
+ * Keys and values are copied shallowly.
+ */
+void hashmap_copy(hashmap_t* dst, const hashmap_t* src) {
+    *dst = *src;
+    dst->entries = (hashmap_item*)malloc(src->capacity * sizeof(hashmap_item));
+    memcpy(dst->entries, src->entries, src->capacity * sizeof(hashmap_item));
+}
+
 /**
  * Return the size of this hashmap.
  */
@@ -241,6 +275,36 @@ int hashmap_collision_count(hashmap_t* map, HASHMAP_KEY_TYPE key) {
     return -1;
 }
 
+/**
+ * Fill stats with the map's size, load, and how many collisions each key takes to find.
+ *
+ * Mostly used for debugging and profiling.
+ */
+void hashmap_stats(hashmap_t* map, hashmap_stats_t* stats) {
+    memset(stats, 0, sizeof(hashmap_stats_t));
+    stats->total = map->total;
+    stats->capacity = map->capacity;
+    stats->load = map->capacity ? (double)map->total / map->capacity : 0;
+    stats->grows = map->grows;
+    stats->failed_adds = map->failed_adds;
+    size_t sum = 0;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->entries[i].empty) {
+            continue;
+        }
+        int probe = hashmap_collision_count(map, map->entries[i].key);
+        if (probe < 0 || probe >= HASHMAP_MAX_PROBE) {
+            continue;
+        }
+        stats->probes[probe]++;
+        sum += probe;
+        if ((size_t)probe > stats->max_probe) {
+            stats->max_probe = probe;
+        }
+    }
+    stats->mean_probe = map->total ? (double)sum / map->total : 0;
+}
+
 /**
  * Add an element to this hashmap, if possible.
  *
@@ -251,7 +315,11 @@ int hashmap_collision_count(hashmap_t* map, HASHMAP_KEY_TYPE key) {
 bool hashmap_add_without_grow(hashmap_t* map, HASHMAP_KEY_TYPE key, HASHMAP_VALUE_TYPE value) {
     // If it already exists, return false
     hashmap_item* entry = _hashmap_get(map, key, NULL);
-    if (!entry || !entry->empty) {
+    if (!entry) {
+        map->failed_adds++;
+        return false;
+    }
+    if (!entry->empty) {
         return false;
     }
     // If missing, add it to the start of the linked list at its index
@@ -300,6 +368,9 @@ void hashmap_grow(hashmap_t* map, size_t factor) {
     _hashmap_free_entries(map);
     map->capacity = map->capacity * factor;
     map->entries = newmap.entries;
+    map->total = newmap.total;
+    map->grows++;
+    map->failed_adds += newmap.failed_adds;
 }
 
 /**
@@ -10,7 +10,7 @@
 #include "value.h"
 
 size_t hashString(const char* chars, size_t length);
-size_t hashInt(unsigned int elem);
+size_t hashInt(uint64_t elem);
 size_t hashAny(Value val);
 
 #ifndef HASHMAP_KEY_TYPE
@@ -44,8 +44,24 @@ typedef struct hashmap_t {
     size_t capacity;
     size_t max_collisions;
     hashmap_scheme_t open_addressing_scheme;
+    size_t grows;
+    size_t failed_adds; // Keys dropped because probing gave up, while adding or growing
 } hashmap_t;
 
+// Probe lengths are below max_collisions, which is at most this
+#define HASHMAP_MAX_PROBE 16
+
+typedef struct hashmap_stats_t {
+    size_t total;
+    size_t capacity;
+    double load;
+    size_t probes[HASHMAP_MAX_PROBE]; // Keys found after this many collisions
+    size_t max_probe;
+    double mean_probe;
+    size_t grows;
+    size_t failed_adds;
+} hashmap_stats_t;
+
 #define AS_HASHMAP(value) (((ObjHashmap*)AS_OBJ(value)))
 #define HASHMAP_LENGTH(value) (hashmap_len(&((ObjHashmap*)AS_OBJ(value))->map))
 
@@ -53,11 +69,14 @@ struct ObjHashmap {
     // First-class hashmaps!
     Obj obj;
     hashmap_t map;
+    bool borrowed; // map.entries belongs to a constant hashmap, copy them before writing
 };
 
 typedef void (*hashmap_iterator)(hashmap_t* map, size_t index, HASHMAP_KEY_TYPE key, HASHMAP_VALUE_TYPE value, void* data);
 
 void hashmap_init(hashmap_t* map, size_t capacity, hash_function hasher);
+size_t hashmap_capacity_for(size_t count);
+void hashmap_copy(hashmap_t* dst, const hashmap_t* src);
 void hashmap_free(hashmap_t* map);
 size_t hashmap_len(hashmap_t* map);
 HASHMAP_VALUE_TYPE hashmap_get(hashmap_t* map, HASHMAP_KEY_TYPE key, bool* not_found);
@@ -66,5 +85,7 @@ bool hashmap_add(hashmap_t* map, HASHMAP_KEY_TYPE key, HASHMAP_VALUE_TYPE value)
 bool hashmap_set(hashmap_t* map, HASHMAP_KEY_TYPE key, HASHMAP_VALUE_TYPE value);
 bool hashmap_remove(hashmap_t* map, HASHMAP_KEY_TYPE key);
 bool hashmap_iter(hashmap_t* map, hashmap_iterator func, void* data);
+int hashmap_collision_count(hashmap_t* map, HASHMAP_KEY_TYPE key);
+void hashmap_stats(hashmap_t* map, hashmap_stats_t* stats);
 
 #endif
@@ -0,0 +1,328 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jit.h"
+#include "vm.h"
+#include "x64.h"
+
+// Baseline template JIT from register code to x86-64.
+//
+// Every register instruction becomes a fixed sequence: moves, int and double
+// arithmetic and compare-and-jumps are inlined behind type checks, and
+// everything else calls regOp(), regCompare() or regCall() in vm.c with the
+// frame and the instruction, so the semantics stay in one place.
+//
+// The generated function is bool (*)(CallFrame* frame) and keeps
+//   rbx = frame->slots, reloaded after every call into C
+//   r12 = frame
+//   r13 = reg->constants
+// all callee-saved, so helpers preserve them.
+
+#if defined(__x86_64__)
+
+static Mem operand(uint16_t rk) {
+    if (IS_REG_K(rk)) {
+        return (Mem){R13, (rk & REG_MAX) * (int32_t)sizeof(Value)};
+    }
+    return (Mem){RBX, rk * (int32_t)sizeof(Value)};
+}
+
+static void copyValue(Assembler* as, Mem to, Mem from) {
+    asmLoad(as, RAX, from);
+    asmLoad(as, RCX, (Mem){from.base, from.disp + 8});
+    asmStore(as, to, RAX);
+    asmStore(as, (Mem){to.base, to.disp + 8}, RCX);
+}
+
+// helper(frame, instr), leaves its bool in al
+static void callHelper(Assembler* as, bool (*helper)(CallFrame*, RegInstr*), RegInstr* instr) {
+    asmAluReg(as, ALU_MOV, RDI, R12);
+    asmMovImm64(as, RSI, (uint64_t)(uintptr_t)instr);
+    asmMovImm64(as, RAX, (uint64_t)(uintptr_t)helper);
+    asmBytes(as, (uint8_t[]){0xff, 0xd0}, 2); // call rax
+    asmLoad(as, RBX, (Mem){R12, (int32_t)offsetof(CallFrame, slots)});
+    asmBytes(as, (uint8_t[]){0x84, 0xc0}, 2); // test al, al
+}
+
+// The generic path, any runtime error leaves through the fail exit
+static void slowOp(Assembler* as, RegInstr* instr, int fail) {
+    callHelper(as, regOp, instr);
+    asmJccLabel(as, CC_E, fail);
+}
+
+static void arithmetic(Assembler* as, RegInstr* instr, int fail) {
+    Mem a = operand(instr->a);
+    Mem b = operand(instr->b);
+    Mem c = operand(instr->c);
+    int notInt[2], overflow = -1, intDone = -1;
+    if (instr->op != REG_DIV) {
+        notInt[0] = (asmCmpType(as, b, VAL_INT), asmJcc(as, CC_NE));
+        notInt[1] = (asmCmpType(as, c, VAL_INT), asmJcc(as, CC_NE));
+        asmLoad(as, RAX, payloadOf(b));
+        switch (instr->op) {
+            case REG_ADD: asmAlu(as, 0x03, RAX, payloadOf(c)); break;
+            case REG_SUB: asmAlu(as, 0x2b, RAX, payloadOf(c)); break;
+            default: asmImul(as, RAX, payloadOf(c)); break;
+        }
+        overflow = asmJcc(as, CC_O);
+        asmStoreType(as, a, VAL_INT);
+        asmStore(as, payloadOf(a), RAX);
+        intDone = asmJmp(as);
+        asmBind(as, notInt[0]);
+        asmBind(as, notInt[1]);
+    }
+    int notDouble[2];
+    notDouble[0] = (asmCmpType(as, b, VAL_DOUBLE), asmJcc(as, CC_NE));
+    notDouble[1] = (asmCmpType(as, c, VAL_DOUBLE), asmJcc(as, CC_NE));
+    int zero = -1;
+    if (instr->op == REG_DIV) {
+        // Division by +-0.0 takes the slow path for its warning
+        asmLoad(as, RAX, payloadOf(c));
+        asmBytes(as, (uint8_t[]){0x48, 0xd1, 0xe0}, 3); // shl rax, 1
+        zero = asmJcc(as, CC_E);
+    }
+    asmSse(as, 0xf2, MOVSD_LOAD, 0, payloadOf(b));
+    switch (instr->op) {
+        case REG_ADD: asmSse(as, 0xf2, ADDSD, 0, payloadOf(c)); break;
+        case REG_SUB: asmSse(as, 0xf2, SUBSD, 0, payloadOf(c)); break;
+        case REG_MUL: asmSse(as, 0xf2, MULSD, 0, payloadOf(c)); break;
+        default: asmSse(as, 0xf2, DIVSD, 0, payloadOf(c)); break;
+    }
+    asmStoreType(as, a, VAL_DOUBLE);
+    asmSse(as, 0xf2, MOVSD_STORE, 0, payloadOf(a));
+    int doubleDone = asmJmp(as);
+    asmBind(as, notDouble[0]);
+    asmBind(as, notDouble[1]);
+    if (overflow != -1) {
+        asmBind(as, overflow);
+    }
+    if (zero != -1) {
+        asmBind(as, zero);
+    }
+    slowOp(as, instr, fail);
+    if (intDone != -1) {
+        asmBind(as, intDone);
+    }
+    asmBind(as, doubleDone);
+}
+
+static X64Cond compareCond(RegOp op) {
+    switch (op) {
+        case REG_EQUAL:
+        case REG_JUMP_IF_NOT_EQUAL: return CC_E;
+        case REG_GREATER:
+        case REG_JUMP_IF_NOT_GREATER: return CC_G;
+        default: return CC_L;
+    }
+}
+
+// Only ints are inlined, everything else goes through valuesEqual() or compareNumbers()
+static void compare(Assembler* as, RegInstr* instr, int fail) {
+    Mem a = operand(instr->a);
+    Mem b = operand(instr->b);
+    Mem c = operand(instr->c);
+    int notInt[2];
+    notInt[0] = (asmCmpType(as, b, VAL_INT), asmJcc(as, CC_NE));
+    notInt[1] = (asmCmpType(as, c, VAL_INT), asmJcc(as, CC_NE));
+    asmLoad(as, RAX, payloadOf(b));
+    asmAlu(as, 0x3b, RAX, payloadOf(c));
+    asmBytes(as, (uint8_t[]){0x0f, 0x90 | compareCond(instr->op), 0xc0}, 3); // setcc al
+    asmBytes(as, (uint8_t[]){0x0f, 0xb6, 0xc0}, 3); // movzx eax, al
+    asmStoreType(as, a, VAL_BOOL);
+    asmStore(as, payloadOf(a), RAX);
+    int done = asmJmp(as);
+    asmBind(as, notInt[0]);
+    asmBind(as, notInt[1]);
+    slowOp(as, instr, fail);
+    asmBind(as, done);
+}
+
+static void compareJump(Assembler* as, RegInstr* instr) {
+    Mem b = operand(instr->b);
+    Mem c = operand(instr->c);
+    int notInt[2];
+    notInt[0] = (asmCmpType(as, b, VAL_INT), asmJcc(as, CC_NE));
+    notInt[1] = (asmCmpType(as, c, VAL_INT), asmJcc(as, CC_NE));
+    asmLoad(as, RAX, payloadOf(b));
+    asmAlu(as, 0x3b, RAX, payloadOf(c));
+    // Jump when the comparison fails, the condition codes come in pairs
+    asmJccLabel(as, compareCond(instr->op) ^ 1, instr->a);
+    int intDone = asmJmp(as);
+    asmBind(as, notInt[0]);
+    asmBind(as, notInt[1]);
+    int doubleDone = -1, notDouble[2] = {-1, -1};
+    if (instr->op != REG_JUMP_IF_NOT_EQUAL) {
+        // a < b is b > a, ja is false for NaN, so jbe takes the jump
+        notDouble[0] = (asmCmpType(as, b, VAL_DOUBLE), asmJcc(as, CC_NE));
+        notDouble[1] = (asmCmpType(as, c, VAL_DOUBLE), asmJcc(as, CC_NE));
+        bool less = instr->op == REG_JUMP_IF_NOT_LESS;
+        asmSse(as, 0xf2, MOVSD_LOAD, 0, payloadOf(less ? c : b));
+        asmSse(as, 0x66, UCOMISD, 0, payloadOf(less ? b : c));
+        asmJccLabel(as, CC_BE, instr->a);
+        doubleDone = asmJmp(as);
+        asmBind(as, notDouble[0]);
+        asmBind(as, notDouble[1]);
+    }
+    callHelper(as, regCompare, instr);
+    asmJccLabel(as, CC_E, instr->a);
+    asmBind(as, intDone);
+    if (doubleDone != -1) {
+        asmBind(as, doubleDone);
+    }
+}
+
+// nil and false are falsey, everything else is truthy
+static void jumpIfFalse(Assembler* as, RegInstr* instr) {
+    Mem b = operand(instr->b);
+    asmCmpType(as, b, VAL_NIL);
+    asmJccLabel(as, CC_E, instr->a);
+    asmCmpType(as, b, VAL_BOOL);
+    int notBool = asmJcc(as, CC_NE);
+    asmLoad(as, RAX, payloadOf(b));
+    asmBytes(as, (uint8_t[]){0x48, 0x85, 0xc0}, 3); // test rax, rax
+    asmJccLabel(as, CC_E, instr->a);
+    asmBind(as, notBool);
+}
+
+static void translate(Assembler* as, RegCode* reg, int index, int ok, int fail) {
+    RegInstr* instr = &reg->code[index];
+    switch ((RegOp)instr->op) {
+        case REG_MOVE: copyValue(as, operand(instr->a), operand(instr->b)); break;
+        case REG_ADD:
+        case REG_SUB:
+        case REG_MUL:
+        case REG_DIV:
+            arithmetic(as, instr, fail);
+            break;
+        case REG_EQUAL:
+        case REG_GREATER:
+        case REG_LESS:
+            compare(as, instr, fail);
+            break;
+        case REG_JUMP: asmJmpLabel(as, instr->a); break;
+        case REG_JUMP_IF_FALSE: jumpIfFalse(as, instr); break;
+        case REG_JUMP_IF_NOT_EQUAL:
+        case REG_JUMP_IF_NOT_GREATER:
+        case REG_JUMP_IF_NOT_LESS:
+            compareJump(as, instr);
+            break;
+        case REG_CALL:
+        case REG_TAIL_CALL: {
+            callHelper(as, regCall, instr);
+            asmJccLabel(as, CC_E, fail);
+            break;
+        }
+        case REG_RETURN: {
+            // The caller picks the result up from slot 0
+            copyValue(as, operand(0), operand(instr->b));
+            asmJmpLabel(as, ok);
+            break;
+        }
+        case REG_GET_GLOBAL:
+        case REG_SET_GLOBAL:
+        case REG_DEFINE_GLOBAL:
+        case REG_REMAINDER:
+        case REG_EXP:
+        case REG_BITAND:
+        case REG_BITOR:
+        case REG_BITXOR:
+        case REG_LEFT_SHIFT:
+        case REG_RIGHT_SHIFT:
+        case REG_NOT:
+        case REG_BITNEG:
+        case REG_SIZE:
+        case REG_SUBSCRIPT:
+        case REG_PRINT:
+        case REG_BUILD_ARRAY:
+        case REG_APPEND_ARRAY:
+        case REG_BUILD_HASHMAP:
+        case REG_APPEND_HASHMAP:
+        case REG_COPY_CONSTANT:
+        case REG_CALL_BUILTIN:
+            slowOp(as, instr, fail);
+            break;
+    }
+}
+
+static void assemble(Assembler* as, RegCode* reg) {
+    int ok = reg->count;
+    int fail = reg->count + 1;
+    asmBytes(as, (uint8_t[]){0x53, 0x41, 0x54, 0x41, 0x55}, 5); // push rbx, r12, r13
+    asmAluReg(as, ALU_MOV, R12, RDI);
+    asmLoad(as, RBX, (Mem){R12, (int32_t)offsetof(CallFrame, slots)});
+    asmMovImm64(as, R13, (uint64_t)(uintptr_t)reg->constants);
+    for (int i = 0; i < reg->count; i++) {
+        as->labels[i] = as->count;
+        translate(as, reg, i, ok, fail);
+    }
+    static const uint8_t epilogue[] = {0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3}; // pop r13, r12, rbx, ret
+    as->labels[ok] = as->count;
+    asmBytes(as, (uint8_t[]){0xb8, 1, 0, 0, 0}, 5); // mov eax, 1
+    asmBytes(as, epilogue, sizeof(epilogue));
+    as->labels[fail] = as->count;
+    asmBytes(as, (uint8_t[]){0x31, 0xc0}, 2); // xor eax, eax
+    asmBytes(as, epilogue, sizeof(epilogue));
+    asmPatchLabels(as);
+}
+
+// Function pointers and data pointers only meet through this
+typedef union {
+    void* memory;
+    JitCode code;
+} NativeEntry;
+
+bool jitCompile(RegCode* reg, const char* name) {
+    if (reg->count == 0 || sizeof(ValueType) != 4) {
+        return false;
+    }
+    for (int i = 0; i < reg->count; i++) {
+        if (reg->code[i].op == REG_TAIL_CALL) {
+            // Machine code cannot hand its frame over, the register VM keeps these
+            return false;
+        }
+    }
+    Assembler as;
+    initAssembler(&as, reg->count + 2);
+    assemble(&as, reg);
+    void* memory = asmInstall(&as);
+    if (memory) {
+        NativeEntry entry = {.memory = memory};
+        reg->native = entry.code;
+        reg->nativeSize = (size_t)as.count;
+        if (DEBUG_TRACE) {
+            ERR_PRINT("====== JIT compiled %s: %d instructions, %zu bytes\n", name, reg->count, reg->nativeSize);
+        }
+    }
+    freeAssembler(&as);
+    return memory != NULL;
+}
+
+void jitFree(RegCode* reg) {
+    if (reg->native) {
+        NativeEntry entry = {.code = reg->native};
+        asmRelease(entry.memory, reg->nativeSize);
+        reg->native = NULL;
+    }
+}
+
+#else
+
+bool jitCompile(RegCode* reg, const char* name) {
+    return false;
+}
+
+void jitFree(RegCode* reg) {
+}
+
+#endif
+
+void jitFunction(ObjFunction* function) {
+    function->jitTried = true;
+    if (!function->reg) {
+        function->reg = lowerFunction(function);
+    }
+    if (function->reg && !function->reg->native) {
+        jitCompile(function->reg, function->name ? function->name->chars : "<script>");
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "regcode.h"
+
+#define JIT_DEFAULT_THRESHOLD 1000
+
+// Compiles register code to x86-64, false where that is unsupported
+bool jitCompile(RegCode* reg, const char* name);
+// Lowers and compiles a function that just got hot, it stays on the VMs if either fails
+void jitFunction(ObjFunction* function);
+void jitFree(RegCode* reg);
+
+#endif
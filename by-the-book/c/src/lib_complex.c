@@ -48,8 +48,7 @@ DEFINE_CNATIVE(ctanh)
 DEFINE_CNATIVE2(cpow)
 
 void defineComplexLib() {
-#define ADD_NATIVE(name, arity) \
-    defineConstant(#name, OBJ_VAL(newNative(copyString(#name, sizeof(#name)), arity, FFI_##name)));
+#define ADD_NATIVE(name, arity) defineNative(#name, arity, FFI_##name);
 
     ADD_NATIVE(cabs, 1);
     ADD_NATIVE(cacos, 1);
@@ -61,7 +60,7 @@ void defineComplexLib() {
     ADD_NATIVE(catanh, 1);
     ADD_NATIVE(ccos, 1);
     ADD_NATIVE(ccosh, 1);
-    defineConstant("cexp", OBJ_VAL(newNative(copyString("cexp", sizeof("cexp")), 1, FFI_cexp)));
+    ADD_NATIVE(cexp, 1);
     ADD_NATIVE(cimag, 1);
     ADD_NATIVE(clog, 1);
     ADD_NATIVE(conj, 1);
@@ -0,0 +1,345 @@
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib_fft.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define TAU 6.28318530717958647692528676655900576
+
+// Everything is computed in double precision on split real/imaginary arrays,
+// which keeps the butterfly loops free of complex multiplication libcalls
+// and lets the compiler vectorize them. Results are narrowed to VAL_FCOMPLEX.
+typedef struct Plan {
+    size_t n;
+    // e^(-2*pi*i*k/n) for 0 <= k < n, used by the mixed-radix transform
+    double* wr;
+    double* wi;
+    // Powers of two only: e^(-2*pi*i*j/(2h)) stored contiguously at [h + j]
+    // for each stage half-size h, plus the bit reversal permutation
+    double* sr;
+    double* si;
+    size_t* bitrev;
+    struct Plan* next;
+} Plan;
+
+static Plan* plans = NULL;
+
+static bool isPowerOfTwo(size_t n) {
+    return n && (n & (n - 1)) == 0;
+}
+
+static Plan* getPlan(size_t n) {
+    for (Plan* plan = plans; plan != NULL; plan = plan->next) {
+        if (plan->n == n) {
+            return plan;
+        }
+    }
+    Plan* plan = ALLOCATE(Plan, 1);
+    plan->n = n;
+    plan->wr = ALLOCATE(double, n);
+    plan->wi = ALLOCATE(double, n);
+    for (size_t k = 0; k < n; k++) {
+        double angle = -TAU * (double)k / (double)n;
+        plan->wr[k] = cos(angle);
+        plan->wi[k] = sin(angle);
+    }
+    plan->sr = NULL;
+    plan->si = NULL;
+    plan->bitrev = NULL;
+    if (isPowerOfTwo(n) && n > 1) {
+        plan->sr = ALLOCATE(double, n);
+        plan->si = ALLOCATE(double, n);
+        for (size_t h = 1; h < n; h <<= 1) {
+            for (size_t j = 0; j < h; j++) {
+                plan->sr[h + j] = plan->wr[j * (n / (2 * h))];
+                plan->si[h + j] = plan->wi[j * (n / (2 * h))];
+            }
+        }
+        int logN = 0;
+        while (((size_t)1 << logN) < n) {
+            logN++;
+        }
+        plan->bitrev = ALLOCATE(size_t, n);
+        for (size_t i = 0; i < n; i++) {
+            size_t rev = 0;
+            for (int b = 0; b < logN; b++) {
+                rev |= ((i >> b) & 1) << (logN - 1 - b);
+            }
+            plan->bitrev[i] = rev;
+        }
+    }
+    plan->next = plans;
+    plans = plan;
+    return plan;
+}
+
+void freeFFTLib() {
+    Plan* plan = plans;
+    while (plan != NULL) {
+        Plan* next = plan->next;
+        FREE_ARRAY(double, plan->wr, plan->n);
+        FREE_ARRAY(double, plan->wi, plan->n);
+        FREE_ARRAY(double, plan->sr, plan->n);
+        FREE_ARRAY(double, plan->si, plan->n);
+        FREE_ARRAY(size_t, plan->bitrev, plan->n);
+        FREE_ARRAY(Plan, plan, 1);
+        plan = next;
+    }
+    plans = NULL;
+}
+
+static void butterfly(double* restrict ar, double* restrict ai, double* restrict br, double* restrict bi,
+                      const double* restrict wr, const double* restrict wi, size_t half) {
+    for (size_t j = 0; j < half; j++) {
+        double tr = br[j] * wr[j] - bi[j] * wi[j];
+        double ti = br[j] * wi[j] + bi[j] * wr[j];
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] = ar[j] + tr;
+        ai[j] = ai[j] + ti;
+    }
+}
+
+// In-place iterative radix-2 transform
+static void fftRadix2(const Plan* plan, double* re, double* im) {
+    size_t n = plan->n;
+    for (size_t i = 0; i < n; i++) {
+        size_t j = plan->bitrev[i];
+        if (i < j) {
+            double tr = re[i];
+            double ti = im[i];
+            re[i] = re[j];
+            im[i] = im[j];
+            re[j] = tr;
+            im[j] = ti;
+        }
+    }
+    for (size_t half = 1; half < n; half <<= 1) {
+        for (size_t k = 0; k < n; k += 2 * half) {
+            butterfly(re + k, im + k, re + k + half, im + k + half, plan->sr + half, plan->si + half, half);
+        }
+    }
+}
+
+static size_t smallestFactor(size_t n) {
+    if (n % 4 == 0) {
+        return 4;
+    }
+    for (size_t p = 2; p * p <= n; p++) {
+        if (n % p == 0) {
+            return p;
+        }
+    }
+    return n;
+}
+
+// Out-of-place recursive mixed-radix Cooley-Tukey transform.
+// Twiddles of the size-n sub-problem are W_n^k = plan->w[k * wstride].
+// Prime sizes degrade to a direct DFT through the same combine step.
+static void fftMixed(const Plan* plan, const double* inr, const double* ini, double* outr, double* outi,
+                     size_t n, size_t stride, size_t wstride, double* scratch) {
+    if (n == 1) {
+        outr[0] = inr[0];
+        outi[0] = ini[0];
+        return;
+    }
+    size_t p = smallestFactor(n);
+    size_t m = n / p;
+    for (size_t q = 0; q < p; q++) {
+        fftMixed(plan, inr + q * stride, ini + q * stride, outr + q * m, outi + q * m, m, stride * p, wstride * p, scratch);
+    }
+    const double* wr = plan->wr;
+    const double* wi = plan->wi;
+    size_t N = plan->n;
+    if (p == 2) {
+        for (size_t k = 0; k < m; k++) {
+            double w_r = wr[k * wstride];
+            double w_i = wi[k * wstride];
+            double tr = outr[k + m] * w_r - outi[k + m] * w_i;
+            double ti = outr[k + m] * w_i + outi[k + m] * w_r;
+            outr[k + m] = outr[k] - tr;
+            outi[k + m] = outi[k] - ti;
+            outr[k] += tr;
+            outi[k] += ti;
+        }
+        return;
+    }
+    double* tr = scratch;
+    double* ti = scratch + p;
+    for (size_t k = 0; k < m; k++) {
+        for (size_t q = 0; q < p; q++) {
+            size_t w = (q * k * wstride) % N;
+            double xr = outr[q * m + k];
+            double xi = outi[q * m + k];
+            tr[q] = xr * wr[w] - xi * wi[w];
+            ti[q] = xr * wi[w] + xi * wr[w];
+        }
+        for (size_t r = 0; r < p; r++) {
+            double sumr = 0;
+            double sumi = 0;
+            for (size_t q = 0; q < p; q++) {
+                size_t w = ((q * r) % p) * (N / p);
+                sumr += tr[q] * wr[w] - ti[q] * wi[w];
+                sumi += tr[q] * wi[w] + ti[q] * wr[w];
+            }
+            outr[r * m + k] = sumr;
+            outi[r * m + k] = sumi;
+        }
+    }
+}
+
+// Forward transform of re/im in place
+static void transform(double* re, double* im, size_t n) {
+    if (n < 2) {
+        return;
+    }
+    const Plan* plan = getPlan(n);
+    if (plan->bitrev) {
+        fftRadix2(plan, re, im);
+        return;
+    }
+    double* inr = ALLOCATE(double, n);
+    double* ini = ALLOCATE(double, n);
+    double* scratch = ALLOCATE(double, 2 * n);
+    memcpy(inr, re, n * sizeof(double));
+    memcpy(ini, im, n * sizeof(double));
+    fftMixed(plan, inr, ini, re, im, n, 1, 1, scratch);
+    FREE_ARRAY(double, inr, n);
+    FREE_ARRAY(double, ini, n);
+    FREE_ARRAY(double, scratch, 2 * n);
+}
+
+// Unpack a Lox array of numbers into split arrays, false on error
+static bool unpackArray(const char* name, Value arg, double** re, double** im, size_t* n) {
+    if (!IS_ARRAY(arg)) {
+        ERR_PRINT("%s() expects an array of numbers\n", name);
+        return false;
+    }
+    ObjArray* array = AS_ARRAY(arg);
+    *n = array->length;
+    *re = ALLOCATE(double, *n + 1);
+    *im = ALLOCATE(double, *n + 1);
+    for (size_t i = 0; i < *n; i++) {
+        Value v = array->values[i];
+        if (IS_FCOMPLEX(v)) {
+            (*re)[i] = crealf(AS_FCOMPLEX(v));
+            (*im)[i] = cimagf(AS_FCOMPLEX(v));
+        } else if (IS_NUMBER(v)) {
+            (*re)[i] = AS_DOUBLE(v);
+            (*im)[i] = 0;
+        } else {
+            ERR_PRINT("%s() expects an array of numbers, element %zu is not a number\n", name, i);
+            FREE_ARRAY(double, *re, *n + 1);
+            FREE_ARRAY(double, *im, *n + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+static Value packArray(const double* re, const double* im, size_t n) {
+    ObjArray* array = allocateArray(n ? n : 1);
+    for (size_t i = 0; i < n; i++) {
+        array->values[i] = FCOMPLEX_VAL((float)re[i] + (float)im[i] * I);
+    }
+    array->length = n;
+    return OBJ_VAL(array);
+}
+
+static Value FFI_fft(int argCount, Value* args) {
+    double* re;
+    double* im;
+    size_t n;
+    if (!unpackArray("fft", args[0], &re, &im, &n)) {
+        return NIL_VAL;
+    }
+    transform(re, im, n);
+    Value result = packArray(re, im, n);
+    FREE_ARRAY(double, re, n + 1);
+    FREE_ARRAY(double, im, n + 1);
+    return result;
+}
+
+static Value FFI_ifft(int argCount, Value* args) {
+    double* re;
+    double* im;
+    size_t n;
+    if (!unpackArray("ifft", args[0], &re, &im, &n)) {
+        return NIL_VAL;
+    }
+    // ifft(x) = conj(fft(conj(x))) / n
+    for (size_t i = 0; i < n; i++) {
+        im[i] = -im[i];
+    }
+    transform(re, im, n);
+    for (size_t i = 0; i < n; i++) {
+        re[i] = re[i] / (double)n;
+        im[i] = -im[i] / (double)n;
+    }
+    Value result = packArray(re, im, n);
+    FREE_ARRAY(double, re, n + 1);
+    FREE_ARRAY(double, im, n + 1);
+    return result;
+}
+
+// Transform of a real signal, returns the n/2 + 1 non-redundant bins
+static Value FFI_rfft(int argCount, Value* args) {
+    double* x;
+    double* ignored;
+    size_t n;
+    if (!unpackArray("rfft", args[0], &x, &ignored, &n)) {
+        return NIL_VAL;
+    }
+    size_t bins = n / 2 + 1;
+    double* re = ALLOCATE(double, bins);
+    double* im = ALLOCATE(double, bins);
+    if (n % 2 != 0 || n < 4) {
+        // Odd sizes go through the full complex transform
+        memset(ignored, 0, n * sizeof(double));
+        transform(x, ignored, n);
+        memcpy(re, x, (n ? bins : 0) * sizeof(double));
+        memcpy(im, ignored, (n ? bins : 0) * sizeof(double));
+    } else {
+        // Pack even and odd samples into one half-size complex transform
+        size_t h = n / 2;
+        double* zr = ALLOCATE(double, h);
+        double* zi = ALLOCATE(double, h);
+        for (size_t k = 0; k < h; k++) {
+            zr[k] = x[2 * k];
+            zi[k] = x[2 * k + 1];
+        }
+        transform(zr, zi, h);
+        const Plan* plan = getPlan(n);
+        for (size_t k = 0; k < bins; k++) {
+            double ar = zr[k % h];
+            double ai = zi[k % h];
+            double br = zr[(h - k) % h];
+            double bi = -zi[(h - k) % h];
+            double er = (ar + br) / 2;
+            double ei = (ai + bi) / 2;
+            double dr = (ai - bi) / 2;
+            double di = -(ar - br) / 2;
+            re[k] = er + dr * plan->wr[k] - di * plan->wi[k];
+            im[k] = ei + dr * plan->wi[k] + di * plan->wr[k];
+        }
+        FREE_ARRAY(double, zr, h);
+        FREE_ARRAY(double, zi, h);
+    }
+    Value result = packArray(re, im, n ? bins : 0);
+    FREE_ARRAY(double, x, n + 1);
+    FREE_ARRAY(double, ignored, n + 1);
+    FREE_ARRAY(double, re, bins);
+    FREE_ARRAY(double, im, bins);
+    return result;
+}
+
+void defineFFTLib() {
+    defineNative("fft", 1, FFI_fft);
+    defineNative("ifft", 1, FFI_ifft);
+    defineNative("rfft", 1, FFI_rfft);
+}
@@ -0,0 +1,7 @@
+#ifndef clox_lib_fft_h
+#define clox_lib_fft_h
+
+void defineFFTLib();
+void freeFFTLib();
+
+#endif
@@ -0,0 +1,409 @@
+#include <complex.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "matrix.h"
+#include "memory.h"
+#include "object.h"
+#include "print.h"
+#include "value.h"
+#include "vm.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+Value matrixGet(ObjMatrix* matrix, size_t row, size_t col) {
+    size_t index = row * matrix->cols + col;
+    if (matrix->isComplex) {
+        return FCOMPLEX_VAL((float complex)matrix->complexes[index]);
+    }
+    return DOUBLE_VAL(matrix->real[index]);
+}
+
+void matrixSet(ObjMatrix* matrix, size_t row, size_t col, Value value) {
+    if (IS_FCOMPLEX(value) && !matrix->isComplex) {
+        matrixToComplex(matrix);
+    }
+    size_t index = row * matrix->cols + col;
+    if (matrix->isComplex) {
+        matrix->complexes[index] = AS_FCOMPLEX(value);
+    } else {
+        matrix->real[index] = AS_DOUBLE(value);
+    }
+}
+
+void matrixToComplex(ObjMatrix* matrix) {
+    if (matrix->isComplex) {
+        return;
+    }
+    size_t n = matrix->rows * matrix->cols;
+    matrix->complexes = ALLOCATE(double complex, n + 1);
+    if (matrix->complexes == NULL) {
+        ERR_PRINT("Failed to allocate a complex %zux%zu matrix\n", matrix->rows, matrix->cols);
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        matrix->complexes[i] = matrix->real[i];
+    }
+    FREE_ARRAY(double, matrix->real, n + 1);
+    matrix->real = NULL;
+    matrix->isComplex = true;
+}
+
+// Operands are addressed as base[i * stride], a stride of 0 broadcasts a scalar
+static void elementwiseReal(MatrixOp op, const double* x, size_t xs, const double* y, size_t ys, double* out, size_t n) {
+    switch (op) {
+        case MATRIX_ADD: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] + y[i * ys]; break;
+        case MATRIX_SUB: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] - y[i * ys]; break;
+        case MATRIX_MUL: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] * y[i * ys]; break;
+        case MATRIX_DIV: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] / y[i * ys]; break;
+    }
+}
+
+static void elementwiseComplex(MatrixOp op, const double complex* x, size_t xs, const double complex* y, size_t ys,
+                               double complex* out, size_t n) {
+    switch (op) {
+        case MATRIX_ADD: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] + y[i * ys]; break;
+        case MATRIX_SUB: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] - y[i * ys]; break;
+        case MATRIX_MUL: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] * y[i * ys]; break;
+        case MATRIX_DIV: for (size_t i = 0; i < n; i++) out[i] = x[i * xs] / y[i * ys]; break;
+    }
+}
+
+// Complex view of an operand, copying real matrices into scratch when needed
+static const double complex* complexOperand(Value v, double complex* scalar, double complex** scratch, size_t* stride) {
+    if (!IS_MATRIX(v)) {
+        *scalar = AS_FCOMPLEX(v);
+        *stride = 0;
+        return scalar;
+    }
+    ObjMatrix* m = AS_MATRIX(v);
+    *stride = 1;
+    if (m->isComplex) {
+        return m->complexes;
+    }
+    size_t n = m->rows * m->cols;
+    *scratch = ALLOCATE(double complex, n + 1);
+    if (*scratch == NULL) {
+        ERR_PRINT("Failed to allocate a complex %zux%zu matrix\n", m->rows, m->cols);
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        (*scratch)[i] = m->real[i];
+    }
+    return *scratch;
+}
+
+ObjMatrix* matrixElementwise(MatrixOp op, Value a, Value b) {
+    ObjMatrix* shape = IS_MATRIX(a) ? AS_MATRIX(a) : AS_MATRIX(b);
+    if (IS_MATRIX(a) && IS_MATRIX(b)
+            && (AS_MATRIX(a)->rows != AS_MATRIX(b)->rows || AS_MATRIX(a)->cols != AS_MATRIX(b)->cols)) {
+        return NULL;
+    }
+    bool isComplex = (IS_MATRIX(a) ? AS_MATRIX(a)->isComplex : IS_FCOMPLEX(a))
+        || (IS_MATRIX(b) ? AS_MATRIX(b)->isComplex : IS_FCOMPLEX(b));
+    size_t n = shape->rows * shape->cols;
+    ObjMatrix* result = allocateMatrix(shape->rows, shape->cols, isComplex);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (!isComplex) {
+        double x = AS_DOUBLE(a);
+        double y = AS_DOUBLE(b);
+        elementwiseReal(op,
+            IS_MATRIX(a) ? AS_MATRIX(a)->real : &x, IS_MATRIX(a),
+            IS_MATRIX(b) ? AS_MATRIX(b)->real : &y, IS_MATRIX(b),
+            result->real, n);
+        return result;
+    }
+    double complex x, y;
+    double complex* xScratch = NULL;
+    double complex* yScratch = NULL;
+    size_t xs, ys;
+    const double complex* xp = complexOperand(a, &x, &xScratch, &xs);
+    const double complex* yp = complexOperand(b, &y, &yScratch, &ys);
+    elementwiseComplex(op, xp, xs, yp, ys, result->complexes, n);
+    if (xScratch) {
+        FREE_ARRAY(double complex, xScratch, n + 1);
+    }
+    if (yScratch) {
+        FREE_ARRAY(double complex, yScratch, n + 1);
+    }
+    return result;
+}
+
+// c += a * b over one tile. Four rows of c share each load of b[p][j]
+// and the j loop is contiguous so the compiler can vectorize it.
+static void matmulTileReal(const double* restrict a, const double* restrict b, double* restrict c,
+                           size_t k, size_t n, size_t i0, size_t i1, size_t p0, size_t p1, size_t j0, size_t j1) {
+    size_t i = i0;
+    for (; i + 4 <= i1; i += 4) {
+        double* c0 = c + i * n;
+        double* c1 = c0 + n;
+        double* c2 = c1 + n;
+        double* c3 = c2 + n;
+        for (size_t p = p0; p < p1; p++) {
+            double a0 = a[i * k + p];
+            double a1 = a[(i + 1) * k + p];
+            double a2 = a[(i + 2) * k + p];
+            double a3 = a[(i + 3) * k + p];
+            const double* bp = b + p * n;
+            for (size_t j = j0; j < j1; j++) {
+                double bj = bp[j];
+                c0[j] += a0 * bj;
+                c1[j] += a1 * bj;
+                c2[j] += a2 * bj;
+                c3[j] += a3 * bj;
+            }
+        }
+    }
+    for (; i < i1; i++) {
+        double* ci = c + i * n;
+        for (size_t p = p0; p < p1; p++) {
+            double ai = a[i * k + p];
+            const double* bp = b + p * n;
+            for (size_t j = j0; j < j1; j++) {
+                ci[j] += ai * bp[j];
+            }
+        }
+    }
+}
+
+static void matmulTileComplex(const double complex* restrict a, const double complex* restrict b, double complex* restrict c,
+                              size_t k, size_t n, size_t i0, size_t i1, size_t p0, size_t p1, size_t j0, size_t j1) {
+    for (size_t i = i0; i < i1; i++) {
+        double complex* ci = c + i * n;
+        for (size_t p = p0; p < p1; p++) {
+            double complex ai = a[i * k + p];
+            const double complex* bp = b + p * n;
+            for (size_t j = j0; j < j1; j++) {
+                ci[j] += ai * bp[j];
+            }
+        }
+    }
+}
+
+// Tiled over all three loops. Each row block of c is owned by one thread when built with -fopenmp.
+static void matmulReal(const double* a, const double* b, double* c, size_t m, size_t k, size_t n) {
+    long blocks = (long)((m + MATRIX_TILE - 1) / MATRIX_TILE);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (m * k * n > 1000000)
+#endif
+    for (long block = 0; block < blocks; block++) {
+        size_t i0 = (size_t)block * MATRIX_TILE;
+        size_t i1 = MIN(i0 + MATRIX_TILE, m);
+        for (size_t p0 = 0; p0 < k; p0 += MATRIX_TILE) {
+            size_t p1 = MIN(p0 + MATRIX_TILE, k);
+            for (size_t j0 = 0; j0 < n; j0 += MATRIX_TILE) {
+                matmulTileReal(a, b, c, k, n, i0, i1, p0, p1, j0, MIN(j0 + MATRIX_TILE, n));
+            }
+        }
+    }
+}
+
+static void matmulComplex(const double complex* a, const double complex* b, double complex* c, size_t m, size_t k, size_t n) {
+    long blocks = (long)((m + MATRIX_TILE - 1) / MATRIX_TILE);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if (m * k * n > 250000)
+#endif
+    for (long block = 0; block < blocks; block++) {
+        size_t i0 = (size_t)block * MATRIX_TILE;
+        size_t i1 = MIN(i0 + MATRIX_TILE, m);
+        for (size_t p0 = 0; p0 < k; p0 += MATRIX_TILE) {
+            size_t p1 = MIN(p0 + MATRIX_TILE, k);
+            for (size_t j0 = 0; j0 < n; j0 += MATRIX_TILE) {
+                matmulTileComplex(a, b, c, k, n, i0, i1, p0, p1, j0, MIN(j0 + MATRIX_TILE, n));
+            }
+        }
+    }
+}
+
+ObjMatrix* matrixMultiply(ObjMatrix* a, ObjMatrix* b) {
+    if (a->cols != b->rows) {
+        return NULL;
+    }
+    bool isComplex = a->isComplex || b->isComplex;
+    ObjMatrix* c = allocateMatrix(a->rows, b->cols, isComplex);
+    if (c == NULL) {
+        return NULL;
+    }
+    if (!isComplex) {
+        matmulReal(a->real, b->real, c->real, a->rows, a->cols, b->cols);
+        return c;
+    }
+    // A real operand is promoted into scratch, the arguments keep their type
+    double complex scalar;
+    double complex* aScratch = NULL;
+    double complex* bScratch = NULL;
+    size_t stride;
+    const double complex* ap = complexOperand(OBJ_VAL(a), &scalar, &aScratch, &stride);
+    const double complex* bp = complexOperand(OBJ_VAL(b), &scalar, &bScratch, &stride);
+    matmulComplex(ap, bp, c->complexes, a->rows, a->cols, b->cols);
+    if (aScratch) {
+        FREE_ARRAY(double complex, aScratch, a->rows * a->cols + 1);
+    }
+    if (bScratch) {
+        FREE_ARRAY(double complex, bScratch, b->rows * b->cols + 1);
+    }
+    return c;
+}
+
+ObjMatrix* matrixTranspose(ObjMatrix* matrix) {
+    size_t rows = matrix->rows;
+    size_t cols = matrix->cols;
+    ObjMatrix* t = allocateMatrix(cols, rows, matrix->isComplex);
+    if (t == NULL) {
+        return NULL;
+    }
+    // Blocked so both the reads and the strided writes stay in cache
+    for (size_t i0 = 0; i0 < rows; i0 += MATRIX_TILE) {
+        for (size_t j0 = 0; j0 < cols; j0 += MATRIX_TILE) {
+            for (size_t i = i0; i < MIN(i0 + MATRIX_TILE, rows); i++) {
+                for (size_t j = j0; j < MIN(j0 + MATRIX_TILE, cols); j++) {
+                    if (matrix->isComplex) {
+                        t->complexes[j * rows + i] = matrix->complexes[i * cols + j];
+                    } else {
+                        t->real[j * rows + i] = matrix->real[i * cols + j];
+                    }
+                }
+            }
+        }
+    }
+    return t;
+}
+
+bool matrixEqual(ObjMatrix* a, ObjMatrix* b) {
+    if (a->rows != b->rows || a->cols != b->cols) {
+        return false;
+    }
+    for (size_t i = 0; i < a->rows; i++) {
+        for (size_t j = 0; j < a->cols; j++) {
+            if (!valuesEqual(matrixGet(a, i, j), matrixGet(b, i, j))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void printMatrixRow(ObjMatrix* matrix, size_t row) {
+    printf("[");
+    for (size_t j = 0; j < matrix->cols; j++) {
+        printValue(matrixGet(matrix, row, j));
+        if (j < matrix->cols - 1) {
+            printf(", ");
+        }
+    }
+    printf("]");
+}
+
+void printMatrix(ObjMatrix* matrix) {
+    printf("matrix([");
+    for (size_t i = 0; i < matrix->rows; i++) {
+        printMatrixRow(matrix, i);
+        if (i < matrix->rows - 1) {
+            printf(", ");
+        }
+    }
+    printf("])");
+}
+
+// matrix(rows, cols) is all zeros, matrix([[...], ...]) copies nested arrays of numbers
+static Value FFI_matrix(int argCount, Value* args) {
+    if (argCount == 2) {
+        if (!IS_INTEGER(args[0]) || !IS_INTEGER(args[1]) || AS_INTEGER(args[0]) < 0 || AS_INTEGER(args[1]) < 0) {
+            ERR_PRINT("matrix() expects a non-negative number of rows and columns\n");
+            return NIL_VAL;
+        }
+        ObjMatrix* matrix = allocateMatrix(AS_INTEGER(args[0]), AS_INTEGER(args[1]), false);
+        if (matrix == NULL) {
+            ERR_PRINT("matrix() cannot allocate %" PRId64 "x%" PRId64 "\n", AS_INTEGER(args[0]), AS_INTEGER(args[1]));
+            return NIL_VAL;
+        }
+        return OBJ_VAL(matrix);
+    }
+    if (argCount != 1 || !IS_ARRAY(args[0])) {
+        ERR_PRINT("matrix() expects an array of rows or a shape\n");
+        return NIL_VAL;
+    }
+    ObjArray* rows = AS_ARRAY(args[0]);
+    size_t cols = 0;
+    bool isComplex = false;
+    for (size_t i = 0; i < rows->length; i++) {
+        if (!IS_ARRAY(rows->values[i]) || (i > 0 && ARRAY_LENGTH(rows->values[i]) != cols)) {
+            ERR_PRINT("matrix() expects rows that are arrays of equal length, row %zu is not\n", i);
+            return NIL_VAL;
+        }
+        ObjArray* row = AS_ARRAY(rows->values[i]);
+        cols = row->length;
+        for (size_t j = 0; j < cols; j++) {
+            if (!IS_NUMBER(row->values[j])) {
+                ERR_PRINT("matrix() expects numbers, element [%zu][%zu] is not a number\n", i, j);
+                return NIL_VAL;
+            }
+            isComplex = isComplex || IS_FCOMPLEX(row->values[j]);
+        }
+    }
+    ObjMatrix* matrix = allocateMatrix(rows->length, cols, isComplex);
+    if (matrix == NULL) {
+        ERR_PRINT("matrix() cannot allocate %zux%zu\n", rows->length, cols);
+        return NIL_VAL;
+    }
+    for (size_t i = 0; i < rows->length; i++) {
+        ObjArray* row = AS_ARRAY(rows->values[i]);
+        for (size_t j = 0; j < cols; j++) {
+            matrixSet(matrix, i, j, row->values[j]);
+        }
+    }
+    return OBJ_VAL(matrix);
+}
+
+static Value FFI_matmul(int argCount, Value* args) {
+    if (!IS_MATRIX(args[0]) || !IS_MATRIX(args[1])) {
+        ERR_PRINT("matmul() expects two matrices\n");
+        return NIL_VAL;
+    }
+    ObjMatrix* c = matrixMultiply(AS_MATRIX(args[0]), AS_MATRIX(args[1]));
+    if (c == NULL) {
+        ERR_PRINT("matmul() cannot multiply %zux%zu by %zux%zu\n",
+            AS_MATRIX(args[0])->rows, AS_MATRIX(args[0])->cols, AS_MATRIX(args[1])->rows, AS_MATRIX(args[1])->cols);
+        return NIL_VAL;
+    }
+    return OBJ_VAL(c);
+}
+
+static Value FFI_transpose(int argCount, Value* args) {
+    if (!IS_MATRIX(args[0])) {
+        ERR_PRINT("transpose() expects a matrix\n");
+        return NIL_VAL;
+    }
+    ObjMatrix* t = matrixTranspose(AS_MATRIX(args[0]));
+    if (t == NULL) {
+        ERR_PRINT("transpose() cannot allocate %zux%zu\n", AS_MATRIX(args[0])->cols, AS_MATRIX(args[0])->rows);
+        return NIL_VAL;
+    }
+    return OBJ_VAL(t);
+}
+
+static Value FFI_setMatrix(int argCount, Value* args) {
+    if (!IS_MATRIX(args[0]) || !IS_INTEGER(args[1]) || !IS_INTEGER(args[2]) || !IS_NUMBER(args[3])) {
+        ERR_PRINT("setMatrix() expects a matrix, a row, a column and a number\n");
+        return NIL_VAL;
+    }
+    ObjMatrix* matrix = AS_MATRIX(args[0]);
+    int64_t row = AS_INTEGER(args[1]);
+    int64_t col = AS_INTEGER(args[2]);
+    if (row < 0 || col < 0 || (size_t)row >= matrix->rows || (size_t)col >= matrix->cols) {
+        ERR_PRINT("setMatrix() index [%" PRId64 "][%" PRId64 "] out of bounds\n", row, col);
+        return NIL_VAL;
+    }
+    matrixSet(matrix, row, col, args[3]);
+    return NIL_VAL;
+}
+
+void defineMatrixLib() {
+    defineNative("matrix", -1, FFI_matrix);
+    defineNative("matmul", 2, FFI_matmul);
+    defineNative("transpose", 1, FFI_transpose);
+    defineNative("setMatrix", 4, FFI_setMatrix);
+}
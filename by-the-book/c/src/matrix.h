@@ -0,0 +1,60 @@
+#ifndef clox_matrix_h
+#define clox_matrix_h
+
+#include <complex.h>
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+#define IS_MATRIX(value) isObjType(value, OBJ_MATRIX)
+#define AS_MATRIX(value) ((ObjMatrix*)AS_OBJ(value))
+
+#define IS_MATRIX_ROW(value) isObjType(value, OBJ_MATRIX_ROW)
+#define AS_MATRIX_ROW(value) ((ObjMatrixRow*)AS_OBJ(value))
+
+// Square tile edge used by matmul and transpose, three double tiles fit in L2
+#define MATRIX_TILE 64
+
+// Dense row-major matrix of doubles, or of double complex once any element is complex
+struct ObjMatrix {
+    Obj obj;
+    size_t rows;
+    size_t cols;
+    bool isComplex;
+    double* real;              // rows * cols, NULL when isComplex
+    double complex* complexes; // rows * cols, NULL unless isComplex
+    ObjMatrixRow** rowViews;   // Created on demand by m[i], one per row
+};
+
+// What m[i] evaluates to, indexing it reads straight from the matrix buffer
+struct ObjMatrixRow {
+    Obj obj;
+    ObjMatrix* matrix;
+    size_t row;
+};
+
+typedef enum {
+    MATRIX_ADD,
+    MATRIX_SUB,
+    MATRIX_MUL,
+    MATRIX_DIV,
+} MatrixOp;
+
+Value matrixGet(ObjMatrix* matrix, size_t row, size_t col);
+void matrixSet(ObjMatrix* matrix, size_t row, size_t col, Value value);
+void matrixToComplex(ObjMatrix* matrix);
+
+// Element-wise, either side may be a scalar. Returns NULL if the shapes differ or it cannot be allocated.
+ObjMatrix* matrixElementwise(MatrixOp op, Value a, Value b);
+// Returns NULL if the inner dimensions differ or the result cannot be allocated
+ObjMatrix* matrixMultiply(ObjMatrix* a, ObjMatrix* b);
+ObjMatrix* matrixTranspose(ObjMatrix* matrix); // NULL if it cannot be allocated
+bool matrixEqual(ObjMatrix* a, ObjMatrix* b);
+
+void printMatrixRow(ObjMatrix* matrix, size_t row);
+void printMatrix(ObjMatrix* matrix);
+
+void defineMatrixLib();
+
+#endif
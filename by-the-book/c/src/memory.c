@@ -3,9 +3,13 @@
 
 #include "object.h"
 #include "memory.h"
+#include "profile.h"
 #include "vm.h"
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    if (PROFILING) {
+        profileRealloc(oldSize, newSize);
+    }
     if (!newSize) {
         free(pointer);
         return NULL;
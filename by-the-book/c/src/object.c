@@ -1,14 +1,21 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "bigint.h"
 #include "hashmap.h"
+#include "matrix.h"
 #include "memory.h"
 #include "object.h"
+#include "profile.h"
+#include "regcode.h"
 #include "value.h"
 #include "vm.h"
 
 static Obj* allocateObj(size_t size, ObjType type) {
     Obj* object = (Obj*)reallocate(NULL, 0, size);
+    if (PROFILE_HEAP) {
+        profileObject(type, size);
+    }
     object->type = type;
     object->next = vm.objects;
     vm.objects = object;
@@ -22,6 +29,10 @@ ObjFunction* newFunction(ObjString* name, const Chunk* optionalChunk) {
         func->chunk = *optionalChunk;
     }
     func->arity = 0;
+    func->maxStack = chunkMaxStack(&func->chunk, 1);
+    func->reg = NULL;
+    func->hotness = 0;
+    func->jitTried = false;
     func->name = name;
     return func;
 }
@@ -43,6 +54,7 @@ ObjString* copyString(const char* chars, size_t length) {
     ObjString* string = (ObjString*)allocateObj(sizeof(ObjString) + sizeof(char) * (length + 1), OBJ_STRING);
     string->length = length;
     string->hash = hash;
+    string->builtin = 0;
     memcpy(string->chars, chars, length);
     // Turn the chars into a C-string
     string->chars[length] = '\0';
@@ -53,14 +65,95 @@ ObjString* copyString(const char* chars, size_t length) {
 ObjHashmap* allocateHashmap(size_t capacity) {
     ObjHashmap* hashmap = (ObjHashmap*)allocateObj(sizeof(ObjHashmap), OBJ_HASHMAP);
     hashmap_init(&hashmap->map, capacity, hashAny);
+    hashmap->borrowed = false;
+    return hashmap;
+}
+
+ObjHashmap* borrowHashmap(ObjHashmap* constant) {
+    ObjHashmap* hashmap = (ObjHashmap*)allocateObj(sizeof(ObjHashmap), OBJ_HASHMAP);
+    hashmap->map = constant->map;
+    hashmap->borrowed = true;
     return hashmap;
 }
 
+void ownHashmap(ObjHashmap* hashmap) {
+    if (!hashmap->borrowed) {
+        return;
+    }
+    if (PROFILING) {
+        // The copy bypasses reallocate()
+        profileRealloc(0, sizeof(hashmap_item) * hashmap->map.capacity);
+    }
+    // Copy on write, the constant keeps its entries
+    hashmap_t constant = hashmap->map;
+    hashmap_copy(&hashmap->map, &constant);
+    hashmap->borrowed = false;
+}
+
+ObjBigInt* newBigInt(bool negative, const uint64_t* limbs, size_t length) {
+    ObjBigInt* bigint = (ObjBigInt*)allocateObj(sizeof(ObjBigInt) + sizeof(uint64_t) * length, OBJ_BIGINT);
+    bigint->negative = negative;
+    bigint->length = length;
+    memcpy(bigint->limbs, limbs, sizeof(uint64_t) * length);
+    return bigint;
+}
+
+ObjMatrix* allocateMatrix(size_t rows, size_t cols, bool isComplex) {
+    // One element more so empty matrices still get a buffer
+    size_t size = isComplex ? sizeof(double complex) : sizeof(double);
+    if (cols && rows > (SIZE_MAX / size - 1) / cols) {
+        return NULL;
+    }
+    size_t bytes = size * (rows * cols + 1);
+    void* buffer = reallocate(NULL, 0, bytes);
+    if (buffer == NULL) {
+        // Take back what reallocate() counted for the attempt
+        reallocate(NULL, bytes, 0);
+        return NULL;
+    }
+    memset(buffer, 0, bytes);
+    ObjMatrix* matrix = (ObjMatrix*)allocateObj(sizeof(ObjMatrix), OBJ_MATRIX);
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->isComplex = isComplex;
+    matrix->real = isComplex ? NULL : buffer;
+    matrix->complexes = isComplex ? buffer : NULL;
+    matrix->rowViews = NULL;
+    return matrix;
+}
+
+ObjMatrixRow* getMatrixRow(ObjMatrix* matrix, size_t row) {
+    if (matrix->rowViews == NULL) {
+        matrix->rowViews = (ObjMatrixRow**)calloc(matrix->rows, sizeof(ObjMatrixRow*));
+    }
+    if (matrix->rowViews[row] == NULL) {
+        ObjMatrixRow* view = (ObjMatrixRow*)allocateObj(sizeof(ObjMatrixRow), OBJ_MATRIX_ROW);
+        view->matrix = matrix;
+        view->row = row;
+        matrix->rowViews[row] = view;
+    }
+    return matrix->rowViews[row];
+}
+
 ObjArray* allocateArray(size_t capacity) {
     ObjArray* array = (ObjArray*)allocateObj(sizeof(ObjArray), OBJ_ARRAY);
     array->length = 0;
     array->capacity = capacity;
     array->values = (Value*)calloc(capacity, sizeof(Value));
+    array->borrowed = false;
+    if (PROFILING) {
+        // The buffer bypasses reallocate()
+        profileRealloc(0, sizeof(Value) * capacity);
+    }
+    return array;
+}
+
+ObjArray* borrowArray(ObjArray* constant) {
+    ObjArray* array = (ObjArray*)allocateObj(sizeof(ObjArray), OBJ_ARRAY);
+    array->length = constant->length;
+    array->capacity = constant->length;
+    array->values = constant->values;
+    array->borrowed = true;
     return array;
 }
 
@@ -84,6 +177,18 @@ ObjStringView* getStringView(ObjString* origin, int index, size_t length) {
 }
 
 void reallocArray(ObjArray* array, size_t capacity) {
+    if (PROFILING) {
+        profileRealloc(array->borrowed ? 0 : sizeof(Value) * array->capacity, sizeof(Value) * capacity);
+    }
+    if (array->borrowed) {
+        // Copy on write, the constant keeps its values
+        Value* values = (Value*)calloc(capacity, sizeof(Value));
+        memcpy(values, array->values, sizeof(Value) * array->length);
+        array->values = values;
+        array->capacity = capacity;
+        array->borrowed = false;
+        return;
+    }
     if (capacity == array->capacity) {
         return;
     }
@@ -104,8 +209,9 @@ void insertArray(ObjArray* array, int index, Value value) {
         return;
     }
     if (index == array->length && array->length + 1 > array->capacity) {
-        // ERR_PRINT("Array: Growing capacity from %zu to %zu\n", array->capacity, array->capacity * 2);
-        reallocArray(array, array->capacity * 2);
+        reallocArray(array, GROW_CAPACITY(array->capacity));
+    } else if (array->borrowed) {
+        reallocArray(array, array->capacity);
     }
     if (index == array->length) {
         array->length++;
@@ -134,6 +240,7 @@ void freeObject(Obj* obj) {
         case OBJ_FUNCTION: {
             ObjFunction* func = (ObjFunction*)obj;
             freeChunk(&func->chunk);
+            freeRegCode(func->reg);
             free(func);
             break;
         }
@@ -154,16 +261,43 @@ void freeObject(Obj* obj) {
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)obj;
-            free(array->values);
+            if (!array->borrowed) {
+                free(array->values);
+            }
             free(array);
             break;
         }
         case OBJ_HASHMAP: {
             ObjHashmap* hashmap = (ObjHashmap*)obj;
-            hashmap_free(&hashmap->map);
+            if (!hashmap->borrowed) {
+                hashmap_free(&hashmap->map);
+            }
             free(hashmap);
             break;
         }
+        case OBJ_BIGINT: {
+            ObjBigInt* bigint = (ObjBigInt*)obj;
+            free(bigint);
+            break;
+        }
+        case OBJ_MATRIX: {
+            // The row views are objects of their own and are freed separately
+            ObjMatrix* matrix = (ObjMatrix*)obj;
+            size_t n = matrix->rows * matrix->cols + 1;
+            if (matrix->isComplex) {
+                FREE_ARRAY(double complex, matrix->complexes, n);
+            } else {
+                FREE_ARRAY(double, matrix->real, n);
+            }
+            free(matrix->rowViews);
+            free(matrix);
+            break;
+        }
+        case OBJ_MATRIX_ROW: {
+            ObjMatrixRow* view = (ObjMatrixRow*)obj;
+            free(view);
+            break;
+        }
     }
 }
 
@@ -177,6 +311,14 @@ bool objsEqual(Obj* a, Obj* b) {
             ObjString* bS = (ObjString*)b;
             return aS->length == bS->length && memcmp(aS->chars, bS->chars, aS->length) == 0;
         }
+        case OBJ_BIGINT: {
+            ObjBigInt* aB = (ObjBigInt*)a;
+            ObjBigInt* bB = (ObjBigInt*)b;
+            return aB->negative == bB->negative && aB->length == bB->length
+                && memcmp(aB->limbs, bB->limbs, sizeof(uint64_t) * aB->length) == 0;
+        }
+        case OBJ_MATRIX: return matrixEqual((ObjMatrix*)a, (ObjMatrix*)b);
+        case OBJ_MATRIX_ROW: { ERR_PRINT("Cannot compare objects yet!\n"); exit(1); return false; }
         case OBJ_NEVER: { ERR_PRINT("Cannot compare objects yet!\n"); exit(1); return false; }
         case OBJ_FUNCTION: { ERR_PRINT("Cannot compare objects yet!\n"); exit(1); return false; }
         case OBJ_NATIVE: { ERR_PRINT("Cannot compare objects yet!\n"); exit(1); return false; }
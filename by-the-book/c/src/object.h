@@ -36,6 +36,9 @@ typedef enum {
     OBJ_STRING_VIEW,
     OBJ_ARRAY,
     OBJ_HASHMAP,
+    OBJ_BIGINT,
+    OBJ_MATRIX,
+    OBJ_MATRIX_ROW,
 } ObjType;
 
 struct Obj {
@@ -43,10 +46,16 @@ struct Obj {
     struct Obj* next;
 };
 
+typedef struct RegCode RegCode;
+
 typedef struct {
     Obj obj;
     int arity;
+    int maxStack; // Slots its stack VM frames use at most, from the callee up, see chunkMaxStack()
     Chunk chunk;
+    RegCode* reg; // Register form of chunk, lowered for --reg or once the function is hot
+    int hotness; // Calls plus loop back-edges, see JIT_THRESHOLD
+    bool jitTried;
     ObjString* name;
     // For debugging and documentation purposes
     ObjString* paramNames;
@@ -69,6 +78,7 @@ struct ObjString {
     Obj obj;
     size_t length;
     size_t hash;
+    int builtin; // 1 + index in vm.builtins when this names one, calls to it compile to intrinsics
     char chars[];
 };
 
@@ -85,6 +95,7 @@ struct ObjArray {
     size_t length;
     size_t capacity;
     Value* values;
+    bool borrowed; // values belongs to a constant array, copy it before writing
 };
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -105,7 +116,16 @@ void insertArray(ObjArray* array, int index, Value value); // might grow array,
 Value getArray(ObjArray* array, int index); // bounds check!!!
 Value removeArray(ObjArray* array, int index); // shift values, might shrink array, return old value or (nil?)
 
+ObjArray* borrowArray(ObjArray* constant); // copy-on-write view of a constant array
+
 ObjHashmap* allocateHashmap(size_t capacity);
+ObjHashmap* borrowHashmap(ObjHashmap* constant); // copy-on-write view of a constant hashmap
+void ownHashmap(ObjHashmap* hashmap); // copies borrowed entries, call before writing
+
+ObjBigInt* newBigInt(bool negative, const uint64_t* limbs, size_t length);
+
+ObjMatrix* allocateMatrix(size_t rows, size_t cols, bool isComplex); // zero-filled, NULL if too large
+ObjMatrixRow* getMatrixRow(ObjMatrix* matrix, size_t row); // cached, one view per row
 
 void freeObject(Obj* obj);
 bool objsEqual(Obj* a, Obj* b);
@@ -1,7 +1,10 @@
+#include <inttypes.h>
 #include <stdio.h>
 #include <complex.h>
 
 #include "print.h"
+#include "bigint.h"
+#include "matrix.h"
 
 void printValueExtra(Value value, bool printQuotes);
 
@@ -59,8 +62,9 @@ void printValueExtra(Value value, bool printQuotes) {
             }
             break;
         }
-        case VAL_INT: printf("%d", AS_INTEGER(value)); break;
+        case VAL_INT: printf("%" PRId64, AS_INTEGER(value)); break;
         case VAL_BOOL: printf("%s", AS_BOOL(value) ? "true" : "false"); break;
+        case VAL_BIGINT: printBigInt(AS_BIGINT(value)); break;
         case VAL_OBJ: {
             switch (AS_OBJ(value)->type) {
                 case OBJ_NEVER: printf("(OBJ null or uninitialized?)"); break;
@@ -91,6 +95,15 @@ void printValueExtra(Value value, bool printQuotes) {
                     hashmap_iter(&AS_HASHMAP(value)->map, printHashmapItem, NULL);
                     printf("}");
                     break;
+                case OBJ_BIGINT:
+                    printBigInt((ObjBigInt*)AS_OBJ(value));
+                    break;
+                case OBJ_MATRIX:
+                    printMatrix(AS_MATRIX(value));
+                    break;
+                case OBJ_MATRIX_ROW:
+                    printMatrixRow(AS_MATRIX_ROW(value)->matrix, AS_MATRIX_ROW(value)->row);
+                    break;
             }
         }
     }
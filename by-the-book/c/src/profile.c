@@ -0,0 +1,790 @@
+// clock_gettime, sigaction and setitimer are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "bigint.h"
+#include "debug.h"
+#include "hashmap.h"
+#include "matrix.h"
+#include "profile.h"
+#include "vm.h"
+
+// One instruction in PROFILE_PERIOD on average is timed, from its dispatch to the next one's
+#define PROFILE_PERIOD 64
+#define PROFILE_TOP 20
+#define NO_OP (-1)
+// Call stack samples per second of CPU time
+#define SAMPLE_HZ 997
+// Deeper stacks keep the outermost frame and the innermost ones
+#define SAMPLE_FRAMES 256
+// Trace events are written through a buffer of this size
+#define EVENTS_BUFFER (1 << 20)
+
+#if defined(__x86_64__)
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+typedef struct {
+    uint64_t* counts;  // [op]
+    uint64_t* pairs;   // [first * OP_COUNT + second]
+    uint64_t* triples; // [(first * OP_COUNT + second) * OP_COUNT + third]
+    uint64_t* ticks;   // [op], summed over the timed executions
+    uint64_t* timed;   // [op]
+    uint64_t total;
+    int previous[2];   // The last two opcodes, most recent first
+    int pending;       // Opcode being timed, or NO_OP
+    uint64_t start;
+    uint32_t untilSample;
+    uint32_t seed;
+} Profile;
+
+typedef struct {
+    int index;
+    uint64_t count;
+} Entry;
+
+// Counts keyed by a string, like the folded stack "outer:line;inner:line"
+typedef struct {
+    char* key;
+    uint32_t hash;
+    uint64_t count;
+    uint64_t bytes;
+} KeyEntry;
+
+typedef struct {
+    KeyEntry* entries; // Open addressing, key is NULL in empty slots
+    int count;
+    int capacity;
+} KeyTable;
+
+// What ran on each line of the source being run, indexed by line number
+typedef struct {
+    uint64_t* instructions;
+    uint64_t* bytes; // Allocated
+    int capacity;
+} Lines;
+
+// Everything allocated through reallocate() and array buffers, and objects by type
+typedef struct {
+    uint64_t allocations; // Calls that grew something
+    uint64_t allocated; // Bytes, summed over the growth
+    uint64_t live;
+    uint64_t peak;
+    uint64_t objects[OBJ_MATRIX_ROW + 1];
+    uint64_t objectBytes[OBJ_MATRIX_ROW + 1];
+    uint64_t strings; // Interned, summed over the VMs that ran
+    uint64_t stringBytes;
+    uint64_t stringSlots;
+} Heap;
+
+// A call or phase that began and has not ended yet
+typedef struct {
+    const char* name;
+    const char* category;
+    uint64_t start; // ns
+} Span;
+
+// Chrome trace event JSON, one complete event per span once it ends
+typedef struct {
+    FILE* out;
+    char* buffer;
+    uint64_t origin; // ns, timestamps count from here
+    uint64_t threshold; // ns, shorter spans are not written
+    uint64_t written;
+    Span* spans;
+    int depth;
+    int capacity;
+} Events;
+
+static const char* objTypeNames[OBJ_MATRIX_ROW + 1] = {
+    [OBJ_NEVER] = "OBJ_NEVER",
+    [OBJ_FUNCTION] = "OBJ_FUNCTION",
+    [OBJ_NATIVE] = "OBJ_NATIVE",
+    [OBJ_STRING] = "OBJ_STRING",
+    [OBJ_STRING_VIEW] = "OBJ_STRING_VIEW",
+    [OBJ_ARRAY] = "OBJ_ARRAY",
+    [OBJ_HASHMAP] = "OBJ_HASHMAP",
+    [OBJ_BIGINT] = "OBJ_BIGINT",
+    [OBJ_MATRIX] = "OBJ_MATRIX",
+    [OBJ_MATRIX_ROW] = "OBJ_MATRIX_ROW",
+};
+
+static Profile profile;
+static KeyTable stacks;
+static Lines lines;
+static Heap heap;
+static KeyTable sites; // Objects allocated per "function:line"
+static Events events;
+// The key being built
+static char* scratch;
+static size_t scratchCapacity;
+// The handler only raises this, run() takes the sample at the next instruction where the frames are consistent
+static volatile sig_atomic_t sampleDue = 0;
+// What SIGUSR1 turns on and off
+static volatile sig_atomic_t toggledHooks = 0;
+
+uint64_t profileNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t now(void) {
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return profileNanos();
+#endif
+}
+
+// Jittered so loops whose length divides the period are not always timed at the same instruction
+static uint32_t nextPeriod(void) {
+    uint32_t x = profile.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    profile.seed = x;
+    return PROFILE_PERIOD / 2 + x % PROFILE_PERIOD;
+}
+
+void profileStart(void) {
+    if (profile.counts) {
+        return;
+    }
+    profile.counts = calloc(OP_COUNT, sizeof(uint64_t));
+    profile.pairs = calloc(OP_COUNT * OP_COUNT, sizeof(uint64_t));
+    profile.triples = calloc(OP_COUNT * OP_COUNT * OP_COUNT, sizeof(uint64_t));
+    profile.ticks = calloc(OP_COUNT, sizeof(uint64_t));
+    profile.timed = calloc(OP_COUNT, sizeof(uint64_t));
+    profile.previous[0] = profile.previous[1] = NO_OP;
+    profile.pending = NO_OP;
+    profile.seed = 2463534242u;
+    profile.untilSample = nextPeriod();
+}
+
+static void countOp(OpCode op) {
+    if (profile.pending != NO_OP) {
+        profile.ticks[profile.pending] += now() - profile.start;
+        profile.timed[profile.pending]++;
+        profile.pending = NO_OP;
+    }
+    profile.counts[op]++;
+    profile.total++;
+    int first = profile.previous[1], second = profile.previous[0];
+    if (second != NO_OP) {
+        profile.pairs[second * OP_COUNT + op]++;
+        if (first != NO_OP) {
+            profile.triples[(first * OP_COUNT + second) * OP_COUNT + op]++;
+        }
+    }
+    profile.previous[1] = second;
+    profile.previous[0] = op;
+    if (--profile.untilSample == 0) {
+        profile.untilSample = nextPeriod();
+        profile.pending = op;
+        profile.start = now();
+    }
+}
+
+static void onSignal(int signal) {
+    sampleDue = 1;
+}
+
+static void onToggle(int signal) {
+    setHooks(getHooks() ^ toggledHooks);
+}
+
+bool profileHooksOnSignal(int hooks) {
+    toggledHooks = hooks;
+    struct sigaction action = {0};
+    action.sa_handler = onToggle;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(SIGUSR1, &action, NULL) == 0;
+}
+
+bool profileStacksStart(void) {
+    struct sigaction action = {0};
+    action.sa_handler = onSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    struct itimerval timer = {{0, 1000000 / SAMPLE_HZ}, {0, 1000000 / SAMPLE_HZ}};
+    return sigaction(SIGPROF, &action, NULL) == 0 && setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+static uint32_t hashKey(const char* key) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = key; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static KeyEntry* findKey(KeyEntry* entries, int capacity, const char* key, uint32_t hash) {
+    for (uint32_t i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        KeyEntry* entry = &entries[i];
+        if (!entry->key || (entry->hash == hash && strcmp(entry->key, key) == 0)) {
+            return entry;
+        }
+    }
+}
+
+// The entry for key, added with zero counts if it is new
+static KeyEntry* keyEntry(KeyTable* table, const char* key) {
+    if (table->capacity < (table->count + 1) * 4 / 3 + 1) {
+        int capacity = table->capacity ? table->capacity * 2 : 64;
+        KeyEntry* entries = calloc(capacity, sizeof(KeyEntry));
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key) {
+                *findKey(entries, capacity, table->entries[i].key, table->entries[i].hash) = table->entries[i];
+            }
+        }
+        free(table->entries);
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    uint32_t hash = hashKey(key);
+    KeyEntry* entry = findKey(table->entries, table->capacity, key, hash);
+    if (!entry->key) {
+        size_t size = strlen(key) + 1;
+        entry->key = memcpy(malloc(size), key, size);
+        entry->hash = hash;
+        table->count++;
+    }
+    return entry;
+}
+
+// The entries in a new array, ordered by compare. The caller frees the result.
+static KeyEntry* sortKeys(KeyTable* table, int (*compare)(const void*, const void*)) {
+    KeyEntry* sorted = malloc(sizeof(KeyEntry) * (table->count + 1));
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key) {
+            sorted[count++] = table->entries[i];
+        }
+    }
+    qsort(sorted, count, sizeof(KeyEntry), compare);
+    return sorted;
+}
+
+static void freeKeys(KeyTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        free(table->entries[i].key);
+    }
+    free(table->entries);
+    *table = (KeyTable){0};
+}
+
+// Appends "name:line" for the frame to scratch, after a ';' unless it is the first
+static void appendFrame(size_t* length, CallFrame* frame) {
+    const char* name = frame->function->name ? frame->function->name->chars : "<script>";
+    // Room for the separators, the line number and a following ";..."
+    size_t needed = *length + strlen(name) + 32;
+    if (scratchCapacity < needed) {
+        scratchCapacity = needed * 2;
+        scratch = realloc(scratch, scratchCapacity);
+    }
+    int line = getLineRun(&frame->function->chunk, frameOffset(frame)).line;
+    *length += sprintf(scratch + *length, "%s%s:%d", *length ? ";" : "", name, line);
+}
+
+static void sampleStack(void) {
+    if (vm.frameCount == 0) {
+        return;
+    }
+    size_t length = 0;
+    int inner = vm.frameCount > SAMPLE_FRAMES ? vm.frameCount - SAMPLE_FRAMES + 1 : 0;
+    if (inner > 0) {
+        appendFrame(&length, FRAME(0));
+        length += sprintf(scratch + length, ";...");
+    }
+    for (int i = inner; i < vm.frameCount; i++) {
+        appendFrame(&length, FRAME(i));
+    }
+    keyEntry(&stacks, scratch)->count++;
+}
+
+// Line of the instruction the innermost frame is executing, 0 if there is none
+static int currentLine(void) {
+    if (vm.frameCount == 0) {
+        return 0;
+    }
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    int line = getLineRun(&frame->function->chunk, frameOffset(frame)).line;
+    if (line >= lines.capacity) {
+        // Not through reallocate(), which would count this too
+        int capacity = lines.capacity ? lines.capacity : 64;
+        while (capacity <= line) {
+            capacity *= 2;
+        }
+        lines.instructions = realloc(lines.instructions, sizeof(uint64_t) * capacity);
+        lines.bytes = realloc(lines.bytes, sizeof(uint64_t) * capacity);
+        memset(lines.instructions + lines.capacity, 0, sizeof(uint64_t) * (capacity - lines.capacity));
+        memset(lines.bytes + lines.capacity, 0, sizeof(uint64_t) * (capacity - lines.capacity));
+        lines.capacity = capacity;
+    }
+    return line;
+}
+
+void profileRealloc(size_t oldSize, size_t newSize) {
+    if (PROFILE_LINES && newSize > oldSize) {
+        int line = currentLine();
+        if (line > 0) {
+            lines.bytes[line] += newSize - oldSize;
+        }
+    }
+    if (PROFILE_HEAP) {
+        if (newSize > oldSize) {
+            heap.allocations++;
+            heap.allocated += newSize - oldSize;
+            heap.live += newSize - oldSize;
+        } else {
+            heap.live -= oldSize - newSize < heap.live ? oldSize - newSize : heap.live;
+        }
+        if (heap.live > heap.peak) {
+            heap.peak = heap.live;
+        }
+    }
+}
+
+void profileObject(ObjType type, size_t size) {
+    heap.objects[type]++;
+    heap.objectBytes[type] += size;
+    size_t length = 0;
+    if (vm.frameCount > 0) {
+        appendFrame(&length, FRAME(vm.frameCount - 1));
+    }
+    KeyEntry* site = keyEntry(&sites, length ? scratch : "<compiler>");
+    site->count++;
+    site->bytes += size;
+}
+
+void profileOp(OpCode op) {
+    if (PROFILE_OPS) {
+        countOp(op);
+    }
+    if (PROFILE_LINES) {
+        int line = currentLine();
+        if (line > 0) {
+            lines.instructions[line]++;
+        }
+    }
+    if (sampleDue) {
+        sampleDue = 0;
+        sampleStack();
+    }
+}
+
+static int byCount(const void* a, const void* b) {
+    const Entry* x = a;
+    const Entry* y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+// The non-zero counts, most frequent first. The caller frees the result.
+static Entry* sortCounts(const uint64_t* counts, int length, int* count) {
+    Entry* entries = malloc(sizeof(Entry) * length);
+    *count = 0;
+    for (int i = 0; i < length; i++) {
+        if (counts[i] > 0) {
+            entries[(*count)++] = (Entry){i, counts[i]};
+        }
+    }
+    qsort(entries, *count, sizeof(Entry), byCount);
+    return entries;
+}
+
+// index holds length opcodes in base OP_COUNT, the first one most significant
+static void decode(int index, int length, int* ops) {
+    for (int i = length - 1; i >= 0; i--) {
+        ops[i] = index % OP_COUNT;
+        index /= OP_COUNT;
+    }
+}
+
+static double percent(uint64_t count) {
+    return profile.total ? 100.0 * count / profile.total : 0;
+}
+
+static void reportSequences(FILE* out, const char* title, const uint64_t* counts, int length) {
+    int size = length == 2 ? OP_COUNT * OP_COUNT : OP_COUNT * OP_COUNT * OP_COUNT;
+    int count;
+    Entry* entries = sortCounts(counts, size, &count);
+    fprintf(out, "== Top %d opcode %s ==\n", PROFILE_TOP, title);
+    for (int i = 0; i < count && i < PROFILE_TOP; i++) {
+        int ops[3];
+        decode(entries[i].index, length, ops);
+        fprintf(out, "%14" PRIu64 " %6.2f%% ", entries[i].count, percent(entries[i].count));
+        for (int k = 0; k < length; k++) {
+            fprintf(out, " %s", opName(ops[k]));
+        }
+        fprintf(out, "\n");
+    }
+    free(entries);
+}
+
+void profileReport(FILE* out) {
+    if (!profile.counts) {
+        return;
+    }
+    int count;
+    Entry* entries = sortCounts(profile.counts, OP_COUNT, &count);
+    fprintf(out, "== Opcode profile, %" PRIu64 " instructions ==\n", profile.total);
+    fprintf(out, "%-18s %14s %7s %12s\n", "opcode", "count", "%", TICK_UNIT "/op");
+    for (int i = 0; i < count; i++) {
+        int op = entries[i].index;
+        fprintf(out, "%-18s %14" PRIu64 " %6.2f%% ", opName(op), entries[i].count, percent(entries[i].count));
+        if (profile.timed[op] > 0) {
+            fprintf(out, "%12.1f\n", (double)profile.ticks[op] / profile.timed[op]);
+        } else {
+            fprintf(out, "%12s\n", "-");
+        }
+    }
+    free(entries);
+    reportSequences(out, "pairs", profile.pairs, 2);
+    reportSequences(out, "triples", profile.triples, 3);
+}
+
+static void jsonSequences(FILE* out, const char* key, const uint64_t* counts, int length) {
+    int size = length == 2 ? OP_COUNT * OP_COUNT : OP_COUNT * OP_COUNT * OP_COUNT;
+    int count;
+    Entry* entries = sortCounts(counts, size, &count);
+    fprintf(out, "  \"%s\": [", key);
+    for (int i = 0; i < count; i++) {
+        int ops[3];
+        decode(entries[i].index, length, ops);
+        fprintf(out, "%s\n    {\"ops\": [", i ? "," : "");
+        for (int k = 0; k < length; k++) {
+            fprintf(out, "%s\"%s\"", k ? ", " : "", opName(ops[k]));
+        }
+        fprintf(out, "], \"count\": %" PRIu64 "}", entries[i].count);
+    }
+    fprintf(out, "\n  ]");
+    free(entries);
+}
+
+bool profileReportJson(const char* path) {
+    if (!profile.counts) {
+        return true;
+    }
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    int count;
+    Entry* entries = sortCounts(profile.counts, OP_COUNT, &count);
+    fprintf(out, "{\n  \"total\": %" PRIu64 ",\n  \"tick_unit\": \"%s\",\n", profile.total, TICK_UNIT);
+    fprintf(out, "  \"ops\": [");
+    for (int i = 0; i < count; i++) {
+        int op = entries[i].index;
+        fprintf(out, "%s\n    {\"op\": \"%s\", \"count\": %" PRIu64 ", \"timed\": %" PRIu64 ", \"ticks\": %" PRIu64 "}",
+                i ? "," : "", opName(op), entries[i].count, profile.timed[op], profile.ticks[op]);
+    }
+    fprintf(out, "\n  ],\n");
+    free(entries);
+    jsonSequences(out, "pairs", profile.pairs, 2);
+    fprintf(out, ",\n");
+    jsonSequences(out, "triples", profile.triples, 3);
+    fprintf(out, "\n}\n");
+    return fclose(out) == 0;
+}
+
+void profileLinesReport(FILE* out, const char* name, const char* source) {
+    uint64_t instructions = 0, bytes = 0;
+    for (int i = 0; i < lines.capacity; i++) {
+        instructions += lines.instructions[i];
+        bytes += lines.bytes[i];
+    }
+    fprintf(out, "== %s: %" PRIu64 " instructions, %" PRIu64 " bytes allocated ==\n", name, instructions, bytes);
+    fprintf(out, "%14s %12s %6s\n", "instructions", "bytes", "line");
+    int line = 1;
+    for (const char* start = source; *start; line++) {
+        const char* end = strchr(start, '\n');
+        int length = end ? (int)(end - start) : (int)strlen(start);
+        uint64_t count = line < lines.capacity ? lines.instructions[line] : 0;
+        uint64_t allocated = line < lines.capacity ? lines.bytes[line] : 0;
+        if (count || allocated) {
+            fprintf(out, "%14" PRIu64 " %12" PRIu64 " %6d: %.*s\n", count, allocated, line, length, start);
+        } else {
+            fprintf(out, "%14s %12s %6d: %.*s\n", "-", "-", line, length, start);
+        }
+        start += end ? length + 1 : length;
+    }
+    if (lines.capacity > 0) {
+        memset(lines.instructions, 0, sizeof(uint64_t) * lines.capacity);
+        memset(lines.bytes, 0, sizeof(uint64_t) * lines.capacity);
+    }
+}
+
+static int byBytes(const void* a, const void* b) {
+    const KeyEntry* x = a;
+    const KeyEntry* y = b;
+    if (x->bytes != y->bytes) {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return strcmp(x->key, y->key);
+}
+
+static void countString(hashmap_t* map, size_t index, Value key, Value value, void* data) {
+    heap.strings++;
+    heap.stringBytes += sizeof(ObjString) + AS_STRING(key)->length + 1;
+}
+
+void profileStrings(hashmap_t* strings) {
+    hashmap_iter(strings, countString, NULL);
+    heap.stringSlots += strings->capacity;
+}
+
+void profileHeapReport(FILE* out) {
+    fprintf(out, "== Heap: %" PRIu64 " bytes in %" PRIu64 " allocations, peak %" PRIu64 " bytes live, %" PRIu64 " at exit ==\n",
+            heap.allocated, heap.allocations, heap.peak, heap.live);
+    fprintf(out, "%-18s %12s %14s\n", "type", "objects", "bytes");
+    for (int type = 0; type <= OBJ_MATRIX_ROW; type++) {
+        if (heap.objects[type]) {
+            fprintf(out, "%-18s %12" PRIu64 " %14" PRIu64 "\n", objTypeNames[type], heap.objects[type], heap.objectBytes[type]);
+        }
+    }
+    fprintf(out, "== Top %d allocation sites ==\n", PROFILE_TOP);
+    fprintf(out, "%12s %14s  %s\n", "objects", "bytes", "site");
+    KeyEntry* sorted = sortKeys(&sites, byBytes);
+    for (int i = 0; i < sites.count && i < PROFILE_TOP; i++) {
+        fprintf(out, "%12" PRIu64 " %14" PRIu64 "  %s\n", sorted[i].count, sorted[i].bytes, sorted[i].key);
+    }
+    free(sorted);
+    fprintf(out, "== Interned strings: %" PRIu64 " strings, %" PRIu64 " bytes, %" PRIu64 " table slots ==\n",
+            heap.strings, heap.stringBytes, heap.stringSlots);
+}
+
+// What the object itself takes, with the buffers it owns
+static size_t objectSize(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_NEVER: return 0;
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_NATIVE: return sizeof(ObjNative);
+        case OBJ_STRING: return sizeof(ObjString) + ((ObjString*)obj)->length + 1;
+        case OBJ_STRING_VIEW: return sizeof(ObjStringView);
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)obj;
+            return sizeof(ObjArray) + (array->borrowed ? 0 : sizeof(Value) * array->capacity);
+        }
+        case OBJ_HASHMAP: {
+            ObjHashmap* hashmap = (ObjHashmap*)obj;
+            return sizeof(ObjHashmap) + (hashmap->borrowed ? 0 : sizeof(hashmap_item) * hashmap->map.capacity);
+        }
+        case OBJ_BIGINT: return sizeof(ObjBigInt) + sizeof(uint64_t) * ((ObjBigInt*)obj)->length;
+        case OBJ_MATRIX: {
+            ObjMatrix* matrix = (ObjMatrix*)obj;
+            size_t element = matrix->isComplex ? sizeof(double complex) : sizeof(double);
+            return sizeof(ObjMatrix) + element * matrix->rows * matrix->cols;
+        }
+        case OBJ_MATRIX_ROW: return sizeof(ObjMatrixRow);
+    }
+    return 0;
+}
+
+static void writeReference(FILE* out, Value value) {
+    if (IS_OBJ(value)) {
+        fprintf(out, " %p", (void*)AS_OBJ(value));
+    }
+}
+
+static void writeEntry(hashmap_t* map, size_t index, Value key, Value value, void* data) {
+    writeReference(data, key);
+    writeReference(data, value);
+}
+
+static void writeRoot(hashmap_t* map, size_t index, Value key, Value value, void* data) {
+    if (IS_OBJ(value)) {
+        fprintf(data, "root %p global %s\n", (void*)AS_OBJ(value), AS_CSTRING(key));
+    }
+}
+
+bool profileHeapSnapshot(const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    fprintf(out, "# root ADDRESS global NAME | root ADDRESS stack SLOT | ADDRESS TYPE BYTES REFERENCES...\n");
+    hashmap_iter(&vm.globals, writeRoot, out);
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        if (IS_OBJ(*slot)) {
+            fprintf(out, "root %p stack %d\n", (void*)AS_OBJ(*slot), (int)(slot - vm.stack));
+        }
+    }
+    for (Obj* obj = vm.objects; obj; obj = obj->next) {
+        fprintf(out, "%p %s %zu", (void*)obj, objTypeNames[obj->type], objectSize(obj));
+        switch (obj->type) {
+            case OBJ_FUNCTION: {
+                ObjFunction* function = (ObjFunction*)obj;
+                if (function->name) {
+                    fprintf(out, " %p", (void*)function->name);
+                }
+                for (int i = 0; i < function->chunk.constants.count; i++) {
+                    writeReference(out, function->chunk.constants.values[i]);
+                }
+                break;
+            }
+            case OBJ_NATIVE:
+                fprintf(out, " %p", (void*)((ObjNative*)obj)->name);
+                break;
+            case OBJ_STRING_VIEW:
+                fprintf(out, " %p", (void*)((ObjStringView*)obj)->origin);
+                break;
+            case OBJ_ARRAY: {
+                ObjArray* array = (ObjArray*)obj;
+                for (size_t i = 0; i < array->length; i++) {
+                    writeReference(out, array->values[i]);
+                }
+                break;
+            }
+            case OBJ_HASHMAP:
+                hashmap_iter(&((ObjHashmap*)obj)->map, writeEntry, out);
+                break;
+            case OBJ_MATRIX: {
+                ObjMatrix* matrix = (ObjMatrix*)obj;
+                for (size_t row = 0; matrix->rowViews && row < matrix->rows; row++) {
+                    if (matrix->rowViews[row]) {
+                        fprintf(out, " %p", (void*)matrix->rowViews[row]);
+                    }
+                }
+                break;
+            }
+            case OBJ_MATRIX_ROW:
+                fprintf(out, " %p", (void*)((ObjMatrixRow*)obj)->matrix);
+                break;
+            case OBJ_NEVER:
+            case OBJ_STRING:
+            case OBJ_BIGINT:
+                break;
+        }
+        fprintf(out, "\n");
+    }
+    return fclose(out) == 0;
+}
+
+static int byKey(const void* a, const void* b) {
+    return strcmp(((const KeyEntry*)a)->key, ((const KeyEntry*)b)->key);
+}
+
+bool profileStacksWrite(const char* path) {
+    struct itimerval off = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &off, NULL);
+    signal(SIGPROF, SIG_DFL);
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+    // Sorted like flamegraph.pl would, so runs diff cleanly
+    KeyEntry* sorted = sortKeys(&stacks, byKey);
+    for (int i = 0; i < stacks.count; i++) {
+        fprintf(out, "%s %" PRIu64 "\n", sorted[i].key, sorted[i].count);
+    }
+    free(sorted);
+    return fclose(out) == 0;
+}
+
+uint64_t profileInstructions(void) {
+    return profile.total;
+}
+
+void profileAllocations(uint64_t* count, uint64_t* bytes) {
+    *count = heap.allocations;
+    *bytes = heap.allocated;
+}
+
+void profileMapReport(FILE* out, const char* name, hashmap_t* map) {
+    hashmap_stats_t stats;
+    hashmap_stats(map, &stats);
+    fprintf(out, "== Hashmap %s: %zu keys in %zu slots, load %.2f, probes mean %.2f max %zu, %zu grows, %zu failed adds ==\n",
+            name, stats.total, stats.capacity, stats.load, stats.mean_probe, stats.max_probe, stats.grows, stats.failed_adds);
+    fprintf(out, "%6s %10s\n", "probe", "keys");
+    for (size_t i = 0; i <= stats.max_probe; i++) {
+        fprintf(out, "%6zu %10zu\n", i, stats.probes[i]);
+    }
+}
+
+bool profileEventsStart(const char* path) {
+    events.out = fopen(path, "w");
+    if (!events.out) {
+        return false;
+    }
+    events.buffer = malloc(EVENTS_BUFFER);
+    setvbuf(events.out, events.buffer, _IOFBF, EVENTS_BUFFER);
+    fputs("{\"traceEvents\":[\n", events.out);
+    events.origin = profileNanos();
+    return true;
+}
+
+void profileEventsThreshold(double micros) {
+    events.threshold = micros > 0 ? (uint64_t)(micros * 1000) : 0;
+}
+
+void profileEnter(const char* name, const char* category) {
+    if (events.depth == events.capacity) {
+        events.capacity = events.capacity ? events.capacity * 2 : 64;
+        events.spans = realloc(events.spans, sizeof(Span) * events.capacity);
+    }
+    events.spans[events.depth++] = (Span){name, category, profileNanos()};
+}
+
+void profileLeave(void) {
+    if (events.depth == 0) {
+        return;
+    }
+    uint64_t end = profileNanos();
+    Span* span = &events.spans[--events.depth];
+    uint64_t duration = end - span->start;
+    if (duration < events.threshold) {
+        return;
+    }
+    // Names are Lox identifiers or fixed, nothing to escape
+    fprintf(events.out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+            events.written ? ",\n" : "", span->name, span->category,
+            (span->start - events.origin) / 1000.0, duration / 1000.0);
+    events.written++;
+}
+
+void profileLeaveAll(void) {
+    while (events.depth > 0) {
+        profileLeave();
+    }
+}
+
+bool profileEventsWrite(void) {
+    profileLeaveAll();
+    fputs("\n],\"displayTimeUnit\":\"ns\"}\n", events.out);
+    bool ok = fclose(events.out) == 0;
+    free(events.buffer);
+    free(events.spans);
+    events = (Events){0};
+    return ok;
+}
+
+void profileFree(void) {
+    freeKeys(&stacks);
+    freeKeys(&sites);
+    heap = (Heap){0};
+    free(scratch);
+    scratch = NULL;
+    scratchCapacity = 0;
+    free(lines.instructions);
+    free(lines.bytes);
+    lines = (Lines){0};
+    free(profile.counts);
+    free(profile.pairs);
+    free(profile.triples);
+    free(profile.ticks);
+    free(profile.timed);
+    profile = (Profile){0};
+}
@@ -0,0 +1,58 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "hashmap.h"
+#include "object.h"
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t profileNanos(void);
+// Allocates the counters, PROFILE_OPS must be set too for run() to count
+void profileStart(void);
+// Starts the SIGPROF timer, PROFILE_STACKS must be set too for run() to take the samples
+bool profileStacksStart(void);
+// Called by run() before executing each instruction while HOOK_PROFILE is on, frame->ip must be saved
+void profileOp(OpCode op);
+// Each SIGUSR1 toggles these hooks, see setHooks()
+bool profileHooksOnSignal(int hooks);
+// Called when PROFILING is set by reallocate(), and for array buffers which bypass it
+void profileRealloc(size_t oldSize, size_t newSize);
+// Called by allocateObj() when PROFILE_HEAP is set, profileRealloc() counts the bytes too
+void profileObject(ObjType type, size_t size);
+// Sorted tables of opcodes, pairs and triples
+void profileReport(FILE* out);
+// The same data as JSON, returns false if path could not be written
+bool profileReportJson(const char* path);
+// Stops the timer and writes one line per distinct call stack, folded for flame graph tools
+bool profileStacksWrite(const char* path);
+// Writes source annotated with what ran on each of its lines since the last call, then starts over
+void profileLinesReport(FILE* out, const char* name, const char* source);
+// Called by freeVM() when PROFILE_HEAP is set, before the string table goes away
+void profileStrings(hashmap_t* strings);
+// Totals, objects by type, the top allocation sites and the interned strings
+void profileHeapReport(FILE* out);
+// Writes the roots, then every object with its size and the objects it references
+bool profileHeapSnapshot(const char* path);
+// Instructions counted so far, 0 unless PROFILE_OPS is set
+uint64_t profileInstructions(void);
+// Allocations and bytes allocated so far, 0 unless PROFILE_HEAP is set
+void profileAllocations(uint64_t* count, uint64_t* bytes);
+// Load, probe length histogram, grows and failed adds of map
+void profileMapReport(FILE* out, const char* name, hashmap_t* map);
+// Opens path for Chrome trace event JSON, PROFILE_EVENTS must be set too for anything to be recorded
+bool profileEventsStart(const char* path);
+// Spans shorter than this are not written
+void profileEventsThreshold(double micros);
+// Begins a span, names must stay valid until it ends
+void profileEnter(const char* name, const char* category);
+// Ends the innermost span
+void profileLeave(void);
+// Ends every span, after a runtime error unwound them all
+void profileLeaveAll(void);
+// Ends what is still running and closes the file
+bool profileEventsWrite(void);
+void profileFree(void);
+
+#endif
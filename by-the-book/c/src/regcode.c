@@ -0,0 +1,728 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "regcode.h"
+#include "jit.h"
+#include "trace.h"
+#include "memory.h"
+#include "print.h"
+
+// Lowering from stack bytecode to register code.
+//
+// The stack VM keeps locals and temporaries in frame->slots, so stack depth d
+// becomes register d. Pushes of locals and constants are delayed: the virtual
+// stack records which register or constant each entry holds, and an entry is
+// only copied into its own register when something needs it there (calls,
+// literals, jumps). Arithmetic then reads its operands straight from the
+// locals and constants, and `i = i + 1` becomes a single ADD into i.
+
+typedef struct {
+    int instr;  // Jump instruction to patch
+    int target; // Bytecode offset it goes to
+} JumpPatch;
+
+typedef struct {
+    ObjFunction* function;
+    Chunk* chunk;
+    RegCode* reg;
+    uint16_t* stack; // Virtual stack, stack[e] == e once entry e is in its register
+    int depth;
+    int* labelDepth; // Stack depth at each jump target, -1 until a jump reaches it
+    int* labelInstr; // First register instruction of each jump target, -1 until lowered
+    int* jumpCount;  // Jumps to each offset
+    int* previous;   // Start of the instruction before each instruction start
+    bool* skipPop;   // Target of a fused compare-and-jump, its POP already happened
+    JumpPatch* patches;
+    int patchCount;
+    int patchCapacity;
+    int producer; // Instruction that wrote the top temporary, -1 if none
+    int extras;   // First constant past the chunk's own
+    bool failed;
+} Lowering;
+
+static int read24(const Chunk* chunk, int offset) {
+    return chunk->code[offset] | chunk->code[offset + 1] << 8 | chunk->code[offset + 2] << 16;
+}
+
+static int emit(Lowering* low, RegOp op, int a, int b, int c, int offset) {
+    RegCode* reg = low->reg;
+    if (reg->count == UINT16_MAX) { // Jump targets are 16 bits
+        low->failed = true;
+        return 0;
+    }
+    if (reg->capacity < reg->count + 1) {
+        int old = reg->capacity;
+        reg->capacity = GROW_CAPACITY(old);
+        reg->code = GROW_ARRAY(RegInstr, reg->code, old, reg->capacity);
+        reg->offsets = GROW_ARRAY(int, reg->offsets, old, reg->capacity);
+    }
+    reg->code[reg->count] = (RegInstr){op, a, b, c};
+    reg->offsets[reg->count] = offset;
+    low->producer = -1;
+    return reg->count++;
+}
+
+static uint16_t constantOperand(Lowering* low, int index) {
+    if (index > REG_MAX) {
+        low->failed = true;
+        return REG_K;
+    }
+    return REG_K | index;
+}
+
+// nil, true and friends have no chunk constant, they are appended once each
+static uint16_t extraConstant(Lowering* low, Value value) {
+    RegCode* reg = low->reg;
+    for (int i = low->extras; i < reg->constantCount; i++) {
+        Value other = reg->constants[i];
+        if (other.type == value.type && memcmp(&other.as, &value.as, sizeof(value.as)) == 0) {
+            return constantOperand(low, i);
+        }
+    }
+    if (reg->constantCapacity < reg->constantCount + 1) {
+        int old = reg->constantCapacity;
+        reg->constantCapacity = GROW_CAPACITY(old);
+        reg->constants = GROW_ARRAY(Value, reg->constants, old, reg->constantCapacity);
+    }
+    reg->constants[reg->constantCount] = value;
+    return constantOperand(low, reg->constantCount++);
+}
+
+static void pushOperand(Lowering* low, uint16_t operand) {
+    if (low->depth > REG_MAX) {
+        low->failed = true;
+        return;
+    }
+    low->stack[low->depth++] = operand;
+    if (low->depth > low->reg->registers) {
+        low->reg->registers = low->depth;
+    }
+}
+
+static uint16_t popOperand(Lowering* low) {
+    if (low->depth == 0) {
+        low->failed = true;
+        return REG_K;
+    }
+    return low->stack[--low->depth];
+}
+
+// Result of instr goes to the register at the current depth
+static void pushTemp(Lowering* low, int instr) {
+    pushOperand(low, low->depth);
+    low->producer = instr;
+}
+
+static void materialize(Lowering* low, int entry, int offset) {
+    if (low->stack[entry] != entry) {
+        emit(low, REG_MOVE, entry, low->stack[entry], 0, offset);
+        low->stack[entry] = entry;
+    }
+}
+
+static void materializeFrom(Lowering* low, int base, int offset) {
+    if (base < 0) {
+        low->failed = true;
+        return;
+    }
+    for (int e = base; e < low->depth; e++) {
+        materialize(low, e, offset);
+    }
+}
+
+// Both sides of a jump agree on where values live: everything in its own register
+static void flush(Lowering* low, int offset) {
+    materializeFrom(low, 0, offset);
+}
+
+// The first jump to a target decides its depth, the others must agree
+static void recordLabel(Lowering* low, int target, int depth) {
+    if (target < 0 || target >= low->chunk->count) {
+        low->failed = true;
+    } else if (low->labelDepth[target] == -1) {
+        low->labelDepth[target] = depth;
+    } else if (low->labelDepth[target] != depth) {
+        low->failed = true;
+    }
+}
+
+static void jumpTo(Lowering* low, int instr, int target) {
+    if (low->patchCapacity < low->patchCount + 1) {
+        int old = low->patchCapacity;
+        low->patchCapacity = GROW_CAPACITY(old);
+        low->patches = GROW_ARRAY(JumpPatch, low->patches, old, low->patchCapacity);
+    }
+    low->patches[low->patchCount++] = (JumpPatch){instr, target};
+}
+
+// `a < b` followed by a JUMP_IF_FALSE that pops on both sides becomes one compare-and-jump.
+// The other side's POP must only be reachable through this jump.
+static bool fuseCompare(Lowering* low, int next, int target, int offset) {
+    Chunk* chunk = low->chunk;
+    RegCode* reg = low->reg;
+    if (low->producer == -1 || low->producer != reg->count - 1
+            || low->stack[low->depth - 1] != low->depth - 1) {
+        return false;
+    }
+    RegInstr compare = reg->code[low->producer];
+    RegOp fused;
+    switch (compare.op) {
+        case REG_EQUAL: fused = REG_JUMP_IF_NOT_EQUAL; break;
+        case REG_GREATER: fused = REG_JUMP_IF_NOT_GREATER; break;
+        case REG_LESS: fused = REG_JUMP_IF_NOT_LESS; break;
+        default: return false;
+    }
+    if (next >= chunk->count || chunk->code[next] != OP_POP
+            || target >= chunk->count || chunk->code[target] != OP_POP
+            || low->jumpCount[target] != 1 || low->labelDepth[target] != -1) {
+        return false;
+    }
+    int before = low->previous[target];
+    if (before < 0 || (chunk->code[before] != OP_JUMP && chunk->code[before] != OP_NEG_JUMP)) {
+        return false;
+    }
+    reg->count--;
+    low->depth--;
+    flush(low, offset);
+    jumpTo(low, emit(low, fused, 0, compare.b, compare.c, offset), target);
+    recordLabel(low, target, low->depth);
+    low->skipPop[target] = true;
+    return true;
+}
+
+static void setLocal(Lowering* low, int slot, int offset) {
+    if (slot >= low->depth - 1) {
+        low->failed = true;
+        return;
+    }
+    int top = low->depth - 1;
+    uint16_t value = low->stack[top];
+    int producer = low->producer;
+    bool shared = false;
+    // Entries still reading the old value of the local get their own copy first
+    for (int e = 0; e < top; e++) {
+        if (e != slot && low->stack[e] == slot) {
+            materialize(low, e, offset);
+            shared = true;
+        }
+    }
+    if (!shared && producer != -1 && producer == low->reg->count - 1 && value == top) {
+        low->reg->code[producer].a = slot;
+    } else {
+        emit(low, REG_MOVE, slot, value, 0, offset);
+    }
+    low->stack[slot] = slot;
+    low->stack[top] = slot;
+    low->producer = -1;
+}
+
+static RegOp binaryOp(OpCode op) {
+    switch (op) {
+        case OP_ADD: return REG_ADD;
+        case OP_SUB: return REG_SUB;
+        case OP_MUL: return REG_MUL;
+        case OP_DIV: return REG_DIV;
+        case OP_REMAINDER: return REG_REMAINDER;
+        case OP_EXP: return REG_EXP;
+        case OP_BITAND: return REG_BITAND;
+        case OP_BITOR: return REG_BITOR;
+        case OP_BITXOR: return REG_BITXOR;
+        case OP_LEFT_SHIFT: return REG_LEFT_SHIFT;
+        case OP_RIGHT_SHIFT: return REG_RIGHT_SHIFT;
+        case OP_EQUAL: return REG_EQUAL;
+        case OP_GREATER: return REG_GREATER;
+        case OP_LESS: return REG_LESS;
+        case OP_SUBSCRIPT: return REG_SUBSCRIPT;
+        default: return REG_MOVE;
+    }
+}
+
+// Returns where lowering continues, past the POP a fused jump already did
+static int lowerInstruction(Lowering* low, int offset, int next) {
+    Chunk* chunk = low->chunk;
+    int at = offset;
+    bool wide = chunk->code[at] == OP_WIDE;
+    if (wide) {
+        at++;
+    }
+    OpCode op = chunk->code[at];
+    int arg = 0;
+    if (next - at > 1) {
+        arg = next - at == 2 ? chunk->code[at + 1] : read24(chunk, at + 1);
+    }
+    int depth = low->depth;
+    switch (op) {
+        case OP_INVALID:
+        case OP_SWAP: // Never emitted by the compiler
+        case OP_WIDE:
+            low->failed = true;
+            return next;
+        case OP_RETURN:
+            emit(low, REG_RETURN, 0, popOperand(low), 0, offset);
+            return next;
+        case OP_PRINT:
+            emit(low, REG_PRINT, 0, popOperand(low), 0, offset);
+            return next;
+        case OP_POP:
+            popOperand(low);
+            return next;
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            int base = depth - arg - 1;
+            materializeFrom(low, base, offset);
+            if (low->failed) {
+                return next;
+            }
+            // Not a producer, a is the callee as well as the result
+            emit(low, op == OP_TAIL_CALL ? REG_TAIL_CALL : REG_CALL, base, arg, 0, offset);
+            low->depth = base;
+            pushOperand(low, base);
+            return next;
+        }
+        case OP_CALL_BUILTIN:
+        case OP_TYPEOF:
+        case OP_ARRAY_SET:
+        case OP_ARRAY_POP: {
+            // The dedicated instructions are builtins with a fixed argument count here
+            int index = BUILTIN_TYPE, argCount = 1;
+            if (op == OP_CALL_BUILTIN) {
+                index = chunk->code[at + 1];
+                argCount = chunk->code[at + 2];
+            } else if (op == OP_ARRAY_SET) {
+                index = BUILTIN_SET_ARRAY;
+                argCount = 3;
+            } else if (op == OP_ARRAY_POP) {
+                index = BUILTIN_RM_ARRAY_TOP;
+            }
+            int base = depth - argCount;
+            materializeFrom(low, base, offset);
+            if (low->failed) {
+                return next;
+            }
+            // Not a producer either, the arguments are read from a
+            emit(low, REG_CALL_BUILTIN, base, argCount, index, offset);
+            low->depth = base;
+            pushOperand(low, base);
+            return next;
+        }
+        case OP_DEFINE_GLOBAL: {
+            uint16_t name = constantOperand(low, arg);
+            emit(low, REG_DEFINE_GLOBAL, name, popOperand(low), 0, offset);
+            return next;
+        }
+        case OP_GET_GLOBAL:
+            pushTemp(low, emit(low, REG_GET_GLOBAL, depth, constantOperand(low, arg), 0, offset));
+            return next;
+        case OP_SET_GLOBAL:
+            if (depth == 0) {
+                low->failed = true;
+                return next;
+            }
+            emit(low, REG_SET_GLOBAL, constantOperand(low, arg), low->stack[depth - 1], 0, offset);
+            return next;
+        case OP_GET_LOCAL:
+            if (arg >= depth) {
+                low->failed = true;
+                return next;
+            }
+            materialize(low, arg, offset);
+            pushOperand(low, arg);
+            return next;
+        case OP_SET_LOCAL:
+            setLocal(low, arg, offset);
+            return next;
+        case OP_JUMP_IF_FALSE: {
+            if (depth == 0) {
+                low->failed = true;
+                return next;
+            }
+            int target = next + arg;
+            if (fuseCompare(low, next, target, offset)) {
+                return next + 1;
+            }
+            flush(low, offset);
+            jumpTo(low, emit(low, REG_JUMP_IF_FALSE, 0, depth - 1, 0, offset), target);
+            recordLabel(low, target, depth);
+            return next;
+        }
+        case OP_JUMP: {
+            flush(low, offset);
+            jumpTo(low, emit(low, REG_JUMP, 0, 0, 0, offset), next + arg);
+            recordLabel(low, next + arg, depth);
+            return next;
+        }
+        case OP_NEG_JUMP: {
+            int target = next - arg;
+            flush(low, offset);
+            if (target < 0 || target >= chunk->count
+                    || low->labelInstr[target] == -1 || low->labelDepth[target] != depth) {
+                low->failed = true;
+                return next;
+            }
+            emit(low, REG_JUMP, low->labelInstr[target], 0, 0, offset);
+            return next;
+        }
+        case OP_CONSTANT: pushOperand(low, constantOperand(low, arg)); return next;
+        case OP_NIL: pushOperand(low, extraConstant(low, NIL_VAL)); return next;
+        case OP_TRUE: pushOperand(low, extraConstant(low, BOOL_VAL(true))); return next;
+        case OP_FALSE: pushOperand(low, extraConstant(low, BOOL_VAL(false))); return next;
+        case OP_NAN: pushOperand(low, extraConstant(low, DOUBLE_VAL(NAN))); return next;
+        case OP_INF: pushOperand(low, extraConstant(low, DOUBLE_VAL(INFINITY))); return next;
+        case OP_BUILD_ARRAY:
+        case OP_BUILD_HASHMAP: {
+            int base = depth - (op == OP_BUILD_ARRAY ? arg : 2 * arg);
+            materializeFrom(low, base, offset);
+            if (low->failed) {
+                return next;
+            }
+            emit(low, op == OP_BUILD_ARRAY ? REG_BUILD_ARRAY : REG_BUILD_HASHMAP, base, arg, 0, offset);
+            low->depth = base;
+            pushOperand(low, base);
+            return next;
+        }
+        case OP_APPEND_ARRAY:
+        case OP_APPEND_HASHMAP: {
+            int base = depth - (op == OP_APPEND_ARRAY ? arg : 2 * arg) - 1;
+            materializeFrom(low, base, offset);
+            if (low->failed) {
+                return next;
+            }
+            emit(low, op == OP_APPEND_ARRAY ? REG_APPEND_ARRAY : REG_APPEND_HASHMAP, base, arg, 0, offset);
+            low->depth = base + 1;
+            return next;
+        }
+        case OP_COPY_CONSTANT:
+            pushTemp(low, emit(low, REG_COPY_CONSTANT, depth, constantOperand(low, arg), 0, offset));
+            return next;
+        case OP_NEG: {
+            // Same as the stack VM, a multiplication by -1
+            uint16_t value = popOperand(low);
+            uint16_t minusOne = extraConstant(low, INTEGER_VAL(-1));
+            pushTemp(low, emit(low, REG_MUL, low->depth, value, minusOne, offset));
+            return next;
+        }
+        case OP_NOT:
+        case OP_BITNEG:
+        case OP_SIZE: {
+            RegOp unary = op == OP_NOT ? REG_NOT : op == OP_BITNEG ? REG_BITNEG : REG_SIZE;
+            uint16_t value = popOperand(low);
+            pushTemp(low, emit(low, unary, low->depth, value, 0, offset));
+            return next;
+        }
+        case OP_SUBSCRIPT:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_REMAINDER:
+        case OP_EXP:
+        case OP_BITAND:
+        case OP_BITOR:
+        case OP_BITXOR:
+        case OP_LEFT_SHIFT:
+        case OP_RIGHT_SHIFT:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS: {
+            uint16_t b = popOperand(low);
+            uint16_t a = popOperand(low);
+            pushTemp(low, emit(low, binaryOp(op), low->depth, a, b, offset));
+            return next;
+        }
+    }
+    low->failed = true;
+    return next;
+}
+
+static bool lower(Lowering* low) {
+    Chunk* chunk = low->chunk;
+    int count = chunk->count;
+    // Find jump targets and instruction boundaries first
+    int last = -1;
+    for (int offset = 0; offset < count;) {
+        int length = instructionLength(chunk, offset);
+        if (offset + length > count) {
+            return false;
+        }
+        int at = chunk->code[offset] == OP_WIDE ? offset + 1 : offset;
+        int next = offset + length;
+        int target = -1;
+        if (chunk->code[at] == OP_JUMP || chunk->code[at] == OP_JUMP_IF_FALSE) {
+            target = next + read24(chunk, at + 1);
+        } else if (chunk->code[at] == OP_NEG_JUMP) {
+            target = next - read24(chunk, at + 1);
+        }
+        if (target != -1) {
+            if (target < 0 || target >= count) {
+                return false;
+            }
+            low->jumpCount[target]++;
+        }
+        low->previous[offset] = last;
+        last = offset;
+        offset = next;
+    }
+
+    bool live = true;
+    int deadDepth = 0; // Depth where the last unconditional jump or return left
+    for (int offset = 0; offset < count && !low->failed;) {
+        int next = offset + instructionLength(chunk, offset);
+        if (low->jumpCount[offset] > 0) {
+            if (live) {
+                flush(low, offset);
+                recordLabel(low, offset, low->depth);
+            } else {
+                // Only reachable through jumps, their depth says what is on the stack.
+                // A loop's increment clause is only jumped to from below, assume it
+                // starts where the code above left off, the backward jump checks that.
+                live = true;
+                if (low->labelDepth[offset] == -1) {
+                    low->labelDepth[offset] = deadDepth;
+                }
+                low->depth = low->labelDepth[offset];
+                for (int e = 0; e < low->depth; e++) {
+                    low->stack[e] = e;
+                }
+            }
+            low->labelInstr[offset] = low->reg->count;
+            low->producer = -1;
+            if (low->skipPop[offset]) {
+                if (low->depth != low->labelDepth[offset]) {
+                    return false;
+                }
+                offset = next;
+                continue;
+            }
+        }
+        if (!live) {
+            offset = next;
+            continue;
+        }
+        OpCode op = chunk->code[offset];
+        live = !(op == OP_JUMP || op == OP_NEG_JUMP || op == OP_RETURN);
+        offset = lowerInstruction(low, offset, next);
+        deadDepth = low->depth;
+    }
+    if (low->failed) {
+        return false;
+    }
+    for (int i = 0; i < low->patchCount; i++) {
+        int target = low->labelInstr[low->patches[i].target];
+        if (target == -1) {
+            return false;
+        }
+        low->reg->code[low->patches[i].instr].a = target;
+    }
+    return true;
+}
+
+RegCode* lowerFunction(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    RegCode* reg = ALLOCATE(RegCode, 1);
+    *reg = (RegCode){0};
+    // Slot 0 holds the function itself, then its parameters
+    reg->registers = function->arity + 1;
+    reg->constantCount = chunk->constants.count;
+    reg->constantCapacity = chunk->constants.count;
+    reg->constants = ALLOCATE(Value, reg->constantCapacity);
+    if (chunk->constants.count > 0) {
+        memcpy(reg->constants, chunk->constants.values, chunk->constants.count * sizeof(Value));
+    }
+
+    int count = chunk->count;
+    Lowering low = {0};
+    low.function = function;
+    low.chunk = chunk;
+    low.reg = reg;
+    low.producer = -1;
+    low.extras = reg->constantCount;
+    // Every instruction pushes at most one value
+    low.stack = ALLOCATE(uint16_t, count + function->arity + 1);
+    low.labelDepth = ALLOCATE(int, count);
+    low.labelInstr = ALLOCATE(int, count);
+    low.jumpCount = ALLOCATE(int, count);
+    low.previous = ALLOCATE(int, count);
+    low.skipPop = ALLOCATE(bool, count);
+    for (int i = 0; i < count; i++) {
+        low.labelDepth[i] = -1;
+        low.labelInstr[i] = -1;
+        low.jumpCount[i] = 0;
+        low.previous[i] = -1;
+        low.skipPop[i] = false;
+    }
+    for (int i = 0; i <= function->arity; i++) {
+        pushOperand(&low, i);
+    }
+
+    bool ok = count > 0 && lower(&low);
+
+    FREE_ARRAY(uint16_t, low.stack, count + function->arity + 1);
+    FREE_ARRAY(int, low.labelDepth, count);
+    FREE_ARRAY(int, low.labelInstr, count);
+    FREE_ARRAY(int, low.jumpCount, count);
+    FREE_ARRAY(int, low.previous, count);
+    FREE_ARRAY(bool, low.skipPop, count);
+    FREE_ARRAY(JumpPatch, low.patches, low.patchCapacity);
+    if (!ok) {
+        freeRegCode(reg);
+        return NULL;
+    }
+    return reg;
+}
+
+void lowerFunctions(ObjFunction* function) {
+    if (function->reg) {
+        return;
+    }
+    function->reg = lowerFunction(function);
+    if (DEBUG_TRACE && function->reg) {
+        disRegCode(function->reg, function->name ? function->name->chars : "<script>");
+    }
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) {
+            lowerFunctions(AS_FUNCTION(constants->values[i]));
+        }
+    }
+}
+
+void freeRegCode(RegCode* reg) {
+    if (!reg) {
+        return;
+    }
+    FREE_ARRAY(RegInstr, reg->code, reg->capacity);
+    FREE_ARRAY(int, reg->offsets, reg->capacity);
+    FREE_ARRAY(Value, reg->constants, reg->constantCapacity);
+    jitFree(reg);
+    freeTraces(reg);
+    free(reg);
+}
+
+static const char* regOpNames[] = {
+    [REG_MOVE] = "MOVE",
+    [REG_GET_GLOBAL] = "GET_GLOBAL",
+    [REG_SET_GLOBAL] = "SET_GLOBAL",
+    [REG_DEFINE_GLOBAL] = "DEFINE_GLOBAL",
+    [REG_ADD] = "ADD",
+    [REG_SUB] = "SUB",
+    [REG_MUL] = "MUL",
+    [REG_DIV] = "DIV",
+    [REG_REMAINDER] = "REMAINDER",
+    [REG_EXP] = "EXP",
+    [REG_BITAND] = "BITAND",
+    [REG_BITOR] = "BITOR",
+    [REG_BITXOR] = "BITXOR",
+    [REG_LEFT_SHIFT] = "LEFT_SHIFT",
+    [REG_RIGHT_SHIFT] = "RIGHT_SHIFT",
+    [REG_EQUAL] = "EQUAL",
+    [REG_GREATER] = "GREATER",
+    [REG_LESS] = "LESS",
+    [REG_NOT] = "NOT",
+    [REG_BITNEG] = "BITNEG",
+    [REG_SIZE] = "SIZE",
+    [REG_SUBSCRIPT] = "SUBSCRIPT",
+    [REG_JUMP] = "JUMP",
+    [REG_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+    [REG_JUMP_IF_NOT_EQUAL] = "JUMP_IF_NOT_EQUAL",
+    [REG_JUMP_IF_NOT_GREATER] = "JUMP_IF_NOT_GREATER",
+    [REG_JUMP_IF_NOT_LESS] = "JUMP_IF_NOT_LESS",
+    [REG_CALL] = "CALL",
+    [REG_TAIL_CALL] = "TAIL_CALL",
+    [REG_CALL_BUILTIN] = "CALL_BUILTIN",
+    [REG_RETURN] = "RETURN",
+    [REG_PRINT] = "PRINT",
+    [REG_BUILD_ARRAY] = "BUILD_ARRAY",
+    [REG_APPEND_ARRAY] = "APPEND_ARRAY",
+    [REG_BUILD_HASHMAP] = "BUILD_HASHMAP",
+    [REG_APPEND_HASHMAP] = "APPEND_HASHMAP",
+    [REG_COPY_CONSTANT] = "COPY_CONSTANT",
+};
+
+static void printOperand(RegCode* reg, uint16_t operand) {
+    if (IS_REG_K(operand)) {
+        printf(" k%d '", operand & REG_MAX);
+        printValue(reg->constants[operand & REG_MAX]);
+        printf("'");
+    } else {
+        printf(" r%d", operand);
+    }
+}
+
+void disRegCode(RegCode* reg, const char* name) {
+    printf("== %s (%d registers) ==\n", name, reg->registers);
+    for (int i = 0; i < reg->count;) {
+        i = disRegInstruction(reg, i);
+    }
+}
+
+int disRegInstruction(RegCode* reg, int index) {
+    RegInstr instr = reg->code[index];
+    printf("%04d %04d %-20s", index, reg->offsets[index], regOpNames[instr.op]);
+    switch ((RegOp)instr.op) {
+        case REG_RETURN:
+        case REG_PRINT:
+            printOperand(reg, instr.b);
+            break;
+        case REG_SET_GLOBAL:
+        case REG_DEFINE_GLOBAL:
+            printOperand(reg, instr.a);
+            printOperand(reg, instr.b);
+            break;
+        case REG_JUMP:
+            printf(" -> %d", instr.a);
+            break;
+        case REG_JUMP_IF_FALSE:
+            printf(" -> %d", instr.a);
+            printOperand(reg, instr.b);
+            break;
+        case REG_JUMP_IF_NOT_EQUAL:
+        case REG_JUMP_IF_NOT_GREATER:
+        case REG_JUMP_IF_NOT_LESS:
+            printf(" -> %d", instr.a);
+            printOperand(reg, instr.b);
+            printOperand(reg, instr.c);
+            break;
+        case REG_CALL:
+        case REG_TAIL_CALL:
+        case REG_BUILD_ARRAY:
+        case REG_APPEND_ARRAY:
+        case REG_BUILD_HASHMAP:
+        case REG_APPEND_HASHMAP:
+            printf(" r%d %d", instr.a, instr.b);
+            break;
+        case REG_CALL_BUILTIN:
+            printf(" r%d %d #%d", instr.a, instr.b, instr.c);
+            break;
+        case REG_MOVE:
+        case REG_GET_GLOBAL:
+        case REG_NOT:
+        case REG_BITNEG:
+        case REG_SIZE:
+        case REG_COPY_CONSTANT:
+            printf(" r%d", instr.a);
+            printOperand(reg, instr.b);
+            break;
+        case REG_ADD:
+        case REG_SUB:
+        case REG_MUL:
+        case REG_DIV:
+        case REG_REMAINDER:
+        case REG_EXP:
+        case REG_BITAND:
+        case REG_BITOR:
+        case REG_BITXOR:
+        case REG_LEFT_SHIFT:
+        case REG_RIGHT_SHIFT:
+        case REG_EQUAL:
+        case REG_GREATER:
+        case REG_LESS:
+        case REG_SUBSCRIPT:
+            printf(" r%d", instr.a);
+            printOperand(reg, instr.b);
+            printOperand(reg, instr.c);
+            break;
+    }
+    printf("\n");
+    return index + 1;
+}
@@ -0,0 +1,97 @@
+#ifndef clox_regcode_h
+#define clox_regcode_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// Operands with this bit set index RegCode.constants, otherwise frame->slots
+#define REG_K 0x8000
+#define REG_MAX 0x7fff
+#define IS_REG_K(operand) ((operand) & REG_K)
+
+// Three-address instructions, a is the destination unless noted
+typedef enum {
+    REG_MOVE,                // a = RK(b)
+    REG_GET_GLOBAL,          // a = globals[K(b)]
+    REG_SET_GLOBAL,          // globals[K(a)] = RK(b), which must exist
+    REG_DEFINE_GLOBAL,       // globals[K(a)] = RK(b)
+    // a = RK(b) op RK(c)
+    REG_ADD,
+    REG_SUB,
+    REG_MUL,
+    REG_DIV,
+    REG_REMAINDER,
+    REG_EXP,
+    REG_BITAND,
+    REG_BITOR,
+    REG_BITXOR,
+    REG_LEFT_SHIFT,
+    REG_RIGHT_SHIFT,
+    REG_EQUAL,
+    REG_GREATER,
+    REG_LESS,
+    // a = op RK(b)
+    REG_NOT,
+    REG_BITNEG,
+    REG_SIZE,
+    REG_SUBSCRIPT,           // a = RK(b)[RK(c)]
+    // Jumps, a is the target instruction
+    REG_JUMP,
+    REG_JUMP_IF_FALSE,       // if RK(b) is falsey
+    REG_JUMP_IF_NOT_EQUAL,   // if !(RK(b) == RK(c))
+    REG_JUMP_IF_NOT_GREATER, // if !(RK(b) > RK(c))
+    REG_JUMP_IF_NOT_LESS,    // if !(RK(b) < RK(c))
+    REG_CALL,                // a = a(a + 1, ..., a + b)
+    REG_TAIL_CALL,           // Same, but a function callee replaces the frame instead
+    REG_CALL_BUILTIN,        // a = builtins[c](a, ..., a + b - 1)
+    REG_RETURN,              // return RK(b)
+    REG_PRINT,               // print RK(b)
+    // Literals over consecutive registers starting at a, b is the element or pair count
+    REG_BUILD_ARRAY,         // a = [a, ..., a + b - 1]
+    REG_APPEND_ARRAY,        // a += [a + 1, ..., a + b]
+    REG_BUILD_HASHMAP,       // a = {a: a + 1, ...}
+    REG_APPEND_HASHMAP,      // a += {a + 1: a + 2, ...}
+    REG_COPY_CONSTANT,       // a = copy of K(b)
+} RegOp;
+
+typedef struct {
+    uint8_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+} RegInstr;
+
+struct CallFrame;
+// Machine code for a whole function, returns false after a runtime error
+typedef bool (*JitCode)(struct CallFrame* frame);
+typedef struct Trace Trace;
+
+// Register form of one function. Registers are the frame's stack slots, locals first.
+struct RegCode {
+    RegInstr* code;
+    int* offsets; // Bytecode offset each instruction came from, for errors and __line__
+    int count;
+    int capacity;
+    Value* constants; // The chunk's constants, then nil, true, false and friends
+    int constantCount;
+    int constantCapacity;
+    int registers; // Frame size, the deepest the stack code ever gets
+    JitCode native; // Set once the JIT compiled this, see jit.c
+    size_t nativeSize;
+    Trace* traces; // One per loop that got hot, see trace.c
+    int traceCount;
+    int traceCapacity;
+};
+
+// NULL if some construct cannot be lowered
+RegCode* lowerFunction(ObjFunction* function);
+// Lowers function and every function nested in its constants.
+// A function that cannot be lowered keeps reg == NULL and runs on the stack VM.
+void lowerFunctions(ObjFunction* function);
+void freeRegCode(RegCode* reg);
+
+void disRegCode(RegCode* reg, const char* name);
+int disRegInstruction(RegCode* reg, int index);
+
+#endif
@@ -140,7 +140,7 @@ static TokenType identifierType(void) {
     case 'i':
         if (scanner.current - scanner.start > 1) {
             switch(scanner.start[1]) {
-                case 'f': return TOKEN_IF;
+                case 'f': return checkKeyword(2, 0, "", TOKEN_IF);
                 case 'n': return checkKeyword(2, 1, "f", TOKEN_INF);
             }
         }
@@ -32,11 +32,24 @@ void testChunk2(void) {
 void testChunk3(void) {
     Chunk chunk;
     initChunk(&chunk);
-    for (int i = 0; i < MIN_SIZE_TO_CONSTANT_LONG + 1; i++) {
+    for (int i = 0; i < UINT8_COUNT + 2; i++) {
         writeConstant(&chunk, VAL(i + 3.14159265), 123, 12);
     }
     writeChunk(&chunk, OP_RETURN, 123, 12);
-    disChunk(&chunk, "test return many constants (expect 2 OP_CONSTANT_LONG instructions)");
+    disChunk(&chunk, "test return many constants (expect 2 OP_WIDE_CONSTANT instructions)");
+    freeChunk(&chunk);
+}
+
+void testChunkLines(void) {
+    Chunk chunk;
+    initChunk(&chunk);
+    writeConstant(&chunk, VAL(3.14159265), 122, 11);
+    writeChunk(&chunk, OP_NEG, 123, 12);
+    writeChunk(&chunk, OP_PRINT, 123, 12);
+    writeChunk(&chunk, OP_RETURN, 124, 1);
+    rewindChunk(&chunk, 3);
+    disChunk(&chunk, "test line runs (expect 2 runs)");
+    printf("line runs: %d\n", chunk.lineCount);
     freeChunk(&chunk);
 }
 
@@ -88,6 +101,7 @@ void testAll(void) {
     testChunk1();
     testChunk2();
     testChunk3();
+    testChunkLines();
     testRun1();
     testRun2();
     testRun3();
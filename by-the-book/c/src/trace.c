@@ -0,0 +1,629 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "memory.h"
+#include "x64.h"
+
+// Tracing JIT for hot loops in register code.
+//
+// When a back-edge gets hot, one iteration of its loop runs through
+// recordLoop(), which executes each instruction with the generic regOp() and
+// regCompare() and writes down the operand types it saw and which way each
+// jump went. If that iteration came back to the loop head using only numbers
+// and array reads, the straight-line recording becomes machine code:
+//   - type guards for everything the loop reads are hoisted to the entry,
+//     since every register keeps one type around the loop
+//   - registers that only ever hold ints or doubles live unboxed in machine
+//     registers for the whole loop, constants become immediates
+//   - a jump that goes the other way than recorded, an int overflow, a
+//     division by zero or an array read out of bounds or of another type
+//     is a side exit: the machine registers are written back to the frame
+//     and the register VM continues at the instruction that exited.
+//
+// Loops with calls, globals, strings, inner loops or anything else are left
+// to the interpreter, as are loops on other architectures than x86-64.
+
+#define TRACE_MAX 256
+
+typedef struct {
+    RegInstr instr;
+    int index;
+    ValueType types[2]; // RK(b) and RK(c) when it ran
+    ValueType result;   // slots[a] afterwards
+    bool isArray;       // RK(b) was an array
+    bool taken;         // The jump was taken
+} TraceStep;
+
+typedef struct {
+    TraceStep steps[TRACE_MAX];
+    int count;
+} Recording;
+
+typedef enum {
+    RECORD_DONE,    // Back at the head
+    RECORD_ABORTED, // Something the trace cannot do, or the loop ended while recording
+    RECORD_ERROR,   // Runtime error
+} RecordStatus;
+
+// Recordings can catch the iteration that leaves the loop, so a loop gets a few
+#define TRACE_ATTEMPTS 4
+
+static bool traceable(RegOp op) {
+    switch (op) {
+        case REG_MOVE:
+        case REG_ADD:
+        case REG_SUB:
+        case REG_MUL:
+        case REG_DIV:
+        case REG_SUBSCRIPT:
+        case REG_JUMP:
+        case REG_JUMP_IF_NOT_EQUAL:
+        case REG_JUMP_IF_NOT_GREATER:
+        case REG_JUMP_IF_NOT_LESS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static Value operandValue(CallFrame* frame, uint16_t rk) {
+    RegCode* reg = frame->function->reg;
+    return IS_REG_K(rk) ? reg->constants[rk & REG_MAX] : frame->slots[rk];
+}
+
+// Runs one iteration of the loop from head, *next is where to continue
+static RecordStatus recordLoop(CallFrame* frame, int head, Recording* recording, int* next) {
+    RegCode* reg = frame->function->reg;
+    int pc = head;
+    recording->count = 0;
+    while (true) {
+        RegInstr* instr = &reg->code[pc];
+        *next = pc;
+        if (recording->count == TRACE_MAX || !traceable(instr->op)) {
+            return RECORD_ABORTED;
+        }
+        for (int i = 0; i < recording->count; i++) {
+            if (recording->steps[i].index == pc) {
+                // An inner loop, it gets a trace of its own
+                return RECORD_ABORTED;
+            }
+        }
+        TraceStep* step = &recording->steps[recording->count++];
+        *step = (TraceStep){.instr = *instr, .index = pc};
+        if (instr->op != REG_JUMP) {
+            Value b = operandValue(frame, instr->b);
+            step->types[0] = b.type;
+            step->isArray = IS_ARRAY(b);
+            step->types[1] = operandValue(frame, instr->c).type;
+        }
+        switch ((RegOp)instr->op) {
+            case REG_JUMP:
+                step->taken = true;
+                pc = instr->a;
+                break;
+            case REG_JUMP_IF_NOT_EQUAL:
+            case REG_JUMP_IF_NOT_GREATER:
+            case REG_JUMP_IF_NOT_LESS:
+                step->taken = !regCompare(frame, instr);
+                pc = step->taken ? instr->a : pc + 1;
+                break;
+            default:
+                if (!regOp(frame, instr)) {
+                    return RECORD_ERROR;
+                }
+                step->result = frame->slots[instr->a].type;
+                pc++;
+                break;
+        }
+        *next = pc;
+        if (pc == head) {
+            return RECORD_DONE;
+        }
+    }
+}
+
+#if defined(__x86_64__)
+
+typedef enum {
+    HOME_NONE,   // Not used by the trace
+    HOME_MEMORY, // Stays boxed in its slot
+    HOME_GPR,    // Unboxed int
+    HOME_XMM,    // Unboxed double
+} HomeKind;
+
+typedef struct {
+    HomeKind kind;
+    int reg;
+    ValueType type;  // What the trace expects in the slot on entry, VAL_NEVER for no guard
+    bool mixed;      // Holds more than one type during the trace
+} Home;
+
+// Callee-saved ones are pushed by the prologue, rax and rcx are scratch
+static const X64Reg gprs[] = {RDX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+#define XMM_FIRST 2
+#define XMM_COUNT 16
+
+enum {
+    LABEL_LOOP,
+    LABEL_WRITEBACK,
+    LABEL_EPILOGUE,
+    LABEL_ENTRY_EXIT,
+    LABEL_EXITS, // One per guard from here on
+};
+
+typedef struct {
+    Assembler as;
+    RegCode* reg;
+    Recording* recording;
+    Home* homes;
+    int* exitTargets;
+    int exitCount;
+} TraceCompiler;
+
+static bool isNumber(ValueType type) {
+    return type == VAL_INT || type == VAL_DOUBLE;
+}
+
+// What a step leaves in slots[a] given the types it saw, VAL_NEVER if the trace cannot do it
+static ValueType stepType(TraceStep* step) {
+    ValueType b = step->types[0];
+    ValueType c = step->types[1];
+    switch (step->instr.op) {
+        case REG_MOVE: return isNumber(b) ? b : VAL_NEVER;
+        case REG_ADD:
+        case REG_SUB:
+        case REG_MUL:
+            if (!isNumber(b) || !isNumber(c)) {
+                return VAL_NEVER;
+            }
+            return b == VAL_INT && c == VAL_INT ? VAL_INT : VAL_DOUBLE;
+        case REG_DIV:
+            // Int division has its own rounding, leave it to the VM
+            return isNumber(b) && isNumber(c) && (b == VAL_DOUBLE || c == VAL_DOUBLE) ? VAL_DOUBLE : VAL_NEVER;
+        case REG_SUBSCRIPT:
+            return step->isArray && !IS_REG_K(step->instr.b) && c == VAL_INT && isNumber(step->result)
+                ? step->result : VAL_NEVER;
+        default: return VAL_NEVER;
+    }
+}
+
+static bool comparable(TraceStep* step) {
+    ValueType b = step->types[0];
+    ValueType c = step->types[1];
+    if (step->instr.op == REG_JUMP_IF_NOT_EQUAL) {
+        return b == VAL_INT && c == VAL_INT;
+    }
+    return isNumber(b) && isNumber(c);
+}
+
+static void observe(Home* home, ValueType type) {
+    if (home->kind == HOME_NONE) {
+        home->kind = HOME_MEMORY;
+        home->type = type;
+    } else if (home->type != type) {
+        home->mixed = true;
+    }
+}
+
+// Checks the recording can loop on its own and decides where each register lives
+static bool analyze(TraceCompiler* tc) {
+    Recording* recording = tc->recording;
+    int registers = tc->reg->registers;
+    ValueType* current = ALLOCATE(ValueType, registers);
+    ValueType* entry = ALLOCATE(ValueType, registers);
+    for (int r = 0; r < registers; r++) {
+        current[r] = VAL_NEVER;
+        entry[r] = VAL_NEVER;
+    }
+    bool ok = true;
+    for (int i = 0; i < recording->count && ok; i++) {
+        TraceStep* step = &recording->steps[i];
+        RegInstr instr = step->instr;
+        int reads = instr.op == REG_JUMP ? 0 : instr.op == REG_MOVE ? 1 : 2;
+        uint16_t operands[2] = {instr.b, instr.c};
+        for (int k = 0; k < reads; k++) {
+            if (IS_REG_K(operands[k])) {
+                continue;
+            }
+            int r = operands[k];
+            if (current[r] == VAL_NEVER) {
+                entry[r] = current[r] = step->types[k];
+                observe(&tc->homes[r], step->types[k]);
+            } else if (current[r] != step->types[k]) {
+                ok = false;
+            }
+        }
+        switch (instr.op) {
+            case REG_JUMP: break;
+            case REG_JUMP_IF_NOT_EQUAL:
+            case REG_JUMP_IF_NOT_GREATER:
+            case REG_JUMP_IF_NOT_LESS:
+                ok = ok && comparable(step);
+                break;
+            default: {
+                ValueType type = stepType(step);
+                if (type == VAL_NEVER || type != step->result) {
+                    ok = false;
+                    break;
+                }
+                current[instr.a] = type;
+                observe(&tc->homes[instr.a], type);
+                break;
+            }
+        }
+    }
+    // Whatever the loop reads on entry it must leave with the same type for the next iteration
+    for (int r = 0; r < registers && ok; r++) {
+        ok = entry[r] == VAL_NEVER || current[r] == entry[r];
+    }
+
+    int gprCount = 0;
+    int xmmCount = XMM_FIRST;
+    for (int r = 0; r < registers; r++) {
+        Home* home = &tc->homes[r];
+        if (home->kind == HOME_NONE) {
+            continue;
+        }
+        if (!home->mixed && home->type == VAL_INT && gprCount < (int)(sizeof(gprs) / sizeof(gprs[0]))) {
+            home->kind = HOME_GPR;
+            home->reg = gprs[gprCount++];
+        } else if (!home->mixed && home->type == VAL_DOUBLE && xmmCount < XMM_COUNT) {
+            home->kind = HOME_XMM;
+            home->reg = xmmCount++;
+        } else {
+            // Only what the loop reads before writing needs a guard
+            home->type = entry[r];
+        }
+    }
+    FREE_ARRAY(ValueType, current, registers);
+    FREE_ARRAY(ValueType, entry, registers);
+    return ok;
+}
+
+static Mem slot(int r) {
+    return (Mem){RBX, r * (int32_t)sizeof(Value)};
+}
+
+static Value constant(TraceCompiler* tc, uint16_t rk) {
+    return tc->reg->constants[rk & REG_MAX];
+}
+
+static void guard(TraceCompiler* tc, X64Cond cond, int target) {
+    tc->exitTargets[tc->exitCount] = target;
+    asmJccLabel(&tc->as, cond, LABEL_EXITS + tc->exitCount++);
+}
+
+static void intInto(TraceCompiler* tc, X64Reg to, uint16_t rk) {
+    if (IS_REG_K(rk)) {
+        asmMovImm64(&tc->as, to, (uint64_t)constant(tc, rk).as._int);
+    } else if (tc->homes[rk].kind == HOME_GPR) {
+        if (tc->homes[rk].reg != (int)to) {
+            asmAluReg(&tc->as, ALU_MOV, to, tc->homes[rk].reg);
+        }
+    } else {
+        asmLoad(&tc->as, to, payloadOf(slot(rk)));
+    }
+}
+
+// Ints are converted, as AS_DOUBLE() does
+static void doubleInto(TraceCompiler* tc, int xmm, uint16_t rk, ValueType type) {
+    if (type == VAL_INT) {
+        intInto(tc, RAX, rk);
+        asmSseReg(&tc->as, 0xf2, CVTSI2SD, xmm, RAX, true);
+    } else if (IS_REG_K(rk)) {
+        uint64_t bits;
+        double value = constant(tc, rk).as._double;
+        memcpy(&bits, &value, sizeof(bits));
+        asmMovImm64(&tc->as, RAX, bits);
+        asmMovqToXmm(&tc->as, xmm, RAX);
+    } else if (tc->homes[rk].kind == HOME_XMM) {
+        asmSseReg(&tc->as, 0xf2, MOVSD_LOAD, xmm, tc->homes[rk].reg, false);
+    } else {
+        asmSse(&tc->as, 0xf2, MOVSD_LOAD, xmm, payloadOf(slot(rk)));
+    }
+}
+
+static void setInt(TraceCompiler* tc, int r, X64Reg from) {
+    if (tc->homes[r].kind == HOME_GPR) {
+        asmAluReg(&tc->as, ALU_MOV, tc->homes[r].reg, from);
+    } else {
+        asmStore(&tc->as, payloadOf(slot(r)), from);
+        asmStoreType(&tc->as, slot(r), VAL_INT);
+    }
+}
+
+static void setDouble(TraceCompiler* tc, int r, int xmm) {
+    if (tc->homes[r].kind == HOME_XMM) {
+        asmSseReg(&tc->as, 0xf2, MOVSD_LOAD, tc->homes[r].reg, xmm, false);
+    } else {
+        asmSse(&tc->as, 0xf2, MOVSD_STORE, xmm, payloadOf(slot(r)));
+        asmStoreType(&tc->as, slot(r), VAL_DOUBLE);
+    }
+}
+
+static void arithmetic(TraceCompiler* tc, TraceStep* step) {
+    Assembler* as = &tc->as;
+    RegInstr instr = step->instr;
+    if (step->result == VAL_INT) {
+        intInto(tc, RAX, instr.b);
+        intInto(tc, RCX, instr.c);
+        switch (instr.op) {
+            case REG_ADD: asmAluReg(as, ALU_ADD, RAX, RCX); break;
+            case REG_SUB: asmAluReg(as, ALU_SUB, RAX, RCX); break;
+            default: asmImulReg(as, RAX, RCX); break;
+        }
+        // Overflow promotes to a bigint in the VM
+        guard(tc, CC_O, step->index);
+        setInt(tc, instr.a, RAX);
+        return;
+    }
+    doubleInto(tc, 0, instr.b, step->types[0]);
+    doubleInto(tc, 1, instr.c, step->types[1]);
+    uint8_t opcode;
+    switch (instr.op) {
+        case REG_ADD: opcode = ADDSD; break;
+        case REG_SUB: opcode = SUBSD; break;
+        case REG_MUL: opcode = MULSD; break;
+        default: {
+            // Division by +-0.0 warns in the VM
+            asmMovqFromXmm(as, RAX, 1);
+            asmBytes(as, (uint8_t[]){0x48, 0xd1, 0xe0}, 3); // shl rax, 1
+            guard(tc, CC_E, step->index);
+            opcode = DIVSD;
+            break;
+        }
+    }
+    asmSseReg(as, 0xf2, opcode, 0, 1, false);
+    setDouble(tc, instr.a, 0);
+}
+
+static void subscript(TraceCompiler* tc, TraceStep* step) {
+    Assembler* as = &tc->as;
+    RegInstr instr = step->instr;
+    asmLoad(as, RAX, payloadOf(slot(instr.b)));
+    intInto(tc, RCX, instr.c);
+    // Unsigned, so negative indices fail too
+    asmAlu(as, 0x3b, RCX, (Mem){RAX, (int32_t)offsetof(ObjArray, length)});
+    guard(tc, CC_AE, step->index);
+    asmLoad(as, RAX, (Mem){RAX, (int32_t)offsetof(ObjArray, values)});
+    asmBytes(as, (uint8_t[]){0x48, 0xc1, 0xe1, 0x04}, 4); // shl rcx, 4
+    asmAluReg(as, ALU_ADD, RAX, RCX);
+    Mem element = {RAX, 0};
+    asmCmpType(as, element, step->result);
+    guard(tc, CC_NE, step->index);
+    if (step->result == VAL_INT) {
+        asmLoad(as, RCX, payloadOf(element));
+        setInt(tc, instr.a, RCX);
+    } else {
+        asmSse(as, 0xf2, MOVSD_LOAD, 0, payloadOf(element));
+        setDouble(tc, instr.a, 0);
+    }
+}
+
+static void compareJump(TraceCompiler* tc, TraceStep* step) {
+    Assembler* as = &tc->as;
+    RegInstr instr = step->instr;
+    X64Cond cond;
+    if (step->types[0] == VAL_INT && step->types[1] == VAL_INT) {
+        intInto(tc, RAX, instr.b);
+        intInto(tc, RCX, instr.c);
+        asmAluReg(as, ALU_CMP, RAX, RCX);
+        cond = instr.op == REG_JUMP_IF_NOT_EQUAL ? CC_E : instr.op == REG_JUMP_IF_NOT_GREATER ? CC_G : CC_L;
+    } else {
+        // b < c is c > b, ja is false for NaN just like the VM's compare
+        bool less = instr.op == REG_JUMP_IF_NOT_LESS;
+        doubleInto(tc, 0, less ? instr.c : instr.b, step->types[less ? 1 : 0]);
+        doubleInto(tc, 1, less ? instr.b : instr.c, step->types[less ? 0 : 1]);
+        asmSseReg(as, 0x66, UCOMISD, 0, 1, false);
+        cond = CC_A;
+    }
+    if (step->taken) {
+        guard(tc, cond, step->index + 1);
+    } else {
+        guard(tc, cond ^ 1, instr.a);
+    }
+}
+
+static void compileStep(TraceCompiler* tc, TraceStep* step) {
+    RegInstr instr = step->instr;
+    switch (instr.op) {
+        case REG_MOVE:
+            if (step->result == VAL_INT) {
+                intInto(tc, RAX, instr.b);
+                setInt(tc, instr.a, RAX);
+            } else {
+                doubleInto(tc, 0, instr.b, VAL_DOUBLE);
+                setDouble(tc, instr.a, 0);
+            }
+            break;
+        case REG_ADD:
+        case REG_SUB:
+        case REG_MUL:
+        case REG_DIV:
+            arithmetic(tc, step);
+            break;
+        case REG_SUBSCRIPT: subscript(tc, step); break;
+        case REG_JUMP_IF_NOT_EQUAL:
+        case REG_JUMP_IF_NOT_GREATER:
+        case REG_JUMP_IF_NOT_LESS:
+            compareJump(tc, step);
+            break;
+        default:
+            // Forward jumps are already followed by the recording
+            break;
+    }
+}
+
+static void compileTrace(TraceCompiler* tc, int head) {
+    Assembler* as = &tc->as;
+    int registers = tc->reg->registers;
+    asmBytes(as, (uint8_t[]){0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}, 9); // push rbx, r12-r15
+    asmAluReg(as, ALU_MOV, RBX, RDI);
+
+    // Hoisted guards, the loop body keeps every type it starts with
+    for (int r = 0; r < registers; r++) {
+        Home* home = &tc->homes[r];
+        if (home->kind == HOME_NONE || home->type == VAL_NEVER) {
+            continue;
+        }
+        asmCmpType(as, slot(r), home->type);
+        asmJccLabel(as, CC_NE, LABEL_ENTRY_EXIT);
+        if (home->type == VAL_OBJ) {
+            // Only arrays are read, and their registers are never written
+            asmLoad(as, RAX, payloadOf(slot(r)));
+            asmCmp32(as, (Mem){RAX, (int32_t)offsetof(Obj, type)}, OBJ_ARRAY);
+            asmJccLabel(as, CC_NE, LABEL_ENTRY_EXIT);
+        }
+    }
+    for (int r = 0; r < registers; r++) {
+        Home* home = &tc->homes[r];
+        if (home->kind == HOME_GPR) {
+            asmLoad(as, home->reg, payloadOf(slot(r)));
+        } else if (home->kind == HOME_XMM) {
+            asmSse(as, 0xf2, MOVSD_LOAD, home->reg, payloadOf(slot(r)));
+        }
+    }
+
+    as->labels[LABEL_LOOP] = as->count;
+    for (int i = 0; i < tc->recording->count; i++) {
+        compileStep(tc, &tc->recording->steps[i]);
+    }
+    asmJmpLabel(as, LABEL_LOOP);
+
+    for (int i = 0; i < tc->exitCount; i++) {
+        as->labels[LABEL_EXITS + i] = as->count;
+        asmByte(as, 0xb8); // mov eax, target
+        asm32(as, (uint32_t)tc->exitTargets[i]);
+        asmJmpLabel(as, LABEL_WRITEBACK);
+    }
+    // Types in memory never changed for unboxed registers, only their payloads did
+    as->labels[LABEL_WRITEBACK] = as->count;
+    for (int r = 0; r < registers; r++) {
+        Home* home = &tc->homes[r];
+        if (home->kind == HOME_GPR) {
+            asmStore(as, payloadOf(slot(r)), home->reg);
+        } else if (home->kind == HOME_XMM) {
+            asmSse(as, 0xf2, MOVSD_STORE, home->reg, payloadOf(slot(r)));
+        }
+    }
+    as->labels[LABEL_EPILOGUE] = as->count;
+    asmBytes(as, (uint8_t[]){0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3}, 10); // pop r15-r12, rbx, ret
+    as->labels[LABEL_ENTRY_EXIT] = as->count;
+    asmByte(as, 0xb8); // mov eax, head
+    asm32(as, (uint32_t)head);
+    asmJmpLabel(as, LABEL_EPILOGUE);
+    asmPatchLabels(as);
+}
+
+// Function pointers and data pointers only meet through this
+typedef union {
+    void* memory;
+    TraceCode code;
+} TraceEntry;
+
+static bool compileRecording(Trace* trace, RegCode* reg, Recording* recording) {
+    if (sizeof(ValueType) != 4 || sizeof(ObjType) != 4) {
+        return false;
+    }
+    TraceCompiler tc = {.reg = reg, .recording = recording};
+    tc.homes = ALLOCATE(Home, reg->registers);
+    for (int r = 0; r < reg->registers; r++) {
+        tc.homes[r] = (Home){HOME_NONE, 0, VAL_NEVER, false};
+    }
+    bool ok = analyze(&tc);
+    if (ok) {
+        // Subscripts guard twice, everything else at most once
+        tc.exitTargets = ALLOCATE(int, 2 * recording->count);
+        initAssembler(&tc.as, LABEL_EXITS + 2 * recording->count);
+        compileTrace(&tc, trace->head);
+        void* memory = asmInstall(&tc.as);
+        ok = memory != NULL;
+        if (ok) {
+            TraceEntry entry = {.memory = memory};
+            trace->code = entry.code;
+            trace->size = (size_t)tc.as.count;
+        }
+        freeAssembler(&tc.as);
+        FREE_ARRAY(int, tc.exitTargets, 2 * recording->count);
+    }
+    FREE_ARRAY(Home, tc.homes, reg->registers);
+    return ok;
+}
+
+void freeTraces(RegCode* reg) {
+    for (int i = 0; i < reg->traceCount; i++) {
+        if (reg->traces[i].code) {
+            TraceEntry entry = {.code = reg->traces[i].code};
+            asmRelease(entry.memory, reg->traces[i].size);
+        }
+    }
+    FREE_ARRAY(Trace, reg->traces, reg->traceCapacity);
+    reg->traces = NULL;
+    reg->traceCount = reg->traceCapacity = 0;
+}
+
+#else
+
+static bool compileRecording(Trace* trace, RegCode* reg, Recording* recording) {
+    return false;
+}
+
+void freeTraces(RegCode* reg) {
+    FREE_ARRAY(Trace, reg->traces, reg->traceCapacity);
+    reg->traces = NULL;
+    reg->traceCount = reg->traceCapacity = 0;
+}
+
+#endif
+
+static Trace* findTrace(RegCode* reg, int head) {
+    for (int i = 0; i < reg->traceCount; i++) {
+        if (reg->traces[i].head == head) {
+            return &reg->traces[i];
+        }
+    }
+    return NULL;
+}
+
+int traceLoop(CallFrame* frame, int head) {
+    RegCode* reg = frame->function->reg;
+    Trace* trace = findTrace(reg, head);
+    if (!trace) {
+        if (reg->traceCapacity < reg->traceCount + 1) {
+            int old = reg->traceCapacity;
+            reg->traceCapacity = GROW_CAPACITY(old);
+            reg->traces = GROW_ARRAY(Trace, reg->traces, old, reg->traceCapacity);
+        }
+        trace = &reg->traces[reg->traceCount++];
+        *trace = (Trace){head, NULL, 0, 0};
+    }
+    if (!trace->code && trace->failures < TRACE_ATTEMPTS) {
+        Recording recording;
+        int next;
+        RecordStatus status = recordLoop(frame, head, &recording, &next);
+        if (status == RECORD_ERROR) {
+            return -1;
+        }
+        const char* name = frame->function->name ? frame->function->name->chars : "<script>";
+        if (status == RECORD_DONE && compileRecording(trace, reg, &recording)) {
+            if (DEBUG_TRACE) {
+                ERR_PRINT("====== JIT traced loop at %d in %s: %d instructions, %zu bytes\n",
+                          head, name, recording.count, trace->size);
+            }
+        } else {
+            trace->failures++;
+            if (DEBUG_TRACE) {
+                ERR_PRINT("====== JIT cannot trace loop at %d in %s, stopped at %d\n", head, name, next);
+            }
+        }
+        if (next != head) {
+            return next;
+        }
+    }
+    if (!trace->code) {
+        return head;
+    }
+    return trace->code(frame->slots);
+}
@@ -0,0 +1,23 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include "common.h"
+#include "regcode.h"
+#include "vm.h"
+
+// Machine code for one loop, returns the register instruction to continue at
+typedef int (*TraceCode)(Value* slots);
+
+struct Trace {
+    int head;        // Instruction the loop's back-edge jumps to
+    TraceCode code;  // NULL when the loop could not be traced, it stays interpreted
+    size_t size;
+    int failures;    // Recordings that did not make it, see TRACE_ATTEMPTS
+};
+
+// Runs the loop starting at head from one of its hot back-edges, recording and compiling
+// a trace on the first visits. Returns the instruction to continue at, -1 after a runtime error.
+int traceLoop(CallFrame* frame, int head);
+void freeTraces(RegCode* reg);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "value.h"
+#include "bigint.h"
 #include "hashmap.h"
 #include "memory.h"
 #include "object.h"
@@ -13,6 +14,7 @@ const char* valueTypeNames[] = {
     "VAL_FCOMPLEX",
     "VAL_BOOL",
     "VAL_OBJ",
+    "VAL_BIGINT",
 };
 
 void initValues(Values* values) {
@@ -43,18 +45,22 @@ double AS_DOUBLE(Value value) {
         return (double)AS_INTEGER(value);
     } else if (IS_FCOMPLEX(value)) {
         return (double)AS_FCOMPLEX(value);
+    } else if (IS_BIGINT(value)) {
+        return bigintToDouble(AS_BIGINT(value));
     } else {
         return value.as._double;
     }
 }
 
-int AS_INTEGER(Value value) {
+int64_t AS_INTEGER(Value value) {
     if (IS_INTEGER(value) || IS_BOOL(value)) {
         return value.as._int;
     } else if (IS_DOUBLE(value)) {
-        return (double)value.as._double;
+        return (int64_t)value.as._double;
     } else if (IS_FCOMPLEX(value)) {
-        return (int)AS_FCOMPLEX(value);
+        return (int64_t)AS_FCOMPLEX(value);
+    } else if (IS_BIGINT(value)) {
+        return bigintToInt(AS_BIGINT(value));
     } else {
         return value.as._int;
     }
@@ -67,6 +73,8 @@ float complex AS_FCOMPLEX(Value value) {
         return (float complex)AS_DOUBLE(value);
     } else if (IS_INTEGER(value) || IS_BOOL(value)) {
         return (float complex)AS_INTEGER(value);
+    } else if (IS_BIGINT(value)) {
+        return (float complex)AS_DOUBLE(value);
     } else {
         return value.as._fcomplex;
     }
@@ -80,6 +88,13 @@ bool valuesEqual(Value a, Value b) {
             return false;
         }
     }
+    if (IS_BIGINT(a) || IS_BIGINT(b)) {
+        // Normalized bigints never equal a VAL_INT
+        if (IS_DOUBLE(a) || IS_DOUBLE(b) || IS_FCOMPLEX(a) || IS_FCOMPLEX(b)) {
+            return AS_FCOMPLEX(a) == AS_FCOMPLEX(b) && AS_DOUBLE(a) == AS_DOUBLE(b);
+        }
+        return bigintCompare(a, b) == 0;
+    }
     switch (a.type) { // Exhaustive
         case VAL_NEVER: return false;
         case VAL_NIL: return a.type == b.type;
@@ -88,6 +103,7 @@ bool valuesEqual(Value a, Value b) {
         case VAL_DOUBLE: return AS_DOUBLE(a) == AS_DOUBLE(b);
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_OBJ: return objsEqual(AS_OBJ(a), AS_OBJ(b)); // This function also has an exhaustive switch
+        case VAL_BIGINT: return bigintCompare(a, b) == 0;
     }
     return false;
 }
@@ -9,6 +9,9 @@ typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjArray ObjArray;
 typedef struct ObjHashmap ObjHashmap;
+typedef struct ObjBigInt ObjBigInt;
+typedef struct ObjMatrix ObjMatrix;
+typedef struct ObjMatrixRow ObjMatrixRow;
 
 typedef enum {
     VAL_NEVER,  // Sentinel at enum value 0 to detect uninitialized memory
@@ -18,13 +21,14 @@ typedef enum {
     VAL_FCOMPLEX,
     VAL_BOOL,
     VAL_OBJ,
+    VAL_BIGINT, // Payload is an ObjBigInt, a number that did not fit in VAL_INT
 } ValueType;
 
 // Flat! Struct is packed to fill 8 bytes on a 64-bit arch
 typedef struct {
     ValueType type;
     union {
-        int _int;
+        int64_t _int;
         double _double;
         float complex _fcomplex;
         Obj* _obj;
@@ -41,16 +45,19 @@ extern const char* valueTypeNames[];
 #define FCOMPLEX_VAL(val) ((Value){VAL_FCOMPLEX, {._fcomplex = val}})
 #define BOOL_VAL(val) ((Value){VAL_BOOL, {._int = (val) != 0}})
 #define OBJ_VAL(pointer) ((Value){VAL_OBJ, {._obj = (Obj*)(pointer)}})
+#define BIGINT_VAL(pointer) ((Value){VAL_BIGINT, {._obj = (Obj*)(pointer)}})
 
 #define AS_BOOL(value) ((bool)(value).as._int)
 #define AS_OBJ(value) ((value).as._obj)
+#define AS_BIGINT(value) ((ObjBigInt*)(value).as._obj)
 
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_DOUBLE(value) ((value).type == VAL_DOUBLE)
 #define IS_FCOMPLEX(value) ((value).type == VAL_FCOMPLEX)
 #define IS_INTEGER(value) ((value).type == VAL_INT)
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
-#define IS_NUMBER(v) (IS_DOUBLE(v) || IS_FCOMPLEX(v) || IS_INTEGER(v) || IS_BOOL(v))
+#define IS_BIGINT(value) ((value).type == VAL_BIGINT)
+#define IS_NUMBER(v) (IS_DOUBLE(v) || IS_FCOMPLEX(v) || IS_INTEGER(v) || IS_BOOL(v) || IS_BIGINT(v))
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 #define IS_ZERO(value) (AS_DOUBLE(value) == 0.0 || AS_FCOMPLEX(value) == 0.0)
 
@@ -60,9 +67,6 @@ typedef struct {
     Value* values;
 } ValueArray;
 
-// increment this in the "real world"
-#define MIN_SIZE_TO_CONSTANT_LONG 8
-
 typedef ValueArray Values;
 
 void initValues(Values* values);
@@ -70,7 +74,7 @@ void freeValues(Values* values);
 void writeValues(Values* values, Value value);
 
 double AS_DOUBLE(Value value);
-int AS_INTEGER(Value value);
+int64_t AS_INTEGER(Value value);
 float complex AS_FCOMPLEX(Value value);
 
 bool valuesEqual(Value a, Value b);
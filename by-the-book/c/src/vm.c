@@ -2,8 +2,11 @@
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
+#include <signal.h>
 #include <time.h>
 
+#include "bigint.h"
+#include "cache.h"
 #include "common.h"
 #include "debug.h"
 #include "compiler.h"
@@ -13,39 +16,74 @@
 #include "value.h"
 #include "vm.h"
 #include "print.h"
+#include "profile.h"
+#include "regcode.h"
+#include "jit.h"
+#include "trace.h"
 #include "lib_complex.h"
+#include "lib_fft.h"
+#include "matrix.h"
+
+// run() dispatches through tables of label addresses, a GNU C extension, unless built with
+// -DDISPATCH_TABLES=0. Then it is a plain switch that checks for hooks before each instruction.
+#ifndef DISPATCH_TABLES
+#ifdef __GNUC__
+#define DISPATCH_TABLES 1
+#else
+#define DISPATCH_TABLES 0
+#endif
+#endif
 
 VM vm;
 
+// See setHooks(), they outlive the VMs
+static volatile sig_atomic_t hooks = 0;
+#if DISPATCH_TABLES
+// The tables without and with hooks, run() fills them in on its first call since its labels
+// cannot be named outside of it
+static const void* const* dispatchTables[2];
+static const void* const* volatile dispatch;
+#endif
+
 #define runtimeError(...) { runtimeErrorLog(__VA_ARGS__); resetStack(); }
 
 static Value clockNative(int argCount, Value* args) {
     return DOUBLE_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+int frameOffset(CallFrame* frame) {
+    RegCode* reg = frame->function->reg;
+    if (frame->pc) {
+        return reg->offsets[frame->pc - reg->code - 1];
+    }
+    return (int)(frame->ip - frame->function->chunk.code - 1);
+}
+
 static Value lineNative(int argCount, Value* args) {
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
-    int line = frame->function->chunk.lines[frame->ip - frame->function->chunk.code - 1];
-    return INTEGER_VAL(line);
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    return INTEGER_VAL(getLineRun(&frame->function->chunk, frameOffset(frame)).line);
 }
 
 static Value colNative(int argCount, Value* args) {
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
-    int col = frame->function->chunk.columns[frame->ip - frame->function->chunk.code - 1];
-    return INTEGER_VAL(col);
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    return INTEGER_VAL(getLineRun(&frame->function->chunk, frameOffset(frame)).column);
 }
 
 static void resetStack(void) {
     vm.stackTop = vm.stack;
 }
 
-static void defineNative(const char* name, int arity, NativeFn function) {
+void defineNative(const char* name, int arity, NativeFn function) {
     ObjString* _name = copyString(name, strlen(name));
-    hashmap_add(
-        &vm.globals,
-        OBJ_VAL(_name),
-        OBJ_VAL(newNative(_name, arity, function))
-    );
+    ObjNative* native = newNative(_name, arity, function);
+    hashmap_add(&vm.globals, OBJ_VAL(_name), OBJ_VAL(native));
+    if (vm.builtinCapacity < vm.builtinCount + 1) {
+        int old = vm.builtinCapacity;
+        vm.builtinCapacity = GROW_CAPACITY(old);
+        vm.builtins = GROW_ARRAY(Builtin, vm.builtins, old, vm.builtinCapacity);
+    }
+    vm.builtins[vm.builtinCount++] = (Builtin){native, false};
+    _name->builtin = vm.builtinCount;
 }
 
 static Value FFI_prints(int argCount, Value* values) {
@@ -60,19 +98,56 @@ static Value FFI_setArray(int argCount, Value* arg) {
     return NIL_VAL;
 }
 
+static Value FFI_heapSnapshot(int argCount, Value* args) {
+    return BOOL_VAL(IS_STRING(args[0]) && profileHeapSnapshot(AS_CSTRING(args[0])));
+}
+
+static void setStat(ObjHashmap* stats, const char* key, Value value) {
+    hashmap_add(&stats->map, OBJ_VAL(copyString(key, strlen(key))), value);
+}
+
+static Value FFI_mapstats(int argCount, Value* args) {
+    if (!IS_HASHMAP(args[0])) {
+        return NIL_VAL;
+    }
+    hashmap_stats_t stats;
+    hashmap_stats(&AS_HASHMAP(args[0])->map, &stats);
+    ObjArray* probes = allocateArray(stats.max_probe + 1);
+    for (size_t i = 0; i <= stats.max_probe; i++) {
+        insertArray(probes, i, INTEGER_VAL(stats.probes[i]));
+    }
+    ObjHashmap* result = allocateHashmap(16);
+    setStat(result, "count", INTEGER_VAL(stats.total));
+    setStat(result, "capacity", INTEGER_VAL(stats.capacity));
+    setStat(result, "load", DOUBLE_VAL(stats.load));
+    setStat(result, "probes", OBJ_VAL(probes));
+    setStat(result, "maxProbe", INTEGER_VAL(stats.max_probe));
+    setStat(result, "meanProbe", DOUBLE_VAL(stats.mean_probe));
+    setStat(result, "grows", INTEGER_VAL(stats.grows));
+    setStat(result, "failedAdds", INTEGER_VAL(stats.failed_adds));
+    return OBJ_VAL(result);
+}
+
 static Value FFI_rmArrayTop(int argCount, Value* arg) {
     AS_ARRAY(arg[0])->length--;
     return NIL_VAL;
 }
 
+// Calls back into Lox, so it is defined with the call machinery below
+static Value FFI_bench(int argCount, Value* args);
+
 static Value FFI_type(int argCount, Value* arg) {
-    return OBJ_VAL(TYPE_NAME(arg[0].type));
+    return OBJ_VAL(vm.typeNames[arg[0].type]);
 }
 
 void initVM(void) {
-    // vm.frameCount
+    // vm.frameBlocks and vm.frameCount
+    vm.frameBlocks = NULL;
+    vm.frameBlockCount = 0;
     vm.frameCount = 0;
-    // vm.stack and vm.stackTop
+    // vm.stack, vm.stackEnd and vm.stackTop
+    vm.stack = ALLOCATE(Value, STACK_INITIAL);
+    vm.stackEnd = vm.stack + STACK_INITIAL;
     resetStack();
     // vm.objects
     vm.objects = NULL;
@@ -81,41 +156,92 @@ void initVM(void) {
     hashmap_init(&vm.globals, 512, (hash_function)hashAny);
     // vm.strings
     hashmap_init(&vm.strings, 1024, (hash_function)hashAny);
+    // vm.typeNames
+    for (int i = 0; i <= VAL_BIGINT; i++) {
+        vm.typeNames[i] = TYPE_NAME(i);
+    }
+    // vm.builtins
+    vm.builtins = NULL;
+    vm.builtinCount = 0;
+    vm.builtinCapacity = 0;
 
-    // Put these AFTER defining VM
+    // Put these AFTER defining VM, the first ones in BuiltinId order
+    defineNative("type", 1, FFI_type);
+    defineNative("setArray", 3, FFI_setArray);
+    defineNative("rmArrayTop", 1, FFI_rmArrayTop);
     defineNative("clock", 0, clockNative);
     defineNative("__line__", 0, lineNative);
     defineNative("__col__", 0, colNative);
     defineNative("prints", -1, FFI_prints);
-    defineNative("setArray", 3, FFI_setArray);
-    defineNative("rmArrayTop", 1, FFI_rmArrayTop);
-    defineNative("type", 1, FFI_type);
+    defineNative("heapSnapshot", 1, FFI_heapSnapshot);
+    defineNative("mapstats", 1, FFI_mapstats);
+    defineNative("bench", -1, FFI_bench);
 
     defineComplexLib();
+    defineFFTLib();
+    defineMatrixLib();
 }
 
 void freeVM(void) {
+    for (int i = 0; i < vm.frameBlockCount; i++) {
+        FREE_ARRAY(CallFrame, vm.frameBlocks[i], FRAME_BLOCK);
+    }
+    FREE_ARRAY(CallFrame*, vm.frameBlocks, vm.frameBlockCount);
+    FREE_ARRAY(Value, vm.stack, vm.stackEnd - vm.stack);
+    FREE_ARRAY(Builtin, vm.builtins, vm.builtinCapacity);
+    if (PROFILE_HEAP) {
+        profileStrings(&vm.strings);
+    }
+    if (PROFILE_MAPS) {
+        profileMapReport(stderr, "globals", &vm.globals);
+        profileMapReport(stderr, "strings", &vm.strings);
+    }
     hashmap_free(&vm.strings);
     hashmap_free(&vm.globals);
     freeObjects();
+    unmapCaches();
+    freeFFTLib();
 }
 
-static void runtimeErrorLog(const char* format, ...) {
-    va_list args;
-    fputs("ERROR: ", stderr);
-    va_start(args, format);
+// Frames shown at each end of the stack trace after a runtime error
+#define ERROR_TRACE_FRAMES 16
+
+static void runtimeLog(const char* prefix, const char* format, va_list args) {
+    fputs(prefix, stderr);
     vfprintf(stderr,  format, args);
-    va_end(args);
     fputs("\n", stderr);
 
     for (int i = vm.frameCount - 1; i >= 0; i--) {
-        CallFrame* frame = &vm.frames[i];
-        int line = frame->function->chunk.lines[frame->ip - frame->function->chunk.code - 1];
-        int col = frame->function->chunk.columns[frame->ip - frame->function->chunk.code - 1];
-        fprintf(stderr, "    [%d:%d] in %s\n", line, col, frame->function->name->chars);
+        // Deep recursion only shows its ends
+        if (i == vm.frameCount - 1 - ERROR_TRACE_FRAMES && i > ERROR_TRACE_FRAMES) {
+            fprintf(stderr, "    ... %d more\n", i - ERROR_TRACE_FRAMES + 1);
+            i = ERROR_TRACE_FRAMES - 1;
+        }
+        CallFrame* frame = FRAME(i);
+        LineRun run = getLineRun(&frame->function->chunk, frameOffset(frame));
+        fprintf(stderr, "    [%d:%d] in %s\n", run.line, run.column, frame->function->name->chars);
     }
 }
 
+static void runtimeErrorLog(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    runtimeLog("ERROR: ", format, args);
+    va_end(args);
+    if (PROFILE_EVENTS) {
+        // None of what was running returns now
+        profileLeaveAll();
+    }
+}
+
+// Like runtimeErrorLog() with its stack trace, but execution goes on and so do the spans
+static void runtimeWarningLog(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    runtimeLog("WARNING: ", format, args);
+    va_end(args);
+}
+
 void push(Value value) {
     *vm.stackTop = value;
     vm.stackTop++;
@@ -126,7 +252,7 @@ Value pop(void) {
     return *vm.stackTop;
 }
 
-int pop_int(void) {
+int64_t pop_int(void) {
     return AS_INTEGER(pop());
 }
 
@@ -148,17 +274,123 @@ Value peek(int offset) {
         return false; \
     }
 
+// Calls count towards JIT_THRESHOLD, the function is compiled once it gets there
+static void countCall(ObjFunction* func) {
+    if (JIT_THRESHOLD > 0 && !func->jitTried && ++func->hotness >= JIT_THRESHOLD) {
+        jitFunction(func);
+    }
+}
+
+// Makes sure count slots from slots on are allocated, moving the stack if it has to grow.
+// Returns where slots ended up.
+static Value* reserveStack(Value* slots, int count) {
+    if (slots + count <= vm.stackEnd) {
+        return slots;
+    }
+    size_t old = vm.stackEnd - vm.stack;
+    size_t needed = (size_t)(slots - vm.stack) + count;
+    size_t capacity = old;
+    while (capacity < needed) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    Value* stack = ALLOCATE(Value, capacity);
+    memcpy(stack, vm.stack, sizeof(Value) * old);
+    for (int i = 0; i < vm.frameCount; i++) {
+        CallFrame* frame = FRAME(i);
+        frame->slots = stack + (frame->slots - vm.stack);
+    }
+    slots = stack + (slots - vm.stack);
+    vm.stackTop = stack + (vm.stackTop - vm.stack);
+    FREE_ARRAY(Value, vm.stack, old);
+    vm.stack = stack;
+    vm.stackEnd = stack + capacity;
+    return slots;
+}
+
+// What a frame of func can use on the stack: the deepest its expressions get on the stack VM, or
+// its registers once lowered, whichever is more, then the scratch for natives and transients
+static int frameSize(ObjFunction* func) {
+    int slots = func->reg && func->reg->registers > func->maxStack ? func->reg->registers : func->maxStack;
+    return slots + FRAME_SCRATCH;
+}
+
+// Pushes the frame for a callee that passed its arity check. One compare finds out whether
+// the frames or the stack have to grow, or the recursion went too deep.
+static bool pushFrame(ObjFunction* func, int argCount) {
+    // The script itself is only called once
+    if (vm.frameCount > 0) {
+        countCall(func);
+    }
+    Value* slots = vm.stackTop - argCount - 1;
+    if (vm.frameCount == vm.frameBlockCount * FRAME_BLOCK || slots + frameSize(func) > vm.stackEnd) {
+        if (vm.frameCount == FRAMES_MAX) {
+            runtimeError("Stack overflow.");
+            return false;
+        }
+        if (vm.frameCount == vm.frameBlockCount * FRAME_BLOCK) {
+            vm.frameBlocks = GROW_ARRAY(CallFrame*, vm.frameBlocks, vm.frameBlockCount, vm.frameBlockCount + 1);
+            vm.frameBlocks[vm.frameBlockCount++] = ALLOCATE(CallFrame, FRAME_BLOCK);
+        }
+        slots = reserveStack(slots, frameSize(func));
+    }
+    CallFrame* frame = FRAME(vm.frameCount);
+    vm.frameCount++;
+    frame->function = func;
+    frame->ip = func->chunk.code;
+    frame->pc = func->reg ? func->reg->code : NULL;
+    frame->slots = slots;
+    if (PROFILE_EVENTS) {
+        profileEnter(func->name ? func->name->chars : "<script>", "lox");
+    }
+    return true;
+}
+
 static bool call(ObjFunction* func, int argCount) {
     ARITY_CHECK(func)
-    if (vm.frameCount == FRAMES_MAX) {
-        runtimeError("Stack overflow.");
+    return pushFrame(func, argCount);
+}
+
+// After a native returned, whether it raised a runtime error. The error already reset the
+// stack and left the profiled spans, so the caller only returns INTERPRET_RUNTIME_ERROR.
+static bool nativeFailed(void) {
+    if (!vm.nativeError) {
+        return false;
+    }
+    vm.nativeError = false;
+    return true;
+}
+
+static bool callNative(ObjNative* func, int argCount) {
+    if (PROFILE_EVENTS) {
+        profileEnter(func->name->chars, "native");
+    }
+    Value result = func->function(argCount, vm.stackTop - argCount);
+    if (nativeFailed()) {
         return false;
     }
-    vm.frameCount += 1;
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    if (PROFILE_EVENTS) {
+        profileLeave();
+    }
+    vm.stackTop -= argCount + 1;
+    push(result);
+    return true;
+}
+
+// Replaces the frame on top with a call to func, moving callee and arguments down into its slots
+static bool tailCall(ObjFunction* func, Value* callee, int argCount) {
+    ARITY_CHECK(func)
+    countCall(func);
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    memmove(frame->slots, callee, sizeof(Value) * (argCount + 1));
+    vm.stackTop = frame->slots + argCount + 1;
+    reserveStack(frame->slots, frameSize(func));
     frame->function = func;
     frame->ip = func->chunk.code;
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->pc = func->reg ? func->reg->code : NULL;
+    if (PROFILE_EVENTS) {
+        profileLeave();
+        profileEnter(func->name->chars, "lox");
+    }
     return true;
 }
 
@@ -170,10 +402,7 @@ static bool callValue(Value callee, int argCount) {
             case OBJ_NATIVE: {
                 ObjNative* func = AS_NATIVE(callee);
                 ARITY_CHECK(func)
-                Value result = func->function(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
+                return callNative(func, argCount);
             }
             default: // Safe to automatically assume all other types are no callable
                 break;
@@ -183,6 +412,27 @@ static bool callValue(Value callee, int argCount) {
     return false;
 }
 
+// callValue() for the call instruction at offset in chunk. A callee that was called from
+// there before skips the type and arity checks.
+static bool callSite(Chunk* chunk, int offset, Value callee, int argCount) {
+    if (!chunk->callees) {
+        chunk->callees = ALLOCATE(Obj*, chunk->count);
+        memset(chunk->callees, 0, sizeof(Obj*) * chunk->count);
+    }
+    Obj** cached = &chunk->callees[offset];
+    if (IS_OBJ(callee) && AS_OBJ(callee) == *cached) {
+        if ((*cached)->type == OBJ_FUNCTION) {
+            return pushFrame((ObjFunction*)*cached, argCount);
+        }
+        return callNative((ObjNative*)*cached, argCount);
+    }
+    if (!callValue(callee, argCount)) {
+        return false;
+    }
+    *cached = AS_OBJ(callee);
+    return true;
+}
+
 static bool slice(Value key) {
     if (!IS_ARRAY(key)) {
         runtimeError("Invalid array slice");
@@ -227,11 +477,16 @@ static bool slice(Value key) {
         case OBJ_HASHMAP:
             runtimeError("Cannot slice into hashmap yet");
             return false;
+        case OBJ_MATRIX:
+        case OBJ_MATRIX_ROW:
+            runtimeError("Cannot slice into matrix yet");
+            return false;
         case OBJ_NEVER:
             runtimeError("Slicing into a non-initialized object");
             return false;
         case OBJ_FUNCTION:
         case OBJ_NATIVE:
+        case OBJ_BIGINT:
             runtimeError("Indexing into a non-array, non-string, non-hashmap value");
             return false;
     }
@@ -280,6 +535,31 @@ static bool subscript(Value key) {
             push(array->values[i]);
             return true;
         }
+        case OBJ_MATRIX: {
+            // m[i] is a view, m[i][j] reads the element without copying the row
+            ObjMatrix* matrix = AS_MATRIX(pop());
+            if (i < 0) {
+                i = matrix->rows + i;
+            }
+            if (i < 0 || i >= matrix->rows) {
+                runtimeError("Matrix row %d out of bounds", i);
+                return false;
+            }
+            push(OBJ_VAL(getMatrixRow(matrix, i)));
+            return true;
+        }
+        case OBJ_MATRIX_ROW: {
+            ObjMatrixRow* view = AS_MATRIX_ROW(pop());
+            if (i < 0) {
+                i = view->matrix->cols + i;
+            }
+            if (i < 0 || i >= view->matrix->cols) {
+                runtimeError("Matrix column %d out of bounds", i);
+                return false;
+            }
+            push(matrixGet(view->matrix, view->row, i));
+            return true;
+        }
         case OBJ_HASHMAP:
             return true;
         case OBJ_NEVER:
@@ -287,6 +567,7 @@ static bool subscript(Value key) {
             return false;
         case OBJ_FUNCTION:
         case OBJ_NATIVE:
+        case OBJ_BIGINT:
             runtimeError("Indexing into a non-array, non-string, non-hashmap value");
             return false;
     }
@@ -298,7 +579,7 @@ size_t size(void) {
     return vm.stackTop - vm.stack;
 }
 
-static void concatenate(void) {
+void concatenate(void) {
     ObjString* b = AS_STRING(pop());
     ObjString* a = AS_STRING(pop());
     size_t length = a->length + b->length;
@@ -323,37 +604,202 @@ static void concatenateArrays(void) {
     push(OBJ_VAL(result));
 }
 
+// Integer arithmetic promotes to a bigint instead of overflowing
+static Value intAdd(Value a, Value b) {
+    int64_t result;
+    if (IS_BIGINT(a) || IS_BIGINT(b) || __builtin_add_overflow(AS_INTEGER(a), AS_INTEGER(b), &result)) {
+        return bigintAdd(a, b);
+    }
+    return INTEGER_VAL(result);
+}
+
+static Value intSub(Value a, Value b) {
+    int64_t result;
+    if (IS_BIGINT(a) || IS_BIGINT(b) || __builtin_sub_overflow(AS_INTEGER(a), AS_INTEGER(b), &result)) {
+        return bigintSub(a, b);
+    }
+    return INTEGER_VAL(result);
+}
+
+static Value intMul(Value a, Value b) {
+    int64_t result;
+    if (IS_BIGINT(a) || IS_BIGINT(b) || __builtin_mul_overflow(AS_INTEGER(a), AS_INTEGER(b), &result)) {
+        return bigintMul(a, b);
+    }
+    return INTEGER_VAL(result);
+}
+
+static Value intDiv(Value a, Value b) {
+    if (IS_BIGINT(a) || IS_BIGINT(b) || (AS_INTEGER(a) == INT64_MIN && AS_INTEGER(b) == -1)) {
+        return bigintDiv(a, b);
+    }
+    return INTEGER_VAL(AS_INTEGER(a) / AS_INTEGER(b));
+}
+
+// Orders bigints against ints exactly, and against doubles by converting
+static int compareNumbers(Value a, Value b) {
+    if (IS_BIGINT(a) || IS_BIGINT(b)) {
+        if (!(IS_DOUBLE(a) || IS_DOUBLE(b))) {
+            return bigintCompare(a, b);
+        }
+    }
+    if (IS_DOUBLE(a) || IS_DOUBLE(b) || IS_BIGINT(a) || IS_BIGINT(b)) {
+        double x = AS_DOUBLE(a);
+        double y = AS_DOUBLE(b);
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+    int64_t x = AS_INTEGER(a);
+    int64_t y = AS_INTEGER(b);
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static bool matrixArith(MatrixOp op) {
+    Value b = pop();
+    Value a = pop();
+    if (!(IS_MATRIX(a) || IS_NUMBER(a)) || !(IS_MATRIX(b) || IS_NUMBER(b))) {
+        runtimeError("Matrices can only be combined with matrices and numbers");
+        return false;
+    }
+    ObjMatrix* result = matrixElementwise(op, a, b);
+    if (result == NULL && IS_MATRIX(a) && IS_MATRIX(b)
+            && (AS_MATRIX(a)->rows != AS_MATRIX(b)->rows || AS_MATRIX(a)->cols != AS_MATRIX(b)->cols)) {
+        runtimeError("Matrix shapes %zux%zu and %zux%zu do not match",
+            AS_MATRIX(a)->rows, AS_MATRIX(a)->cols, AS_MATRIX(b)->rows, AS_MATRIX(b)->cols);
+        return false;
+    }
+    if (result == NULL) {
+        ObjMatrix* shape = IS_MATRIX(a) ? AS_MATRIX(a) : AS_MATRIX(b);
+        runtimeError("Cannot allocate a %zux%zu matrix", shape->rows, shape->cols);
+        return false;
+    }
+    push(OBJ_VAL(result));
+    return true;
+}
+
+#define IS_MATRIX_OPERAND() (IS_MATRIX(peek(0)) || IS_MATRIX(peek(1)))
+
 static void hashmap_err_print_key(hashmap_t* hm, unsigned long index, Value key, Value val, void* data) {
     // TODO print to stderr
     printValue(key);
     printf(" ");
 }
 
-static InterpretResult run(void) {
-    // All on stack, no indirection. TODO cool?
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+static bool getGlobal(ObjString* name, Value* value) {
+    bool notFound = false;
+    *value = hashmap_get(&vm.globals, OBJ_VAL(name), &notFound);
+    if (notFound) {
+        runtimeError("Undefined variable '%s'.", name->chars);
+        ERR_PRINT("Did you mean one of: ");
+        hashmap_iter(&vm.globals, hashmap_err_print_key, NULL);
+        ERR_PRINT("\n");
+        return false;
+    }
+    return true;
+}
 
-#pragma GCC diagnostic ignored "-Wsequence-point"
-#define READ_BYTE() (*frame->ip++)
-#define READ_24BITS() (READ_BYTE() | READ_BYTE() << 8 | READ_BYTE() << 16)
-#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
-#define READ_CONSTANT_LONG() (frame->function->chunk.constants.values[READ_24BITS()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define READ_STRING_LONG() AS_STRING(READ_CONSTANT_LONG())
+static bool setGlobal(ObjString* name, Value value) {
+    if (!hashmap_set(&vm.globals, OBJ_VAL(name), value)) {
+        runtimeError("Undefined variable '%s'.", name->chars);
+        return false;
+    }
+    if (name->builtin) {
+        vm.builtins[name->builtin - 1].replaced = true;
+    }
+    return true;
+}
+
+static void defineGlobal(ObjString* name, Value value) {
+    // Redefining a global, including a native, replaces it
+    if (!hashmap_add(&vm.globals, OBJ_VAL(name), value)) {
+        hashmap_set(&vm.globals, OBJ_VAL(name), value);
+    }
+    if (name->builtin) {
+        vm.builtins[name->builtin - 1].replaced = true;
+    }
+}
+
+// Calls a builtin on the argCount values on top of the stack, the result replaces them. Once
+// its global was replaced, whatever that holds now is called as OP_CALL would, which may push a frame.
+static bool callBuiltin(int index, int argCount) {
+    Builtin* builtin = &vm.builtins[index];
+    if (!builtin->replaced) {
+        ObjNative* func = builtin->native;
+        ARITY_CHECK(func)
+        if (PROFILE_EVENTS) {
+            profileEnter(func->name->chars, "native");
+        }
+        Value result = func->function(argCount, vm.stackTop - argCount);
+        if (nativeFailed()) {
+            return false;
+        }
+        if (PROFILE_EVENTS) {
+            profileLeave();
+        }
+        vm.stackTop -= argCount;
+        push(result);
+        return true;
+    }
+    Value callee;
+    if (!getGlobal(builtin->native->name, &callee)) {
+        return false;
+    }
+    Value* args = vm.stackTop - argCount;
+    memmove(args + 1, args, sizeof(Value) * argCount);
+    args[0] = callee;
+    vm.stackTop++;
+    return callValue(callee, argCount);
+}
+
+// Allocated once at the final size
+static Value buildArray(const Value* values, int count) {
+    ObjArray* array = allocateArray(count);
+    memcpy(array->values, values, count * sizeof(Value));
+    array->length = count;
+    return OBJ_VAL(array);
+}
+
+static void appendArray(ObjArray* array, const Value* values, int count) {
+    if (array->length + count > array->capacity) {
+        size_t capacity = GROW_CAPACITY(array->capacity);
+        reallocArray(array, capacity > array->length + count ? capacity : array->length + count);
+    }
+    memcpy(array->values + array->length, values, count * sizeof(Value));
+    array->length += count;
+}
+
+static void addPairs(ObjHashmap* hm, const Value* pairs, int count) {
+    ownHashmap(hm);
+    for (int i = 0; i < count; i++) {
+        hashmap_add(&hm->map, pairs[2 * i], pairs[2 * i + 1]);
+    }
+}
+
+static Value copyConstant(Value constant) {
+    if (IS_ARRAY(constant)) {
+        return OBJ_VAL(borrowArray(AS_ARRAY(constant)));
+    }
+    return OBJ_VAL(borrowHashmap(AS_HASHMAP(constant)));
+}
 
-#define ARITH_BIN_OP(op) do { \
+#define ARITH_BIN_OP(op, intOp) do { \
     Value b = pop(); \
     Value a = pop(); \
     push(IS_FCOMPLEX(a) || IS_FCOMPLEX(b) \
       ? FCOMPLEX_VAL(AS_FCOMPLEX(a) op AS_FCOMPLEX(b)) \
       : IS_DOUBLE(a) || IS_DOUBLE(b) ? \
         DOUBLE_VAL(AS_DOUBLE(a) op AS_DOUBLE(b)) : \
-        INTEGER_VAL(AS_INTEGER(a) op AS_INTEGER(b))); \
+        intOp(a, b)); \
 } while (false)
 
-#define INT_BIN_OP(op) do { \
-    int b = pop_int(); \
-    int a = pop_int(); \
+#define INT_BIN_OP(op, bigintOp) do { \
+    if (IS_BIGINT(peek(0)) || IS_BIGINT(peek(1))) { \
+        Value b = pop(); \
+        Value a = pop(); \
+        push(bigintOp(a, b)); \
+        break; \
+    } \
+    int64_t b = pop_int(); \
+    int64_t a = pop_int(); \
     push(INTEGER_VAL(a op b)); \
 } while (false)
 
@@ -363,59 +809,505 @@ static InterpretResult run(void) {
     push(DOUBLE_VAL(func(a, b))); \
 } while (false)
 
-    while (true) {
-        if (DEBUG_TRACE) {
-            printf("[ ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-                printValue(*slot);
-                if (slot < vm.stackTop - 1) {
-                    printf(" ");
+// Pops the operands and pushes the result, shared by run() and run_reg()
+static bool stackOp(OpCode op) {
+    switch (op) {
+        case OP_EQUAL: {
+            push(BOOL_VAL(valuesEqual(pop(), pop())));
+            break;
+        }
+        case OP_NOT: push(BOOL_VAL(isFalsey(pop()))); break;
+        case OP_BITNEG: push(IS_BIGINT(peek(0)) ? bigintBitNeg(pop()) : INTEGER_VAL(~pop_int())); break;
+        case OP_SIZE: if (IS_STRING(peek(0))) {
+            push(INTEGER_VAL(strlen(AS_CSTRING(pop()))));
+        } else if (IS_ARRAY(peek(0))) {
+            push(INTEGER_VAL(ARRAY_LENGTH(pop())));
+        } else if (IS_HASHMAP(peek(0))) {
+            push(INTEGER_VAL(HASHMAP_LENGTH(pop())));
+        } else if (IS_MATRIX(peek(0))) {
+            push(INTEGER_VAL(AS_MATRIX(pop())->rows));
+        } else if (IS_MATRIX_ROW(peek(0))) {
+            push(INTEGER_VAL(AS_MATRIX_ROW(pop())->matrix->cols));
+        } else {
+            push(INTEGER_VAL(sizeof(Value)));
+        }
+        break;
+        case OP_GREATER: {
+            Value b = pop();
+            Value a = pop();
+            push(BOOL_VAL(compareNumbers(a, b) > 0));
+            break;
+        }
+        case OP_LESS: {
+            Value b = pop();
+            Value a = pop();
+            push(BOOL_VAL(compareNumbers(a, b) < 0));
+            break;
+        }
+        case OP_ADD: {
+            if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
+                if (!(IS_STRING(peek(0)) && IS_STRING(peek(1)))) {
+                    runtimeError("Strings can only be added to other strings");
+                    return false;
+                }
+                // TODO convert stuff to string
+                // TODO string interpolation whooo, fast string builder?
+                concatenate();
+            } else if (IS_ARRAY(peek(0)) || IS_ARRAY(peek(1))) {
+                if (!(IS_ARRAY(peek(0)) && IS_ARRAY(peek(1)))) {
+                    runtimeError("Arrays can only be added to other arrays");
+                    return false;
                 }
+                concatenateArrays();
+            } else if (IS_MATRIX_OPERAND()) {
+                if (!matrixArith(MATRIX_ADD)) {
+                    return false;
+                }
+            } else {
+                ARITH_BIN_OP(+, intAdd);
             }
-            printf(" ]\n");
-            disInstruction(&frame->function->chunk, frame->ip - frame->function->chunk.code);
+            break;
+        }
+        case OP_SUB: {
+            if (IS_MATRIX_OPERAND()) {
+                if (!matrixArith(MATRIX_SUB)) {
+                    return false;
+                }
+                break;
+            }
+            ARITH_BIN_OP(-, intSub);
+            break;
+        }
+        case OP_MUL: {
+            // Element-wise, use matmul() for the matrix product
+            if (IS_MATRIX_OPERAND()) {
+                if (!matrixArith(MATRIX_MUL)) {
+                    return false;
+                }
+                break;
+            }
+            ARITH_BIN_OP(*, intMul);
+            break;
+        }
+        case OP_DIV: {
+            if (IS_MATRIX_OPERAND()) {
+                if (!matrixArith(MATRIX_DIV)) {
+                    return false;
+                }
+                break;
+            }
+            if (IS_ZERO(peek(0))) {
+                runtimeWarningLog("Ignoring division by zero! Returning infinity.");
+                pop();
+                pop();
+                push(DOUBLE_VAL(INFINITY));
+                break;
+            }
+            ARITH_BIN_OP(/, intDiv);
+            break;
+        }
+        case OP_BITAND: INT_BIN_OP(&, bigintAnd); break;
+        case OP_BITOR: INT_BIN_OP(|, bigintOr); break;
+        case OP_BITXOR: INT_BIN_OP(^, bigintXor); break;
+        case OP_LEFT_SHIFT: {
+            if (IS_BIGINT(peek(0)) || IS_BIGINT(peek(1))) {
+                Value b = pop();
+                Value a = pop();
+                Value result;
+                if (!bigintShiftLeft(a, b, &result)) {
+                    runtimeError("Cannot shift by %s", IS_BIGINT(b) ? "a bigint count" : "that many bits");
+                    return false;
+                }
+                push(result);
+                break;
+            }
+            // Int shifts wrap in 64 bits and take the count mod 64, so 1 << 64 is 1, unlike bigints
+            uint64_t b = (uint64_t)pop_int();
+            uint64_t a = (uint64_t)pop_int();
+            push(INTEGER_VAL((int64_t)(a << (b & 63))));
+            break;
+        }
+        case OP_RIGHT_SHIFT: {
+            if (IS_BIGINT(peek(0)) || IS_BIGINT(peek(1))) {
+                Value b = pop();
+                Value a = pop();
+                Value result;
+                if (!bigintShiftRight(a, b, &result)) {
+                    runtimeError("Cannot shift by %s", IS_BIGINT(b) ? "a bigint count" : "that many bits");
+                    return false;
+                }
+                push(result);
+                break;
+            }
+            // Arithmetic like the bigints: floor(a / 2^b), counts past 63 leave 0 or -1.
+            // A negative count shifts left the way << does.
+            int64_t b = pop_int();
+            int64_t a = pop_int();
+            if (b < 0) {
+                push(INTEGER_VAL((int64_t)((uint64_t)a << ((0 - (uint64_t)b) & 63))));
+            } else {
+                int count = b > 63 ? 63 : (int)b;
+                push(INTEGER_VAL(a < 0 ? ~(~a >> count) : a >> count));
+            }
+            break;
+        }
+        case OP_REMAINDER: {
+            // Exact when a bigint or int is involved, fmod would lose the low digits
+            Value b = peek(0);
+            Value a = peek(1);
+            if ((IS_BIGINT(a) || IS_BIGINT(b))
+                    && (IS_INTEGER(a) || IS_BOOL(a) || IS_BIGINT(a))
+                    && (IS_INTEGER(b) || IS_BOOL(b) || IS_BIGINT(b))) {
+                pop();
+                pop();
+                push(bigintMod(a, b));
+                break;
+            }
+            // Ints stay exact too, truncating like fmod. By 0 it is still fmod's nan.
+            if ((IS_INTEGER(a) || IS_BOOL(a)) && (IS_INTEGER(b) || IS_BOOL(b)) && AS_INTEGER(b) != 0) {
+                int64_t y = pop_int();
+                int64_t x = pop_int();
+                // INT64_MIN % -1 overflows in C, the remainder of any x by -1 is 0
+                push(INTEGER_VAL(y == -1 ? 0 : x % y));
+                break;
+            }
+            DOUBLE_BIN_OP(fmod);
+            break;
         }
-        OpCode instruction;
-        switch (instruction = READ_BYTE()) { // This switch is exhaustive!
-            case OP_INVALID: {
+        case OP_EXP: DOUBLE_BIN_OP(pow); break;
+        default:
+            runtimeError("Unexpected operator %d", op);
+            return false;
+    }
+    return true;
+}
+
+static InterpretResult run_reg(int baseFrame);
+static InterpretResult runCallee(CallFrame* callee);
+
+// Loop back-edges count towards JIT_THRESHOLD too, saturating once they reach it
+static bool hotBackEdge(ObjFunction* function) {
+    if (JIT_THRESHOLD <= 0) {
+        return false;
+    }
+    if (function->hotness < JIT_THRESHOLD) {
+        function->hotness++;
+    }
+    return function->hotness >= JIT_THRESHOLD;
+}
+
+// Moves a stack VM frame that just jumped back from edge to its loop head onto the register VM.
+// Both keep the locals in the same slots and nothing else is on the stack at a loop head.
+static bool enterRegisters(CallFrame* frame, int edge) {
+    ObjFunction* function = frame->function;
+    if (!function->jitTried) {
+        jitFunction(function);
+    }
+    RegCode* reg = function->reg;
+    if (!reg) {
+        return false;
+    }
+    for (int i = 0; i < reg->count; i++) {
+        if (reg->code[i].op == REG_JUMP && reg->offsets[i] == edge) {
+            reserveStack(frame->slots, frameSize(function));
+            frame->pc = reg->code + reg->code[i].a;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sets hooks and the table run() dispatches through, see vm.h
+void setHooks(int newHooks) {
+    hooks = newHooks;
+#if DISPATCH_TABLES
+    // Until run() is first called, it picks the table itself
+    dispatch = dispatchTables[newHooks != 0];
+#endif
+}
+
+// The hooks set now, for toggling one of them
+int getHooks(void) {
+    return hooks;
+}
+
+// Called by run() before each instruction while any hook is on, frame->ip must be saved
+static void instructionHooks(CallFrame* frame, OpCode instruction) {
+    if (hooks & HOOK_TRACE) {
+        printf("[ ");
+        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+            printValue(*slot);
+            if (slot < vm.stackTop - 1) {
+                printf(" ");
+            }
+        }
+        printf(" ]\n");
+        disInstruction(&frame->function->chunk, frameOffset(frame));
+    }
+    if (hooks & HOOK_PROFILE) {
+        profileOp(instruction);
+    }
+}
+
+#if DISPATCH_TABLES
+// Label addresses and computed gotos
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+// Runs until the frame below baseFrame is back on top, or the script ends when that is 0
+static InterpretResult run(int baseFrame) {
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    // The top frame's ip and slots live in locals, frame->ip is only written back by SAVE_IP()
+    // before anything that may read it: runtime errors, calls, natives and the other tiers
+    uint8_t* ip = frame->ip;
+    Value* slots = frame->slots;
+    bool wide = false; // Set by OP_WIDE, cleared by READ_ARG
+
+#define SAVE_IP() (frame->ip = ip)
+// After calls and returns, which may also have moved the stack
+#define LOAD_FRAME() do { \
+    frame = FRAME(vm.frameCount - 1); \
+    ip = frame->ip; \
+    slots = frame->slots; \
+} while (false)
+
+// After a call, a lowered callee runs to completion on its own tier and leaves its result
+// where ours would
+#define FINISH_CALL() do { \
+    LOAD_FRAME(); \
+    if (frame->pc) { \
+        InterpretResult result = runCallee(frame); \
+        if (result != INTERPRET_OK) { \
+            return result; \
+        } \
+        LOAD_FRAME(); \
+    } \
+} while (false)
+// Builtins with an instruction of their own are called like the others once replaced
+#define CALL_REPLACED(id, argCount) do { \
+    SAVE_IP(); \
+    if (!callBuiltin(id, argCount)) { \
+        return INTERPRET_RUNTIME_ERROR; \
+    } \
+    FINISH_CALL(); \
+} while (false)
+
+#pragma GCC diagnostic ignored "-Wsequence-point"
+#define READ_BYTE() (*ip++)
+#define READ_24BITS() (READ_BYTE() | READ_BYTE() << 8 | READ_BYTE() << 16)
+// One byte, or 24 bits right after an OP_WIDE prefix
+#define READ_ARG() (wide ? (wide = false, READ_24BITS()) : READ_BYTE())
+#define READ_CONSTANT() (frame->function->chunk.constants.values[READ_ARG()])
+#define READ_CONSTANT_LONG() (frame->function->chunk.constants.values[READ_24BITS()])
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+
+#if DISPATCH_TABLES
+// Also a label the tables jump to, skipping the switch
+#define CASE(op) case op: label_##op
+#define LABEL(op) [op] = &&label_##op
+    // Every opcode needs its entry, bytes above them are invalid instructions
+    static const void* const plain[UINT8_COUNT] = {
+        LABEL(OP_INVALID),
+        LABEL(OP_RETURN),
+        LABEL(OP_PRINT),
+        LABEL(OP_POP),
+        LABEL(OP_SWAP),
+        LABEL(OP_CALL),
+        LABEL(OP_TAIL_CALL),
+        LABEL(OP_CALL_BUILTIN),
+        LABEL(OP_TYPEOF),
+        LABEL(OP_ARRAY_SET),
+        LABEL(OP_ARRAY_POP),
+        LABEL(OP_WIDE),
+        LABEL(OP_DEFINE_GLOBAL),
+        LABEL(OP_GET_GLOBAL),
+        LABEL(OP_SET_GLOBAL),
+        LABEL(OP_GET_LOCAL),
+        LABEL(OP_SET_LOCAL),
+        LABEL(OP_JUMP_IF_FALSE),
+        LABEL(OP_JUMP),
+        LABEL(OP_NEG_JUMP),
+        LABEL(OP_CONSTANT),
+        LABEL(OP_NIL),
+        LABEL(OP_TRUE),
+        LABEL(OP_FALSE),
+        LABEL(OP_NAN),
+        LABEL(OP_INF),
+        LABEL(OP_BUILD_ARRAY),
+        LABEL(OP_APPEND_ARRAY),
+        LABEL(OP_SUBSCRIPT),
+        LABEL(OP_BUILD_HASHMAP),
+        LABEL(OP_APPEND_HASHMAP),
+        LABEL(OP_COPY_CONSTANT),
+        LABEL(OP_NEG),
+        LABEL(OP_ADD),
+        LABEL(OP_SUB),
+        LABEL(OP_MUL),
+        LABEL(OP_DIV),
+        LABEL(OP_REMAINDER),
+        LABEL(OP_EXP),
+        LABEL(OP_BITAND),
+        LABEL(OP_BITOR),
+        LABEL(OP_BITXOR),
+        LABEL(OP_BITNEG),
+        LABEL(OP_LEFT_SHIFT),
+        LABEL(OP_RIGHT_SHIFT),
+        LABEL(OP_SIZE),
+        LABEL(OP_NOT),
+        LABEL(OP_EQUAL),
+        LABEL(OP_GREATER),
+        LABEL(OP_LESS),
+        [OP_COUNT ... UINT8_COUNT - 1] = &&label_OP_INVALID,
+    };
+    // Runs the hooks, then the instruction through plain
+    static const void* const hooked[UINT8_COUNT] = {[0 ... UINT8_COUNT - 1] = &&runHooks};
+    if (!dispatchTables[0]) {
+        // An opcode without its LABEL() would jump to address 0
+        for (int op = 0; op < OP_COUNT; op++) {
+            if (!plain[op]) {
+                ERR_PRINT("Opcode %d has no entry in the dispatch table of run()\n", op);
+                exit(1);
+            }
+        }
+        dispatchTables[0] = plain;
+        dispatchTables[1] = hooked;
+        dispatch = dispatchTables[hooks != 0];
+    }
+#undef LABEL
+#else
+#define CASE(op) case op
+#endif
+
+    while (true) {
+        OpCode instruction = READ_BYTE();
+#if DISPATCH_TABLES
+        goto *dispatch[instruction];
+runHooks:
+        SAVE_IP();
+        instructionHooks(frame, instruction);
+        goto *plain[instruction];
+#else
+        if (hooks) {
+            SAVE_IP();
+            instructionHooks(frame, instruction);
+        }
+#endif
+        switch (instruction) { // This switch is exhaustive!
+            CASE(OP_INVALID): {
+                SAVE_IP();
                 runtimeError("Unexpected null instruction!");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_RETURN: {
+            CASE(OP_RETURN): {
                 Value result = pop();
                 vm.frameCount--;
+                if (PROFILE_EVENTS) {
+                    profileLeave();
+                }
                 if (vm.frameCount == 0) {
-                    pop();
+                    // Also when a chunk built by hand returns without a value
+                    vm.stackTop = slots;
                     return INTERPRET_OK;
                 }
-                vm.stackTop = frame->slots;
+                vm.stackTop = slots;
                 push(result);
-                frame = &vm.frames[vm.frameCount - 1];
+                if (vm.frameCount == baseFrame) {
+                    return INTERPRET_OK;
+                }
+                LOAD_FRAME();
                 break;
             }
-            case OP_PRINT: {
+            CASE(OP_PRINT): {
                 if (size()) {
                     printValue(pop());
                     printf("\n");
                 }
                 break;
             }
-            case OP_CALL: {
+            CASE(OP_CALL): {
+                uint8_t argCount = READ_BYTE();
+                SAVE_IP();
+                Chunk* chunk = &frame->function->chunk;
+                if (!callSite(chunk, (int)(ip - chunk->code) - 2, peek(argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                FINISH_CALL();
+                break;
+            }
+            CASE(OP_CALL_BUILTIN): {
+                uint8_t index = READ_BYTE();
                 uint8_t argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
+                SAVE_IP();
+                if (!callBuiltin(index, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
+                FINISH_CALL();
+                break;
+            }
+            CASE(OP_TYPEOF):
+                if (vm.builtins[BUILTIN_TYPE].replaced) {
+                    CALL_REPLACED(BUILTIN_TYPE, 1);
+                    break;
+                }
+                vm.stackTop[-1] = OBJ_VAL(vm.typeNames[vm.stackTop[-1].type]);
+                break;
+            CASE(OP_ARRAY_SET): {
+                if (vm.builtins[BUILTIN_SET_ARRAY].replaced) {
+                    CALL_REPLACED(BUILTIN_SET_ARRAY, 3);
+                    break;
+                }
+                Value value = pop();
+                Value index = pop();
+                insertArray(AS_ARRAY(peek(0)), AS_INTEGER(index), value);
+                vm.stackTop[-1] = NIL_VAL;
                 break;
             }
-            case OP_SUBSCRIPT: {
+            CASE(OP_ARRAY_POP):
+                if (vm.builtins[BUILTIN_RM_ARRAY_TOP].replaced) {
+                    CALL_REPLACED(BUILTIN_RM_ARRAY_TOP, 1);
+                    break;
+                }
+                AS_ARRAY(peek(0))->length--;
+                vm.stackTop[-1] = NIL_VAL;
+                break;
+            CASE(OP_TAIL_CALL): {
+                uint8_t argCount = READ_BYTE();
+                SAVE_IP();
+                Value callee = peek(argCount);
+                if (!IS_FUNCTION(callee)) {
+                    // Natives return normally, through the OP_RETURN after this. One that called
+                    // back into Lox, like bench(), may have moved the stack under the frame.
+                    if (!callValue(callee, argCount)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    LOAD_FRAME();
+                    break;
+                }
+                if (!tailCall(AS_FUNCTION(callee), vm.stackTop - argCount - 1, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (frame->pc) {
+                    // A lowered callee finishes the call on its own tier
+                    InterpretResult result = runCallee(frame);
+                    if (result != INTERPRET_OK) {
+                        return result;
+                    }
+                    if (vm.frameCount == baseFrame) {
+                        return INTERPRET_OK;
+                    }
+                }
+                LOAD_FRAME();
+                break;
+            }
+            CASE(OP_SUBSCRIPT): {
+                SAVE_IP();
                 Value key = pop();
                 if (!subscript(key)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
-            case OP_SWAP: {
+            CASE(OP_SWAP): {
                 if (size()) {
                     Value a = pop();
                     Value b = pop();
@@ -424,181 +1316,690 @@ static InterpretResult run(void) {
                 }
                 break;
             }
-            case OP_POP:
+            CASE(OP_POP):
                 if (size()) {
                     pop();
                 }
                 break;
-            case OP_DEFINE_GLOBAL:
-            case OP_DEFINE_GLOBAL_LONG: {
-                ObjString* name = (instruction == OP_DEFINE_GLOBAL) ? READ_STRING() : READ_STRING_LONG();
-                hashmap_add(&vm.globals, OBJ_VAL(name), pop());
+            CASE(OP_WIDE):
+                wide = true;
+                break;
+            CASE(OP_DEFINE_GLOBAL): {
+                ObjString* name = READ_STRING();
+                defineGlobal(name, pop());
                 break;
             }
-            case OP_SET_GLOBAL_LONG:
-            case OP_SET_GLOBAL: {
-                ObjString* name = (instruction == OP_SET_GLOBAL) ? READ_STRING() : READ_STRING_LONG();
-                if (!hashmap_set(&vm.globals, OBJ_VAL(name), peek(0))) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
+            CASE(OP_SET_GLOBAL): {
+                SAVE_IP();
+                if (!setGlobal(READ_STRING(), peek(0))) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
-            case OP_GET_GLOBAL_LONG:
-            case OP_GET_GLOBAL: {
-                ObjString* name = (instruction == OP_GET_GLOBAL) ? READ_STRING() : READ_STRING_LONG();
-                bool notFound = false;
-                Value value = hashmap_get(&vm.globals, OBJ_VAL(name), &notFound);
-                if (notFound) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    ERR_PRINT("Did you mean one of: ");
-                    hashmap_iter(&vm.globals, hashmap_err_print_key, NULL);
-                    ERR_PRINT("\n");
+            CASE(OP_GET_GLOBAL): {
+                SAVE_IP();
+                Value value;
+                if (!getGlobal(READ_STRING(), &value)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 push(value);
                 break;
             }
-            case OP_SET_LOCAL_LONG:
-            case OP_SET_LOCAL: {
-                int slot = (instruction == OP_SET_LOCAL) ? READ_BYTE() : READ_24BITS();
-                frame->slots[slot] = peek(0);
-                break;
-            }
-            case OP_GET_LOCAL_LONG:
-            case OP_GET_LOCAL: {
-                int slot = (instruction == OP_GET_LOCAL) ? READ_BYTE() : READ_24BITS();
-                push(frame->slots[slot]);
+            CASE(OP_SET_LOCAL): {
+                int slot = READ_ARG();
+                slots[slot] = peek(0);
                 break;
             }
-            case OP_EQUAL: {
-                push(BOOL_VAL(valuesEqual(pop(), pop())));
+            CASE(OP_GET_LOCAL): {
+                int slot = READ_ARG();
+                push(slots[slot]);
                 break;
             }
-            case OP_JUMP: {
+            CASE(OP_JUMP): {
                 int offset = READ_24BITS();
-                frame->ip += offset; // wat about negative
+                ip += offset; // wat about negative
                 break;
             }
-            case OP_NEG_JUMP: {
+            CASE(OP_NEG_JUMP): {
                 int offset = READ_24BITS();
-                frame->ip -= offset; // wat about negative
+                int edge = (int)(ip - frame->function->chunk.code) - 4;
+                ip -= offset; // wat about negative
+                if (hotBackEdge(frame->function) && enterRegisters(frame, edge)) {
+                    // The rest of this call runs on the register VM, which traces its loops
+                    InterpretResult result = run_reg(vm.frameCount - 1);
+                    if (result != INTERPRET_OK) {
+                        return result;
+                    }
+                    if (vm.frameCount <= baseFrame) {
+                        return INTERPRET_OK;
+                    }
+                    LOAD_FRAME();
+                }
                 break;
             }
-            case OP_JUMP_IF_FALSE: {
+            CASE(OP_JUMP_IF_FALSE): {
                 int offset = READ_24BITS();
                 if (isFalsey(peek(0))) {
-                    frame->ip += offset; // wat about negative
+                    ip += offset; // wat about negative
                 }
                 break;
             }
-            case OP_INIT_ARRAY: {
-                ObjArray* array = allocateArray(16);
-                push(OBJ_VAL(array));
+            CASE(OP_BUILD_ARRAY): {
+                int count = READ_24BITS();
+                vm.stackTop -= count;
+                push(buildArray(vm.stackTop, count));
                 break;
             }
-            case OP_INSERT_ARRAY: {
-                Value value = pop();
-                ObjArray* array = AS_ARRAY(peek(0));
-                insertArray(array, array->length, value);
+            CASE(OP_APPEND_ARRAY): {
+                int count = READ_24BITS();
+                appendArray(AS_ARRAY(peek(count)), vm.stackTop - count, count);
+                vm.stackTop -= count;
                 break;
             }
-            case OP_INIT_HASHMAP: {
-                ObjHashmap* hm = allocateHashmap(8);
-                push(OBJ_VAL(hm));
+            CASE(OP_BUILD_HASHMAP):
+            CASE(OP_APPEND_HASHMAP): {
+                int count = READ_24BITS();
+                Value* pairs = vm.stackTop - 2 * count;
+                ObjHashmap* hm = instruction == OP_BUILD_HASHMAP
+                    ? allocateHashmap(hashmap_capacity_for(count))
+                    : AS_HASHMAP(pairs[-1]);
+                addPairs(hm, pairs, count);
+                vm.stackTop = pairs;
+                if (instruction == OP_BUILD_HASHMAP) {
+                    push(OBJ_VAL(hm));
+                }
                 break;
             }
-            case OP_INSERT_HASHMAP: {
-                Value value = pop();
-                Value key = pop();
-                ObjHashmap* hm = AS_HASHMAP(peek(0));
-                hashmap_add(&hm->map, key, value);
-                break;
-            }
-            case OP_CONSTANT: push(READ_CONSTANT()); break;
-            case OP_CONSTANT_LONG: push(READ_CONSTANT_LONG()); break;
-            case OP_NOT: push(BOOL_VAL(isFalsey(pop()))); break;
-            case OP_BITNEG: push(INTEGER_VAL(~pop_int())); break;
-            case OP_SIZE: if (IS_STRING(peek(0))) {
-                push(INTEGER_VAL(strlen(AS_CSTRING(pop()))));
-            } else if (IS_ARRAY(peek(0))) {
-                push(INTEGER_VAL(ARRAY_LENGTH(pop())));
-            } else if (IS_HASHMAP(peek(0))) {
-                push(INTEGER_VAL(HASHMAP_LENGTH(pop())));
-            } else {
-                push(INTEGER_VAL(sizeof(Value)));
+            CASE(OP_COPY_CONSTANT): push(copyConstant(READ_CONSTANT_LONG())); break;
+            CASE(OP_CONSTANT): push(READ_CONSTANT()); break;
+            CASE(OP_NEG): {
+                SAVE_IP();
+                push(INTEGER_VAL(-1));
+                if (!stackOp(OP_MUL)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
             }
+            CASE(OP_NOT):
+            CASE(OP_BITNEG):
+            CASE(OP_SIZE):
+            CASE(OP_EQUAL):
+            CASE(OP_GREATER):
+            CASE(OP_LESS):
+            CASE(OP_ADD):
+            CASE(OP_SUB):
+            CASE(OP_MUL):
+            CASE(OP_DIV):
+            CASE(OP_REMAINDER):
+            CASE(OP_EXP):
+            CASE(OP_BITAND):
+            CASE(OP_BITOR):
+            CASE(OP_BITXOR):
+            CASE(OP_LEFT_SHIFT):
+            CASE(OP_RIGHT_SHIFT):
+                SAVE_IP();
+                if (!stackOp(instruction)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            CASE(OP_NIL): push(NIL_VAL); break;
+            CASE(OP_FALSE): push(BOOL_VAL(false)); break;
+            CASE(OP_TRUE): push(BOOL_VAL(true)); break;
+            CASE(OP_INF): push(DOUBLE_VAL(INFINITY)); break;
+            CASE(OP_NAN): push(DOUBLE_VAL(NAN)); break;
+        }
+    }
+#undef SAVE_IP
+#undef LOAD_FRAME
+#undef FINISH_CALL
+#undef CALL_REPLACED
+#undef CASE
+}
+#if DISPATCH_TABLES
+#pragma GCC diagnostic pop
+#endif
+
+#define RK(operand) (IS_REG_K(operand) ? reg->constants[(operand) & REG_MAX] : slots[operand])
+#define K(operand) (reg->constants[(operand) & REG_MAX])
+#define LESS(a, b) (IS_INTEGER(a) && IS_INTEGER(b) ? AS_INTEGER(a) < AS_INTEGER(b) : compareNumbers(a, b) < 0)
+#define GREATER(a, b) (IS_INTEGER(a) && IS_INTEGER(b) ? AS_INTEGER(a) > AS_INTEGER(b) : compareNumbers(a, b) > 0)
+#define EQUAL(a, b) (IS_INTEGER(a) && IS_INTEGER(b) ? AS_INTEGER(a) == AS_INTEGER(b) : valuesEqual(a, b))
+
+// One register instruction that neither jumps nor calls, in full generality.
+// The slow path of run_reg() and of code from the JIT.
+bool regOp(CallFrame* frame, RegInstr* instr) {
+    RegCode* reg = frame->function->reg;
+    Value* slots = frame->slots;
+    frame->pc = instr + 1;
+    // Scratch space for the stack VM's operators starts above the registers
+    vm.stackTop = slots + reg->registers;
+
+// Anything off the fast paths runs through the stack VM's own implementation
+#define STACK_BINARY(op) do { \
+    push(RK(instr->b)); \
+    push(RK(instr->c)); \
+    if (!stackOp(op)) { \
+        return false; \
+    } \
+    slots[instr->a] = pop(); \
+} while (false)
+#define STACK_UNARY(op) do { \
+    push(RK(instr->b)); \
+    if (!stackOp(op)) { \
+        return false; \
+    } \
+    slots[instr->a] = pop(); \
+} while (false)
+
+    switch ((RegOp)instr->op) {
+        case REG_MOVE: slots[instr->a] = RK(instr->b); break;
+        case REG_GET_GLOBAL: return getGlobal(AS_STRING(K(instr->b)), &slots[instr->a]);
+        case REG_SET_GLOBAL: return setGlobal(AS_STRING(K(instr->a)), RK(instr->b));
+        case REG_DEFINE_GLOBAL: defineGlobal(AS_STRING(K(instr->a)), RK(instr->b)); break;
+        case REG_ADD: STACK_BINARY(OP_ADD); break;
+        case REG_SUB: STACK_BINARY(OP_SUB); break;
+        case REG_MUL: STACK_BINARY(OP_MUL); break;
+        case REG_DIV: {
+            Value a = RK(instr->b);
+            Value b = RK(instr->c);
+            if (!IS_MATRIX(a) && !IS_MATRIX(b) && IS_ZERO(b)) {
+                runtimeWarningLog("Ignoring division by zero! Returning infinity.");
+                slots[instr->a] = DOUBLE_VAL(INFINITY);
+                break;
+            }
+            STACK_BINARY(OP_DIV);
             break;
-            case OP_GREATER: {
-                Value b = pop();
-                Value a = pop();
-                push(IS_DOUBLE(a) || IS_DOUBLE(b) ? \
-                    BOOL_VAL(AS_DOUBLE(a) > AS_DOUBLE(b)) : \
-                    BOOL_VAL(AS_INTEGER(a) > AS_INTEGER(b))); \
+        }
+        case REG_REMAINDER: STACK_BINARY(OP_REMAINDER); break;
+        case REG_EXP: STACK_BINARY(OP_EXP); break;
+        case REG_BITAND: STACK_BINARY(OP_BITAND); break;
+        case REG_BITOR: STACK_BINARY(OP_BITOR); break;
+        case REG_BITXOR: STACK_BINARY(OP_BITXOR); break;
+        case REG_LEFT_SHIFT: STACK_BINARY(OP_LEFT_SHIFT); break;
+        case REG_RIGHT_SHIFT: STACK_BINARY(OP_RIGHT_SHIFT); break;
+        case REG_EQUAL:
+        case REG_GREATER:
+        case REG_LESS: {
+            Value a = RK(instr->b);
+            Value b = RK(instr->c);
+            bool result = instr->op == REG_EQUAL ? EQUAL(a, b) : instr->op == REG_LESS ? LESS(a, b) : GREATER(a, b);
+            slots[instr->a] = BOOL_VAL(result);
+            break;
+        }
+        case REG_NOT: slots[instr->a] = BOOL_VAL(isFalsey(RK(instr->b))); break;
+        case REG_BITNEG: STACK_UNARY(OP_BITNEG); break;
+        case REG_SIZE: STACK_UNARY(OP_SIZE); break;
+        case REG_SUBSCRIPT: {
+            push(RK(instr->b));
+            if (!subscript(RK(instr->c))) {
+                return false;
+            }
+            slots[instr->a] = pop();
+            break;
+        }
+        case REG_PRINT: {
+            printValue(RK(instr->b));
+            printf("\n");
+            break;
+        }
+        case REG_BUILD_ARRAY: slots[instr->a] = buildArray(slots + instr->a, instr->b); break;
+        case REG_APPEND_ARRAY: appendArray(AS_ARRAY(slots[instr->a]), slots + instr->a + 1, instr->b); break;
+        case REG_BUILD_HASHMAP: {
+            ObjHashmap* hm = allocateHashmap(hashmap_capacity_for(instr->b));
+            addPairs(hm, slots + instr->a, instr->b);
+            slots[instr->a] = OBJ_VAL(hm);
+            break;
+        }
+        case REG_APPEND_HASHMAP: addPairs(AS_HASHMAP(slots[instr->a]), slots + instr->a + 1, instr->b); break;
+        case REG_COPY_CONSTANT: slots[instr->a] = copyConstant(K(instr->b)); break;
+        case REG_CALL_BUILTIN: {
+            // The arguments move to the scratch space, where a replaced builtin's callee fits below them
+            memcpy(vm.stackTop, slots + instr->a, sizeof(Value) * instr->b);
+            vm.stackTop += instr->b;
+            if (!callBuiltin(instr->c, instr->b)) {
+                return false;
+            }
+            CallFrame* callee = FRAME(vm.frameCount - 1);
+            if (callee != frame && runCallee(callee) != INTERPRET_OK) {
+                return false;
+            }
+            frame->slots[instr->a] = pop();
+            break;
+        }
+        case REG_JUMP:
+        case REG_JUMP_IF_FALSE:
+        case REG_JUMP_IF_NOT_EQUAL:
+        case REG_JUMP_IF_NOT_GREATER:
+        case REG_JUMP_IF_NOT_LESS:
+        case REG_CALL:
+        case REG_TAIL_CALL:
+        case REG_RETURN:
+            runtimeError("Unexpected control flow instruction %d", instr->op);
+            return false;
+    }
+    return true;
+#undef STACK_BINARY
+#undef STACK_UNARY
+}
+
+// Whether a fused compare-and-jump falls through
+bool regCompare(CallFrame* frame, RegInstr* instr) {
+    RegCode* reg = frame->function->reg;
+    Value* slots = frame->slots;
+    Value a = RK(instr->b);
+    Value b = RK(instr->c);
+    switch ((RegOp)instr->op) {
+        case REG_JUMP_IF_NOT_EQUAL: return EQUAL(a, b);
+        case REG_JUMP_IF_NOT_GREATER: return GREATER(a, b);
+        case REG_JUMP_IF_NOT_LESS: return LESS(a, b);
+        default: return false;
+    }
+}
+
+// Runs the frame call() just pushed until it returns, on whichever tier it was called for
+static InterpretResult runCallee(CallFrame* callee) {
+    char here;
+    if (vm.nativeStackBase - (uintptr_t)&here > NATIVE_STACK_MAX) {
+        // The callee has not started, the error is at its call
+        vm.frameCount--;
+        runtimeError("Stack overflow.");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    if (!callee->pc) {
+        return run(vm.frameCount - 1);
+    }
+    JitCode native = callee->function->reg->native;
+    if (!native) {
+        return run_reg(vm.frameCount - 1);
+    }
+    vm.stackTop = callee->slots + callee->function->reg->registers;
+    if (!native(callee)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    // Its RETURN left the result in slots[0], where the stack VM wants it too
+    vm.frameCount--;
+    vm.stackTop = callee->slots + 1;
+    return INTERPRET_OK;
+}
+
+// REG_CALL for code from the JIT, the callee runs to completion
+bool regCall(CallFrame* frame, RegInstr* instr) {
+    frame->pc = instr + 1;
+    vm.stackTop = frame->slots + instr->a + instr->b + 1;
+    RegCode* reg = frame->function->reg;
+    if (!callSite(&frame->function->chunk, reg->offsets[instr - reg->code], frame->slots[instr->a], instr->b)) {
+        return false;
+    }
+    CallFrame* callee = FRAME(vm.frameCount - 1);
+    if (callee != frame && runCallee(callee) != INTERPRET_OK) {
+        return false;
+    }
+    vm.stackTop = frame->slots + frame->function->reg->registers;
+    return true;
+}
+
+// Calls callee without arguments from a native and runs it to completion on whichever tier it
+// is on. The native's arguments stay below, but may have moved with the stack.
+static bool callFromNative(Value callee) {
+    reserveStack(vm.stackTop, 1);
+    push(callee);
+    int frames = vm.frameCount;
+    if (!callValue(callee, 0)) {
+        return false;
+    }
+    if (vm.frameCount > frames && runCallee(FRAME(vm.frameCount - 1)) != INTERPRET_OK) {
+        return false;
+    }
+    pop();
+    return true;
+}
+
+// Calls callee count times and sets nanos to how long that took. False when a call raised a
+// runtime error, which unwound the frames of bench()'s caller too.
+static bool benchRun(Value callee, int64_t count, uint64_t* nanos) {
+    uint64_t start = profileNanos();
+    for (int64_t i = 0; i < count; i++) {
+        if (!callFromNative(callee)) {
+            vm.nativeError = true;
+            return false;
+        }
+    }
+    *nanos = profileNanos() - start;
+    return true;
+}
+
+// One sample is kept per run to sort them
+#define BENCH_MAX_RUNS 1000000
+
+static int64_t benchOption(Value opts, const char* key, int64_t fallback) {
+    if (!IS_HASHMAP(opts)) {
+        return fallback;
+    }
+    bool missing;
+    Value value = hashmap_get(&AS_HASHMAP(opts)->map, OBJ_VAL(copyString(key, strlen(key))), &missing);
+    return !missing && IS_INTEGER(value) && AS_INTEGER(value) >= 0 ? AS_INTEGER(value) : fallback;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// bench(fn) or bench(fn, {"warmup": calls, "runs": samples, "iterations": calls per sample,
+// "targetNanos": sample length when scaling}) times fn() and returns nanoseconds per call.
+// Without "iterations" these double until a sample takes targetNanos, which also warms up.
+static Value FFI_bench(int argCount, Value* args) {
+    // Read before calling, the stack may move under args
+    Value callee = argCount > 0 ? args[0] : NIL_VAL;
+    Value opts = argCount > 1 ? args[1] : NIL_VAL;
+    if (argCount > 2 || !(IS_FUNCTION(callee) || IS_NATIVE(callee))) {
+        ERR_PRINT("bench() expects a function and optionally a hashmap of options\n");
+        return NIL_VAL;
+    }
+    int64_t runs = benchOption(opts, "runs", 20);
+    if (runs == 0) {
+        runs = 1;
+    }
+    int64_t iterations = benchOption(opts, "iterations", 0);
+    if (runs > BENCH_MAX_RUNS || iterations > INT32_MAX) {
+        ERR_PRINT("bench() takes at most %d runs of %d iterations\n", BENCH_MAX_RUNS, INT32_MAX);
+        return NIL_VAL;
+    }
+    uint64_t target = benchOption(opts, "targetNanos", 1000000);
+    uint64_t nanos;
+    if (!benchRun(callee, benchOption(opts, "warmup", 1), &nanos)) {
+        return NIL_VAL;
+    }
+    if (!iterations) {
+        iterations = 1;
+        while (true) {
+            if (!benchRun(callee, iterations, &nanos)) {
+                return NIL_VAL;
+            }
+            if (nanos >= target || iterations >= INT32_MAX) {
                 break;
             }
-            case OP_LESS: {
-                Value b = pop();
-                Value a = pop();
-                push(IS_DOUBLE(a) || IS_DOUBLE(b) ? \
-                    BOOL_VAL(AS_DOUBLE(a) < AS_DOUBLE(b)) : \
-                    BOOL_VAL(AS_INTEGER(a) < AS_INTEGER(b))); \
+            iterations *= 2;
+        }
+    }
+
+    uint64_t instructions = profileInstructions();
+    uint64_t allocations, bytes;
+    profileAllocations(&allocations, &bytes);
+    double* samples = ALLOCATE(double, runs);
+    double total = 0;
+    for (int64_t i = 0; i < runs; i++) {
+        if (!benchRun(callee, iterations, &nanos)) {
+            FREE_ARRAY(double, samples, runs);
+            return NIL_VAL;
+        }
+        samples[i] = (double)nanos / iterations;
+        total += samples[i];
+    }
+    qsort(samples, runs, sizeof(double), compareDoubles);
+    double calls = (double)runs * iterations;
+
+    ObjHashmap* result = allocateHashmap(16);
+    setStat(result, "runs", INTEGER_VAL(runs));
+    setStat(result, "iterations", INTEGER_VAL(iterations));
+    setStat(result, "min", DOUBLE_VAL(samples[0]));
+    setStat(result, "median", DOUBLE_VAL(runs % 2 ? samples[runs / 2] : (samples[runs / 2 - 1] + samples[runs / 2]) / 2));
+    // Nearest rank
+    setStat(result, "p99", DOUBLE_VAL(samples[(runs * 99 + 99) / 100 - 1]));
+    setStat(result, "max", DOUBLE_VAL(samples[runs - 1]));
+    setStat(result, "mean", DOUBLE_VAL(total / runs));
+    if (PROFILE_OPS) {
+        setStat(result, "instructions", DOUBLE_VAL((profileInstructions() - instructions) / calls));
+    }
+    if (PROFILE_HEAP) {
+        uint64_t allocationsAfter, bytesAfter;
+        profileAllocations(&allocationsAfter, &bytesAfter);
+        setStat(result, "allocations", DOUBLE_VAL((allocationsAfter - allocations) / calls));
+        setStat(result, "bytes", DOUBLE_VAL((bytesAfter - bytes) / calls));
+    }
+    FREE_ARRAY(double, samples, runs);
+    return OBJ_VAL(result);
+}
+
+// Register code reads its operands in place, from frame->slots or the constants
+static InterpretResult run_reg(int baseFrame) {
+    CallFrame* frame = FRAME(vm.frameCount - 1);
+    RegCode* reg = frame->function->reg;
+    Value* slots = frame->slots;
+    // Scratch space for the slow paths and for arguments of natives starts above the registers
+    vm.stackTop = slots + reg->registers;
+
+#define FAST_ARITH(op, overflow) do { \
+    Value a = RK(instr->b); \
+    Value b = RK(instr->c); \
+    int64_t result; \
+    if (IS_INTEGER(a) && IS_INTEGER(b) && !overflow(AS_INTEGER(a), AS_INTEGER(b), &result)) { \
+        slots[instr->a] = INTEGER_VAL(result); \
+    } else if (IS_DOUBLE(a) && IS_DOUBLE(b)) { \
+        slots[instr->a] = DOUBLE_VAL(AS_DOUBLE(a) op AS_DOUBLE(b)); \
+    } else if (!regOp(frame, instr)) { \
+        return INTERPRET_RUNTIME_ERROR; \
+    } \
+} while (false)
+// After a call or return switches frames
+#define LOAD_FRAME() do { \
+    frame = FRAME(vm.frameCount - 1); \
+    reg = frame->function->reg; \
+    slots = frame->slots; \
+    vm.stackTop = slots + reg->registers; \
+} while (false)
+
+    while (true) {
+        RegInstr* instr = frame->pc++;
+        // Without tables, checked like run() does when built with -DDISPATCH_TABLES=0
+        if (hooks & HOOK_TRACE) {
+            printf("[ ");
+            for (int i = 0; i < reg->registers; i++) {
+                printValue(slots[i]);
+                if (i < reg->registers - 1) {
+                    printf(" ");
+                }
+            }
+            printf(" ]\n");
+            disRegInstruction(reg, (int)(instr - reg->code));
+        }
+        switch ((RegOp)instr->op) { // This switch is exhaustive!
+            case REG_MOVE: slots[instr->a] = RK(instr->b); break;
+            case REG_ADD: FAST_ARITH(+, __builtin_add_overflow); break;
+            case REG_SUB: FAST_ARITH(-, __builtin_sub_overflow); break;
+            case REG_MUL: FAST_ARITH(*, __builtin_mul_overflow); break;
+            case REG_EQUAL: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                slots[instr->a] = BOOL_VAL(EQUAL(a, b));
+                break;
+            }
+            case REG_GREATER: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                slots[instr->a] = BOOL_VAL(GREATER(a, b));
                 break;
             }
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
-                    if (!(IS_STRING(peek(0)) && IS_STRING(peek(1)))) {
-                        runtimeError("Strings can only be added to other strings");
+            case REG_LESS: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                slots[instr->a] = BOOL_VAL(LESS(a, b));
+                break;
+            }
+            case REG_NOT: slots[instr->a] = BOOL_VAL(isFalsey(RK(instr->b))); break;
+            case REG_SUBSCRIPT: {
+                Value object = RK(instr->b);
+                Value key = RK(instr->c);
+                if (IS_ARRAY(object) && IS_INTEGER(key)
+                        && AS_INTEGER(key) >= 0 && AS_INTEGER(key) < ARRAY_LENGTH(object)) {
+                    slots[instr->a] = AS_ARRAY(object)->values[AS_INTEGER(key)];
+                } else if (!regOp(frame, instr)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case REG_GET_GLOBAL:
+            case REG_SET_GLOBAL:
+            case REG_DEFINE_GLOBAL:
+            case REG_DIV:
+            case REG_REMAINDER:
+            case REG_EXP:
+            case REG_BITAND:
+            case REG_BITOR:
+            case REG_BITXOR:
+            case REG_LEFT_SHIFT:
+            case REG_RIGHT_SHIFT:
+            case REG_BITNEG:
+            case REG_SIZE:
+            case REG_PRINT:
+            case REG_BUILD_ARRAY:
+            case REG_APPEND_ARRAY:
+            case REG_BUILD_HASHMAP:
+            case REG_APPEND_HASHMAP:
+            case REG_COPY_CONSTANT:
+                if (!regOp(frame, instr)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            case REG_JUMP: {
+                frame->pc = reg->code + instr->a;
+                if (instr->a <= instr - reg->code && hotBackEdge(frame->function)) {
+                    int next = traceLoop(frame, instr->a);
+                    if (next < 0) {
                         return INTERPRET_RUNTIME_ERROR;
                     }
-                    // TODO convert stuff to string
-                    // TODO string interpolation whooo, fast string builder?
-                    concatenate();
-                } else if (IS_ARRAY(peek(0)) || IS_ARRAY(peek(1))) {
-                    if (!(IS_ARRAY(peek(0)) && IS_ARRAY(peek(1)))) {
-                        runtimeError("Arrays can only be added to other arrays");
+                    frame->pc = reg->code + next;
+                }
+                break;
+            }
+            case REG_JUMP_IF_FALSE: {
+                if (isFalsey(RK(instr->b))) {
+                    frame->pc = reg->code + instr->a;
+                }
+                break;
+            }
+            case REG_JUMP_IF_NOT_EQUAL: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                if (!EQUAL(a, b)) {
+                    frame->pc = reg->code + instr->a;
+                }
+                break;
+            }
+            case REG_JUMP_IF_NOT_GREATER: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                if (!GREATER(a, b)) {
+                    frame->pc = reg->code + instr->a;
+                }
+                break;
+            }
+            case REG_JUMP_IF_NOT_LESS: {
+                Value a = RK(instr->b);
+                Value b = RK(instr->c);
+                if (!LESS(a, b)) {
+                    frame->pc = reg->code + instr->a;
+                }
+                break;
+            }
+            case REG_TAIL_CALL:
+                if (IS_FUNCTION(slots[instr->a])) {
+                    if (!tailCall(AS_FUNCTION(slots[instr->a]), slots + instr->a, instr->b)) {
                         return INTERPRET_RUNTIME_ERROR;
                     }
-                    concatenateArrays();
-                } else {
-                    ARITH_BIN_OP(+);
+                    if (!frame->pc || frame->function->reg->native) {
+                        // Other tiers finish the call on their own, then it returns like REG_RETURN
+                        InterpretResult result = runCallee(frame);
+                        if (result != INTERPRET_OK) {
+                            return result;
+                        }
+                        if (vm.frameCount == baseFrame) {
+                            return INTERPRET_OK;
+                        }
+                    }
+                    LOAD_FRAME();
+                    break;
                 }
+                // Natives return normally, through the REG_RETURN after this
+                // fall through
+            case REG_CALL: {
+                // Callee and arguments already sit in consecutive registers, like on the stack
+                int argCount = instr->b;
+                vm.stackTop = slots + instr->a + argCount + 1;
+                int offset = reg->offsets[instr - reg->code];
+                if (!callSite(&frame->function->chunk, offset, slots[instr->a], argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // A native already left its result in slots[instr->a], other tiers will too
+                CallFrame* callee = FRAME(vm.frameCount - 1);
+                if (callee != frame && !(callee->pc && !callee->function->reg->native)) {
+                    InterpretResult result = runCallee(callee);
+                    if (result != INTERPRET_OK) {
+                        return result;
+                    }
+                }
+                LOAD_FRAME();
                 break;
             }
-            case OP_NEG: push(INTEGER_VAL(-1)); ARITH_BIN_OP(*); break;
-            case OP_SUB: ARITH_BIN_OP(-); break;
-            case OP_MUL: ARITH_BIN_OP(*); break;
-            case OP_DIV: {
-                if (IS_ZERO(peek(0))) {
-                    runtimeError("Ignoring division by zero! Returning infinity.");
-                    pop();
-                    pop();
-                    push(DOUBLE_VAL(INFINITY));
+            case REG_CALL_BUILTIN: {
+                // The arguments are read in place, scratch space is only needed once replaced
+                Builtin* builtin = &vm.builtins[instr->c];
+                int arity = builtin->native->arity;
+                if (builtin->replaced || (arity >= 0 && arity != instr->b)) {
+                    if (!regOp(frame, instr)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    LOAD_FRAME();
                     break;
                 }
-                ARITH_BIN_OP(/);
+                Value result = builtin->native->function(instr->b, slots + instr->a);
+                if (nativeFailed()) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // A native that called back into Lox, like bench(), may have moved the stack
+                slots = frame->slots;
+                slots[instr->a] = result;
                 break;
             }
-            case OP_BITAND: INT_BIN_OP(&); break;
-            case OP_BITOR: INT_BIN_OP(|); break;
-            case OP_BITXOR: INT_BIN_OP(^); break;
-            case OP_LEFT_SHIFT: INT_BIN_OP(<<); break;
-            // TODO arithmetic shift >>>
-            case OP_RIGHT_SHIFT: {
-                unsigned b = (unsigned)pop_int();
-                unsigned a = (unsigned)pop_int();
-                push(INTEGER_VAL(a >> b));
+            case REG_RETURN: {
+                Value result = RK(instr->b);
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    resetStack();
+                    return INTERPRET_OK;
+                }
+                // The callee's register 0 is the caller's register for the call
+                frame->slots[0] = result;
+                if (vm.frameCount == baseFrame) {
+                    vm.stackTop = frame->slots + 1;
+                    return INTERPRET_OK;
+                }
+                LOAD_FRAME();
                 break;
             }
-            case OP_REMAINDER: DOUBLE_BIN_OP(fmod); break;
-            case OP_EXP: DOUBLE_BIN_OP(pow); break;
-            case OP_NIL: push(NIL_VAL); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_INF: push(DOUBLE_VAL(INFINITY)); break;
-            case OP_NAN: push(DOUBLE_VAL(NAN)); break;
         }
     }
+#undef FAST_ARITH
+#undef LOAD_FRAME
+}
+
+#undef RK
+#undef K
+#undef LESS
+#undef GREATER
+#undef EQUAL
+
+// Lowers the script for --reg, then runs it on whichever VM its top-level code got
+static InterpretResult runScript(ObjFunction* func) {
+    if (REGISTER_VM) {
+        lowerFunctions(func);
+    }
+    char here;
+    vm.nativeStackBase = (uintptr_t)&here;
+    push(OBJ_VAL(func));
+    call(func, 0);
+    return FRAME(0)->pc ? run_reg(0) : run(0);
 }
 
 // This function takes ownership of chunk and will call freeChunk!
@@ -606,13 +2007,23 @@ InterpretResult interpretChunk(Chunk* chunk) {
     initVM();
     ObjString* name = copyString("interpretChunk", sizeof("interpretChunk"));
     ObjFunction* func = newFunction(name, chunk);
-    push(OBJ_VAL(func));
-    call(func, 0);
-    InterpretResult result = run();
+    InterpretResult result = runScript(func);
     freeVM();
     return result;
 }
 
+// The functions the script defines follow it, each after the one whose constant it is
+static void disFunctions(ObjFunction* function) {
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) {
+            ObjFunction* inner = AS_FUNCTION(constants->values[i]);
+            disChunk(&inner->chunk, inner->name ? inner->name->chars : "<fn>");
+            disFunctions(inner);
+        }
+    }
+}
+
 InterpretResult interpretOrPrint(const char* string, bool printOnly) {
     initVM();
     ObjFunction* func = compile(string);
@@ -621,12 +2032,53 @@ InterpretResult interpretOrPrint(const char* string, bool printOnly) {
     }
     if (printOnly) {
         disChunk(&func->chunk, "compileAndPrint");
+        disFunctions(func);
+        if (REGISTER_VM) {
+            lowerFunctions(func);
+            if (func->reg) {
+                disRegCode(func->reg, "compileAndPrint");
+            }
+        }
         freeVM();
         return INTERPRET_OK;
     }
-    push(OBJ_VAL(func));
-    call(func, 0);
-    InterpretResult result = run();
+    InterpretResult result = runScript(func);
+    freeVM();
+    return result;
+}
+
+// Run source, loading its bytecode from cacheFile when that matches and writing it there otherwise
+InterpretResult interpretCached(const char* source, const char* cacheFile) {
+    initVM();
+    uint64_t hash = cacheHash(source, strlen(source));
+    if (PROFILE_EVENTS) {
+        profileEnter("loadCache", "cache");
+    }
+    ObjFunction* func = loadCache(cacheFile, hash);
+    if (PROFILE_EVENTS) {
+        profileLeave();
+    }
+    if (func) {
+        if (DEBUG_TRACE) {
+            ERR_PRINT("====== Loaded bytecode from %s\n", cacheFile);
+        }
+    } else {
+        func = compile(source);
+        if (!func) {
+            return INTERPRET_COMPILE_ERROR;
+        }
+        if (PROFILE_EVENTS) {
+            profileEnter("writeCache", "cache");
+        }
+        bool written = writeCache(cacheFile, func, hash);
+        if (PROFILE_EVENTS) {
+            profileLeave();
+        }
+        if (!written) {
+            ERR_PRINT("Warning: could not write bytecode cache %s\n", cacheFile);
+        }
+    }
+    InterpretResult result = runScript(func);
     freeVM();
     return result;
 }
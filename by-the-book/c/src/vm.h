@@ -5,24 +5,49 @@
 #include "value.h"
 #include "object.h"
 #include "hashmap.h"
+#include "regcode.h"
 
-#define FRAMES_MAX 256
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Recursion limit, the frames and the stack start small and grow on demand up to it
+#define FRAMES_MAX (1 << 16)
+// Frames are allocated in blocks that never move, CallFrame pointers stay valid as more are added
+#define FRAME_BLOCK 64
+// Stack slots a frame may use above its deepest expression or registers, for natives and transients
+#define FRAME_SCRATCH UINT8_COUNT
+#define STACK_INITIAL (4 * UINT8_COUNT)
+// Calls between tiers and from machine code recurse in C, whose stack runs out before FRAMES_MAX
+#define NATIVE_STACK_MAX (4 * 1024 * 1024)
 
-typedef struct {
+typedef struct CallFrame {
     ObjFunction* function;
     uint8_t* ip;
+    RegInstr* pc; // Instead of ip when the function has register code
     Value* slots;
 } CallFrame;
 
+// A native the compiler may call without looking up its global, see OP_CALL_BUILTIN
+typedef struct {
+    ObjNative* native;
+    bool replaced; // Its global was assigned, calls have to go through the global again
+} Builtin;
+
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame** frameBlocks;
+    int frameBlockCount;
     int frameCount;
-    Value stack[STACK_MAX];
+    // Only call() grows the stack, reserving all a new frame can use, so push() needs no check.
+    // The stack moves when it grows, frame->slots is fixed up but other pointers into it are not.
+    Value* stack;
+    Value* stackEnd;
     Value* stackTop;
+    uintptr_t nativeStackBase;
     Obj* objects;
     hashmap_t globals;
     hashmap_t strings;
+    Builtin* builtins; // In the order initVM() defines them, which compiled code relies on
+    int builtinCount;
+    int builtinCapacity;
+    ObjString* typeNames[VAL_BIGINT + 1]; // What type() returns, allocated once
+    bool nativeError; // Set by a native whose call back into Lox failed, the frames are already unwound
 } VM;
 
 typedef enum {
@@ -31,14 +56,39 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
+// Instrumentation the stack VM runs before each instruction, any combination of them
+typedef enum {
+    HOOK_TRACE = 1 << 0,   // Print the stack and disassemble the instruction, --debug
+    HOOK_PROFILE = 1 << 1, // profileOp(), for the profiling modes that look at instructions
+} Hook;
+
 extern VM vm;
 
+#define FRAME(i) (&vm.frameBlocks[(i) / FRAME_BLOCK][(i) % FRAME_BLOCK])
+
 void initVM(void);
+// Bump LOXC_VERSION in cache.h when the order of builtins changes
+void defineNative(const char* name, int arity, NativeFn function);
 void freeVM(void);
 InterpretResult interpretOrPrint(const char* string, bool onlyPrint);
 InterpretResult interpret(const char* string);
+InterpretResult interpretCached(const char* source, const char* cacheFile);
 InterpretResult interpretChunk(Chunk* chunk);
 void push(Value value);
 Value pop(void);
+// Replaces the two strings on top of the stack with the interned string of both
+void concatenate(void);
+// Switches run() to the dispatch table that calls these hooks before each instruction, or back to
+// the one without any checks when hooks is 0. Takes effect at the next instruction, and may be
+// called from a signal handler. The other tiers are not hooked.
+void setHooks(int hooks);
+int getHooks(void);
+// Bytecode offset of the instruction the frame is executing, whichever VM runs it
+int frameOffset(CallFrame* frame);
+
+// Register VM steps that code from the JIT calls into, false after a runtime error
+bool regOp(CallFrame* frame, RegInstr* instr);
+bool regCompare(CallFrame* frame, RegInstr* instr);
+bool regCall(CallFrame* frame, RegInstr* instr);
 
 #endif
@@ -0,0 +1,217 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "x64.h"
+#include "memory.h"
+
+void initAssembler(Assembler* as, int labelCount) {
+    *as = (Assembler){0};
+    as->labels = ALLOCATE(int, labelCount);
+    as->labelCount = labelCount;
+}
+
+void freeAssembler(Assembler* as) {
+    FREE_ARRAY(uint8_t, as->code, as->capacity);
+    FREE_ARRAY(int, as->labels, as->labelCount);
+    FREE_ARRAY(AsmPatch, as->patches, as->patchCapacity);
+    *as = (Assembler){0};
+}
+
+void asmByte(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        int old = as->capacity;
+        as->capacity = GROW_CAPACITY(old);
+        as->code = GROW_ARRAY(uint8_t, as->code, old, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+void asmBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) {
+        asmByte(as, bytes[i]);
+    }
+}
+
+void asm32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        asmByte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void asm64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        asmByte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void rex(Assembler* as, bool wide, int reg, int base) {
+    uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+    if (prefix != 0x40) {
+        asmByte(as, prefix);
+    }
+}
+
+// ModRM with a 32-bit displacement, rsp and r12 as a base need a SIB byte
+static void modrmMem(Assembler* as, int reg, Mem mem) {
+    asmByte(as, 0x80 | (reg & 7) << 3 | (mem.base & 7));
+    if ((mem.base & 7) == 4) {
+        asmByte(as, 0x24);
+    }
+    asm32(as, (uint32_t)mem.disp);
+}
+
+static void modrmReg(Assembler* as, int reg, int rm) {
+    asmByte(as, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void asmLoad(Assembler* as, X64Reg reg, Mem mem) {
+    rex(as, true, reg, mem.base);
+    asmByte(as, 0x8b);
+    modrmMem(as, reg, mem);
+}
+
+void asmStore(Assembler* as, Mem mem, X64Reg reg) {
+    rex(as, true, reg, mem.base);
+    asmByte(as, 0x89);
+    modrmMem(as, reg, mem);
+}
+
+void asmAlu(Assembler* as, uint8_t opcode, X64Reg reg, Mem mem) {
+    rex(as, true, reg, mem.base);
+    asmByte(as, opcode);
+    modrmMem(as, reg, mem);
+}
+
+void asmAluReg(Assembler* as, uint8_t opcode, X64Reg to, X64Reg from) {
+    rex(as, true, from, to);
+    asmByte(as, opcode);
+    modrmReg(as, from, to);
+}
+
+void asmImul(Assembler* as, X64Reg reg, Mem mem) {
+    rex(as, true, reg, mem.base);
+    asmBytes(as, (uint8_t[]){0x0f, 0xaf}, 2);
+    modrmMem(as, reg, mem);
+}
+
+void asmImulReg(Assembler* as, X64Reg to, X64Reg from) {
+    rex(as, true, to, from);
+    asmBytes(as, (uint8_t[]){0x0f, 0xaf}, 2);
+    modrmReg(as, to, from);
+}
+
+void asmMovImm64(Assembler* as, X64Reg reg, uint64_t value) {
+    rex(as, true, 0, reg);
+    asmByte(as, 0xb8 + (reg & 7));
+    asm64(as, value);
+}
+
+void asmSse(Assembler* as, uint8_t prefix, uint8_t opcode, int xmm, Mem mem) {
+    asmByte(as, prefix);
+    rex(as, false, xmm, mem.base);
+    asmBytes(as, (uint8_t[]){0x0f, opcode}, 2);
+    modrmMem(as, xmm, mem);
+}
+
+void asmSseReg(Assembler* as, uint8_t prefix, uint8_t opcode, int xmm, int from, bool wide) {
+    asmByte(as, prefix);
+    rex(as, wide, xmm, from);
+    asmBytes(as, (uint8_t[]){0x0f, opcode}, 2);
+    modrmReg(as, xmm, from);
+}
+
+void asmMovqToXmm(Assembler* as, int xmm, X64Reg from) {
+    asmSseReg(as, 0x66, 0x6e, xmm, from, true);
+}
+
+void asmMovqFromXmm(Assembler* as, X64Reg to, int xmm) {
+    asmSseReg(as, 0x66, 0x7e, xmm, to, true);
+}
+
+Mem typeOf(Mem value) {
+    return (Mem){value.base, value.disp + (int32_t)offsetof(Value, type)};
+}
+
+Mem payloadOf(Mem value) {
+    return (Mem){value.base, value.disp + (int32_t)offsetof(Value, as)};
+}
+
+void asmStoreType(Assembler* as, Mem value, ValueType type) {
+    Mem mem = typeOf(value);
+    rex(as, false, 0, mem.base);
+    asmByte(as, 0xc7);
+    modrmMem(as, 0, mem);
+    asm32(as, type);
+}
+
+void asmCmp32(Assembler* as, Mem mem, int8_t value) {
+    rex(as, false, 0, mem.base);
+    asmByte(as, 0x83);
+    modrmMem(as, 7, mem);
+    asmByte(as, (uint8_t)value);
+}
+
+void asmCmpType(Assembler* as, Mem value, ValueType type) {
+    asmCmp32(as, typeOf(value), (int8_t)type);
+}
+
+int asmJcc(Assembler* as, X64Cond cond) {
+    asmBytes(as, (uint8_t[]){0x0f, 0x80 | cond}, 2);
+    asm32(as, 0);
+    return as->count - 4;
+}
+
+int asmJmp(Assembler* as) {
+    asmByte(as, 0xe9);
+    asm32(as, 0);
+    return as->count - 4;
+}
+
+void asmBind(Assembler* as, int at) {
+    int32_t rel = as->count - (at + 4);
+    memcpy(as->code + at, &rel, sizeof(rel));
+}
+
+static void patchLabel(Assembler* as, int at, int label) {
+    if (as->patchCapacity < as->patchCount + 1) {
+        int old = as->patchCapacity;
+        as->patchCapacity = GROW_CAPACITY(old);
+        as->patches = GROW_ARRAY(AsmPatch, as->patches, old, as->patchCapacity);
+    }
+    as->patches[as->patchCount++] = (AsmPatch){at, label};
+}
+
+void asmJccLabel(Assembler* as, X64Cond cond, int label) {
+    patchLabel(as, asmJcc(as, cond), label);
+}
+
+void asmJmpLabel(Assembler* as, int label) {
+    patchLabel(as, asmJmp(as), label);
+}
+
+void asmPatchLabels(Assembler* as) {
+    for (int i = 0; i < as->patchCount; i++) {
+        int at = as->patches[i].at;
+        int32_t rel = as->labels[as->patches[i].label] - (at + 4);
+        memcpy(as->code + at, &rel, sizeof(rel));
+    }
+}
+
+void* asmInstall(Assembler* as) {
+    size_t size = (size_t)as->count;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(memory, as->code, size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+    return memory;
+}
+
+void asmRelease(void* memory, size_t size) {
+    munmap(memory, size);
+}
@@ -0,0 +1,129 @@
+#ifndef clox_x64_h
+#define clox_x64_h
+
+#include "common.h"
+#include "value.h"
+
+// A small x86-64 assembler for the JITs, just the instructions they emit.
+// Memory operands are always [base + disp32].
+
+typedef enum {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+} X64Reg;
+
+// Condition codes for jcc and setcc, flipping the low bit negates one
+typedef enum {
+    CC_O = 0x0,
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+} X64Cond;
+
+// Second opcode byte of the sd instructions after F2 0F, and ucomisd after 66 0F
+#define MOVSD_LOAD 0x10
+#define MOVSD_STORE 0x11
+#define CVTSI2SD 0x2a
+#define UCOMISD 0x2e
+#define ADDSD 0x58
+#define MULSD 0x59
+#define SUBSD 0x5c
+#define DIVSD 0x5e
+
+// First opcode byte of the "op r/m64, r64" forms
+#define ALU_ADD 0x01
+#define ALU_SUB 0x29
+#define ALU_CMP 0x39
+#define ALU_MOV 0x89
+
+typedef struct {
+    X64Reg base;
+    int32_t disp;
+} Mem;
+
+typedef struct {
+    int at;    // rel32 to patch
+    int label;
+} AsmPatch;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+    int* labels; // Native offset of each label, filled in by the caller
+    int labelCount;
+    AsmPatch* patches;
+    int patchCount;
+    int patchCapacity;
+} Assembler;
+
+void initAssembler(Assembler* as, int labelCount);
+void freeAssembler(Assembler* as);
+
+void asmByte(Assembler* as, uint8_t byte);
+void asmBytes(Assembler* as, const uint8_t* bytes, int count);
+void asm32(Assembler* as, uint32_t value);
+void asm64(Assembler* as, uint64_t value);
+
+// mov reg, qword [mem] and back
+void asmLoad(Assembler* as, X64Reg reg, Mem mem);
+void asmStore(Assembler* as, Mem mem, X64Reg reg);
+// op reg, qword [mem] where opcode is the "op r64, r/m64" form: 03 add, 2B sub, 3B cmp
+void asmAlu(Assembler* as, uint8_t opcode, X64Reg reg, Mem mem);
+// op to, from with one of the ALU_ opcodes
+void asmAluReg(Assembler* as, uint8_t opcode, X64Reg to, X64Reg from);
+// cmp dword [mem], value
+void asmCmp32(Assembler* as, Mem mem, int8_t value);
+void asmImul(Assembler* as, X64Reg reg, Mem mem);
+void asmImulReg(Assembler* as, X64Reg to, X64Reg from);
+void asmMovImm64(Assembler* as, X64Reg reg, uint64_t value);
+// prefix 0F opcode xmm, [mem]
+void asmSse(Assembler* as, uint8_t prefix, uint8_t opcode, int xmm, Mem mem);
+// prefix 0F opcode xmm, xmm/r64, wide sets REX.W as cvtsi2sd from a r64 needs
+void asmSseReg(Assembler* as, uint8_t prefix, uint8_t opcode, int xmm, int from, bool wide);
+// movq xmm, r64 and movq r64, xmm
+void asmMovqToXmm(Assembler* as, int xmm, X64Reg from);
+void asmMovqFromXmm(Assembler* as, X64Reg to, int xmm);
+
+// The two halves of a Value
+Mem typeOf(Mem value);
+Mem payloadOf(Mem value);
+// mov dword [value.type], type and cmp dword [value.type], type
+void asmStoreType(Assembler* as, Mem value, ValueType type);
+void asmCmpType(Assembler* as, Mem value, ValueType type);
+
+// Forward jumps within a template, the rel32 is bound once its target is emitted
+int asmJcc(Assembler* as, X64Cond cond);
+int asmJmp(Assembler* as);
+void asmBind(Assembler* as, int at);
+// Jumps to labels, resolved by asmPatchLabels() once every label is placed
+void asmJccLabel(Assembler* as, X64Cond cond, int label);
+void asmJmpLabel(Assembler* as, int label);
+void asmPatchLabels(Assembler* as);
+
+// Copies the code into fresh executable memory, NULL if the system refuses
+void* asmInstall(Assembler* as);
+void asmRelease(void* memory, size_t size);
+
+#endif
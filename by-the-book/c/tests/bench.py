@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Run the workloads in tests/benchmarks against clox, and Lua and Python where they have a script too.
+
+Each workload runs --runs times per implementation. The wall times are summarized as
+min, median and mean seconds, and --json writes them out. With --baseline the clox
+medians are compared to that of an earlier --json file. The exit status is 1 when one
+is slower by more than --threshold percent.
+
+    ./tests/bench.py --json before.json
+    ./tests/bench.py --baseline before.json --threshold 5 fib hashmaps
+    ./tests/bench.py --bin "./main --no-jit" --only-clox
+"""
+import argparse
+import json
+import os
+import shlex
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+BENCHMARKS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "benchmarks")
+# Implementation name, script extension, command
+OTHERS = [
+    ("lua", ".lua", ["lua"]),
+    ("python3", ".py", ["python3"]),
+]
+
+
+def workloads(names):
+    found = sorted(f[:-len(".lox")] for f in os.listdir(BENCHMARKS) if f.endswith(".lox"))
+    for name in names:
+        if name not in found:
+            sys.exit(f"Unknown workload {name}, there are: {' '.join(found)}")
+    return names or found
+
+
+def measure(command, runs):
+    """Wall time of each run in seconds, and the first line printed, or None if a run failed."""
+    times = []
+    first = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+        times.append(time.perf_counter() - start)
+        if result.returncode != 0:
+            print(f"  {' '.join(command)} exited with {result.returncode}", file=sys.stderr)
+            return None, None
+        first = (result.stdout.splitlines() or [""])[0]
+    return times, first
+
+
+def summarize(times):
+    return {
+        "runs": times,
+        "min": min(times),
+        "median": statistics.median(times),
+        "mean": statistics.mean(times),
+    }
+
+
+def run(args):
+    binary = shlex.split(args.bin)
+    results = {}
+    for name in workloads(args.workloads):
+        script = os.path.join(BENCHMARKS, name)
+        commands = [("clox", binary + [script + ".lox"])]
+        if not args.only_clox:
+            for impl, extension, command in OTHERS:
+                if os.path.exists(script + extension) and shutil.which(command[0]):
+                    commands.append((impl, command + [script + extension]))
+        results[name] = {}
+        outputs = {}
+        for impl, command in commands:
+            times, first = measure(command, args.runs)
+            if times is None:
+                continue
+            results[name][impl] = summarize(times)
+            outputs[impl] = first
+            print(f"{name:12} {impl:8} median {results[name][impl]['median']:8.3f}s"
+                  f"  min {results[name][impl]['min']:8.3f}s")
+        # Every implementation computes the same thing, their first lines should agree
+        if len(set(outputs.values())) > 1:
+            print(f"{name:12} WARNING: outputs differ: {outputs}")
+    return results
+
+
+def compare(results, baseline, threshold):
+    """Print clox medians against the baseline's, return the workloads that got slower."""
+    regressions = []
+    print(f"\n{'workload':12} {'baseline':>10} {'now':>10} {'change':>8}")
+    for name, impls in results.items():
+        before = baseline.get("results", {}).get(name, {}).get("clox")
+        now = impls.get("clox")
+        if not before or not now:
+            continue
+        change = 100 * (now["median"] / before["median"] - 1)
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+        print(f"{name:12} {before['median']:9.3f}s {now['median']:9.3f}s {change:+7.1f}%{flag}")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("workloads", nargs="*", help="names of tests/benchmarks/*.lox, all by default")
+    parser.add_argument("--bin", default="./main", help="clox command, may include flags (default ./main)")
+    parser.add_argument("--runs", type=int, default=5, help="runs per workload and implementation (default 5)")
+    parser.add_argument("--only-clox", action="store_true", help="skip the Lua and Python scripts")
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--baseline", help="compare to the results in this file")
+    parser.add_argument("--threshold", type=float, default=10,
+                        help="percent a median may grow before it is a regression (default 10)")
+    args = parser.parse_args()
+
+    results = run(args)
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump({"bin": args.bin, "runs": args.runs, "results": results}, out, indent=2)
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.threshold):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
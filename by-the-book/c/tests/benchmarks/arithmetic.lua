@@ -0,0 +1,11 @@
+#!/usr/bin/env lua
+
+-- Integer and float arithmetic in a tight loop
+local sum = 0
+local x = 0.5
+for i = 0, 999999 do
+    sum = (sum + i * i % 7 + i // 3) % 1000003
+    x = x * 0.999 + 1.5
+end
+print(sum)
+print(x > 1000)
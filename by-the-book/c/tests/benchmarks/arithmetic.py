@@ -0,0 +1,10 @@
+#!/usr/bin/env python3
+
+# Integer and float arithmetic in a tight loop
+total = 0
+x = 0.5
+for i in range(1000000):
+    total = (total + i * i % 7 + i // 3) % 1000003
+    x = x * 0.999 + 1.5
+print(total)
+print("true" if x > 1000 else "false")
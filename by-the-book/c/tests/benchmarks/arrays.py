@@ -0,0 +1,15 @@
+#!/usr/bin/env python3
+
+# Appending to, indexing and concatenating arrays
+a = []
+for i in range(200000):
+    a.append(i % 100)
+total = 0
+for round in range(3):
+    for i in range(len(a)):
+        total = total + a[i]
+b = []
+for i in range(2000):
+    b = b + [i]
+print(total)
+print(len(b))
@@ -0,0 +1,15 @@
+#!/usr/bin/env lua
+
+-- Lookups in hashmap literals, and building small ones
+local numbers = {[0] = 0, [1] = 3, [2] = 6, [3] = 9, [4] = 12, [5] = 15, [6] = 18, [7] = 21, [8] = 24, [9] = 27, [10] = 30, [11] = 33, [12] = 36, [13] = 39, [14] = 42, [15] = 45, [16] = 48, [17] = 51, [18] = 54, [19] = 57, [20] = 60, [21] = 63, [22] = 66, [23] = 69}
+local names = {alpha = 1, beta = 2, gamma = 3, delta = 4}
+local keys = {"alpha", "beta", "gamma", "delta"}
+local sum = 0
+for i = 0, 299999 do
+    sum = sum + numbers[i % 24] + names[keys[i % 4 + 1]]
+end
+for i = 0, 49999 do
+    local point = {x = i, y = i + 2}
+    sum = sum + point.y - point.x
+end
+print(sum)
@@ -0,0 +1,13 @@
+#!/usr/bin/env python3
+
+# Lookups in hashmap literals, and building small ones
+numbers = {0: 0, 1: 3, 2: 6, 3: 9, 4: 12, 5: 15, 6: 18, 7: 21, 8: 24, 9: 27, 10: 30, 11: 33, 12: 36, 13: 39, 14: 42, 15: 45, 16: 48, 17: 51, 18: 54, 19: 57, 20: 60, 21: 63, 22: 66, 23: 69}
+names = {"alpha": 1, "beta": 2, "gamma": 3, "delta": 4}
+keys = ["alpha", "beta", "gamma", "delta"]
+total = 0
+for i in range(300000):
+    total = total + numbers[i % 24] + names[keys[i % 4]]
+for i in range(50000):
+    point = {"x": i, "y": i + 2}
+    total = total + point["y"] - point["x"]
+print(total)
@@ -0,0 +1,12 @@
+#!/usr/bin/env python3
+
+# Substrings
+text = "the quick brown fox jumps over the lazy dog"
+piece = None
+count = 0
+for i in range(300000):
+    start = i % 40
+    piece = text[start:start + 3]
+    count = count + 1
+print(count)
+print(piece)
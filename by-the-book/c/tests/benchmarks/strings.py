@@ -0,0 +1,13 @@
+#!/usr/bin/env python3
+
+# Concatenating, comparing and measuring strings
+words = ["alpha", "beta", "gamma", "delta", "epsilon"]
+total = 0
+matches = 0
+for i in range(200000):
+    s = words[i % 5] + "-" + words[(i + 2) % 5]
+    if s == "gamma-epsilon":
+        matches = matches + 1
+    total = total + len(s)
+print(total)
+print(matches)